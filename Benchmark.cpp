@@ -0,0 +1,992 @@
+#include "PizzaShop.h"
+#include <iostream>
+#include <chrono>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include <atomic>
+#include <sstream>
+#include <new>
+#include <algorithm>
+#include <thread>
+#include <map>
+#include <memory>
+#include <filesystem>
+#include <fstream>
+
+typedef std::chrono::steady_clock Clock;
+
+// Global allocation counter so benchmarks can report heap traffic. GCC
+// flags the malloc/free pairing in replacement operators as a mismatch.
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+#endif
+std::atomic<size_t> allocationCount(0);
+
+void* operator new(size_t size) {
+    allocationCount++;
+    void* ptr = std::malloc(size == 0 ? 1 : size);
+    if (ptr == nullptr) throw std::bad_alloc();
+    return ptr;
+}
+
+void operator delete(void* ptr) noexcept {
+    std::free(ptr);
+}
+
+void operator delete(void* ptr, size_t) noexcept {
+    std::free(ptr);
+}
+
+double elapsedMs(Clock::time_point start) {
+    return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+}
+
+// Keeps a benchmarked result alive without the compiler seeing through it
+template <typename T>
+inline void doNotOptimize(const T& value) {
+    asm volatile("" : : "r,m"(value) : "memory");
+}
+
+// Builds count orders with a rotating mix of factory pizzas and discounts
+std::vector<PlaceOrder*> buildOrders(size_t count) {
+    std::vector<PlaceOrder*> orders;
+    orders.reserve(count);
+    for (size_t i = 0; i < count; i++) {
+        PlaceOrder* order = new PlaceOrder();
+        switch (i % 4) {
+            case 0: order->addPizza(PizzaFactory::createPepperoniPizza()); break;
+            case 1: order->addPizza(PizzaFactory::addExtraCheese(PizzaFactory::createVegetarianPizza())); break;
+            case 2: order->addPizza(PizzaFactory::createMeatLoversPizza()); break;
+            default: order->addPizza(PizzaFactory::addStuffedCrust(PizzaFactory::createVegetarianDeluxePizza())); break;
+        }
+        if (i % 3 == 1) order->setDiscountStrategy(new BulkDiscount());
+        if (i % 3 == 2) order->setDiscountStrategy(new FamilyDiscount());
+        orders.push_back(order);
+    }
+    return orders;
+}
+
+void benchBatchPricing(size_t maxOrders) {
+    std::cout << "\n=== Batch Pricing: serial loop vs BatchPricer ===\n";
+    
+    WorkStealingPool pool;
+    BatchPricer pricer(pool);
+    std::cout << "Worker threads: " << pool.size() << std::endl;
+    
+    for (size_t count = 10000; count <= maxOrders; count *= 10) {
+        std::vector<PlaceOrder*> orders = buildOrders(count);
+        
+        Clock::time_point start = Clock::now();
+        std::vector<Money> serial(orders.size());
+        for (size_t i = 0; i < orders.size(); i++) {
+            serial[i] = orders[i]->getTotal();
+        }
+        double serialMs = elapsedMs(start);
+        
+        start = Clock::now();
+        std::vector<Money> batched = pricer.priceOrders(orders);
+        double batchMs = elapsedMs(start);
+        
+        bool identical = serial == batched;
+        std::cout << count << " orders: serial " << serialMs << " ms, batch " << batchMs
+                  << " ms, speedup " << (serialMs / batchMs) << "x, totals "
+                  << (identical ? "bit-identical" : "DIFFER") << std::endl;
+        
+        for (auto order : orders) {
+            delete order;
+        }
+    }
+}
+
+void benchBatchedDiscounts() {
+    std::cout << "\n=== Discounts: per-price virtual call vs batched kernel ===\n";
+    
+    const size_t count = 1000000;
+    std::vector<Money> prices(count);
+    for (size_t i = 0; i < count; i++) {
+        prices[i] = Money(50.0 + (i % 400) * 0.25);
+    }
+    std::vector<Money> scalar(count);
+    std::vector<Money> batched(count);
+    
+    BulkDiscount bulk;
+    FamilyDiscount family;
+    DiscountStrategy* strategies[] = {&bulk, &family};
+    
+    for (auto strategy : strategies) {
+        Clock::time_point start = Clock::now();
+        for (size_t i = 0; i < count; i++) {
+            scalar[i] = strategy->applyDiscount(prices[i]);
+        }
+        double scalarMs = elapsedMs(start);
+        
+        start = Clock::now();
+        strategy->applyDiscount(prices.data(), batched.data(), count);
+        double batchMs = elapsedMs(start);
+        
+        std::cout << strategy->getStrategyName() << ": scalar " << scalarMs << " ms, batched " << batchMs
+                  << " ms, results " << (scalar == batched ? "bit-identical" : "DIFFER") << std::endl;
+    }
+}
+
+class NullObserver : public Observer {
+public:
+    std::atomic<long> count;
+    NullObserver() : count(0) {}
+    void update(const std::string& message) override {
+        count += static_cast<long>(message.size() > 0);
+    }
+};
+
+void benchObserverFanOut() {
+    std::cout << "\n=== Menu fan-out: synchronous vs NotificationDispatcher ===\n";
+    
+    const size_t observerCount = 50000;
+    const int pizzaCount = 20;
+    std::vector<NullObserver> observers(observerCount);
+    std::vector<PizzaPtr> pizzas;
+    for (int i = 0; i < pizzaCount; i++) {
+        pizzas.push_back(PizzaFactory::createMenuPizza<MenuRecipes::Pepperoni>());
+    }
+    
+    PizzaMenu syncMenu;
+    PizzaMenu asyncMenu;
+    for (auto& observer : observers) {
+        syncMenu.addObserver(&observer);
+        asyncMenu.addObserver(&observer);
+    }
+    
+    Clock::time_point start = Clock::now();
+    for (const auto& pizza : pizzas) {
+        syncMenu.addPizza(pizza.get());
+    }
+    double syncMs = elapsedMs(start);
+    
+    NotificationDispatcher dispatcher;
+    asyncMenu.setDispatcher(&dispatcher);
+    start = Clock::now();
+    for (const auto& pizza : pizzas) {
+        asyncMenu.addPizza(pizza.get());
+    }
+    double callerMs = elapsedMs(start);
+    dispatcher.flush();
+    double drainedMs = elapsedMs(start);
+    
+    std::cout << pizzaCount << " additions x " << observerCount << " observers: synchronous " << syncMs
+              << " ms, async caller " << callerMs << " ms, async drained " << drainedMs << " ms in "
+              << dispatcher.getBatchesDelivered() << " batches" << std::endl;
+}
+
+void benchMenuChurn() {
+    std::cout << "\n=== Menu churn at 100k entries ===\n";
+    
+    const size_t count = 100000;
+    std::vector<PizzaPtr> pizzas;
+    for (size_t i = 0; i < count; i++) {
+        pizzas.push_back(PizzaFactory::createMenuPizza<MenuRecipes::Vegetarian>());
+    }
+    std::vector<NullObserver> observers(count);
+    
+    PizzaMenu menu;
+    Clock::time_point start = Clock::now();
+    for (const auto& pizza : pizzas) {
+        menu.addPizza(pizza.get());
+    }
+    double addMs = elapsedMs(start);
+    
+    // Remove from the middle outwards, the worst case for a shifting vector
+    start = Clock::now();
+    for (size_t i = 0; i < count; i++) {
+        menu.removePizza(pizzas[(i * 7919) % count].get());
+    }
+    double removeMs = elapsedMs(start);
+    
+    start = Clock::now();
+    for (auto& observer : observers) {
+        menu.addObserver(&observer);
+    }
+    for (size_t i = 0; i < count; i++) {
+        menu.removeObserver(&observers[(i * 7919) % count]);
+    }
+    double observerMs = elapsedMs(start);
+    
+    std::cout << count << " pizzas: add " << addMs << " ms, remove " << removeMs << " ms; "
+              << count << " observers add+remove " << observerMs << " ms" << std::endl;
+}
+
+// Readers render the menu through MenuReader (or ask the locked
+// getPizzaCount) while one writer edits it every 100 microseconds
+void benchMenuSnapshots() {
+    std::cout << "\n=== Menu reads under edits: snapshots vs locked reads ===\n";
+    
+    std::vector<PizzaPtr> pizzas;
+    PizzaMenu menu;
+    for (size_t i = 0; i < 1000; i++) {
+        pizzas.push_back(PizzaFactory::createMenuPizza<MenuRecipes::Vegetarian>());
+        menu.addPizza(pizzas.back().get());
+    }
+    const char* labels[] = {"locked", "snapshot"};
+    for (size_t readerCount = 1; readerCount <= 4; readerCount *= 2) {
+        for (int useSnapshots = 0; useSnapshots < 2; useSnapshots++) {
+            std::atomic<bool> stop(false);
+            std::atomic<size_t> reads(0);
+            std::vector<std::thread> readers;
+            for (size_t r = 0; r < readerCount; r++) {
+                readers.emplace_back([&menu, &stop, &reads, useSnapshots] {
+                    MenuReader reader(menu);
+                    size_t done = 0;
+                    size_t listed = 0;
+                    while (!stop.load(std::memory_order_relaxed)) {
+                        listed += useSnapshots ? reader.current().size() : menu.getPizzaCount();
+                        done++;
+                    }
+                    doNotOptimize(listed);
+                    reads += done;
+                });
+            }
+            Clock::time_point start = Clock::now();
+            size_t edits = 0;
+            while (elapsedMs(start) < 200) {
+                Pizza* pizza = pizzas[(edits * 7919) % pizzas.size()].get();
+                menu.removePizza(pizza);
+                menu.addPizza(pizza);
+                edits += 2;
+                std::this_thread::sleep_for(std::chrono::microseconds(100));
+            }
+            stop = true;
+            for (auto& reader : readers) {
+                reader.join();
+            }
+            double seconds = elapsedMs(start) / 1000;
+            std::cout << readerCount << " readers, " << labels[useSnapshots] << ": " << (reads / seconds)
+                      << " reads/s with " << (edits / seconds) << " edits/s" << std::endl;
+        }
+    }
+}
+
+void benchPizzaAllocations() {
+    std::cout << "\n=== Factory pizzas: heap allocations per build ===\n";
+    
+    const size_t count = 100000;
+    const char* names[] = {"Pepperoni", "Vegetarian", "Meat Lovers", "Vegetarian Deluxe",
+                           "Pepperoni + Extra Cheese", "Meat Lovers + Cheese + Crust", "Recipe Vegetarian Deluxe"};
+    std::function<PizzaPtr()> builders[] = {
+        PizzaFactory::createPepperoniPizza,
+        PizzaFactory::createVegetarianPizza,
+        PizzaFactory::createMeatLoversPizza,
+        PizzaFactory::createVegetarianDeluxePizza,
+        [] { return PizzaFactory::addExtraCheese(PizzaFactory::createPepperoniPizza()); },
+        [] { return PizzaFactory::addStuffedCrust(PizzaFactory::addExtraCheese(PizzaFactory::createMeatLoversPizza())); },
+        PizzaFactory::createMenuPizza<MenuRecipes::VegetarianDeluxe>
+    };
+    
+    std::vector<PizzaPtr> pizzas(count);
+    for (size_t b = 0; b < sizeof(builders) / sizeof(builders[0]); b++) {
+        builders[b]();
+        size_t allocationsBefore = allocationCount;
+        Clock::time_point start = Clock::now();
+        for (size_t i = 0; i < count; i++) {
+            pizzas[i] = builders[b]();
+        }
+        double buildMs = elapsedMs(start);
+        size_t allocations = allocationCount - allocationsBefore;
+        
+        start = Clock::now();
+        for (auto& pizza : pizzas) {
+            pizza.reset();
+        }
+        double freeMs = elapsedMs(start);
+        std::cout << names[b] << ": " << (double(allocations) / count) << " allocations, build "
+                  << (buildMs * 1e6 / count) << " ns, free " << (freeMs * 1e6 / count) << " ns per pizza" << std::endl;
+    }
+}
+
+// Alternates Extra Cheese and Stuffed Crust, as nested decorators or as one inline stack
+PizzaPtr buildAddOns(size_t depth, bool inlineStack) {
+    PizzaPtr pizza = PizzaFactory::createPepperoniPizza();
+    for (size_t d = 0; d < depth; d++) {
+        if (inlineStack) {
+            pizza = d % 2 == 0 ? PizzaFactory::addExtraCheese(std::move(pizza)) : PizzaFactory::addStuffedCrust(std::move(pizza));
+        } else if (d % 2 == 0) {
+            pizza = makePizza<ExtraCheese>(std::move(pizza));
+        } else {
+            pizza = makePizza<StuffedCrust>(std::move(pizza));
+        }
+    }
+    return pizza;
+}
+
+void benchAddOnStacks() {
+    std::cout << "\n=== Add-ons: decorator chain vs inline stack ===\n";
+    
+    const size_t builds = 20000;
+    const size_t calls = 200000;
+    const char* labels[] = {"decorators", "inline"};
+    for (size_t depth = 1; depth <= 16; depth *= 2) {
+        double buildNs[2], priceNs[2], nameNs[2];
+        size_t allocations[2];
+        for (int variant = 0; variant < 2; variant++) {
+            bool inlineStack = variant == 1;
+            size_t allocationsBefore = allocationCount;
+            Clock::time_point start = Clock::now();
+            for (size_t i = 0; i < builds; i++) {
+                PizzaPtr pizza = buildAddOns(depth, inlineStack);
+                doNotOptimize(pizza.get());
+            }
+            buildNs[variant] = elapsedMs(start) * 1e6 / builds;
+            allocations[variant] = (allocationCount - allocationsBefore) / builds;
+            
+            PizzaPtr pizza = buildAddOns(depth, inlineStack);
+            Money sum;
+            start = Clock::now();
+            for (size_t i = 0; i < calls; i++) {
+                sum += pizza->getPrice();
+            }
+            priceNs[variant] = elapsedMs(start) * 1e6 / calls;
+            doNotOptimize(sum);
+            
+            // appendName walks the nodes because the label is never cached here
+            std::string name;
+            start = Clock::now();
+            for (size_t i = 0; i < calls / 10; i++) {
+                name.clear();
+                pizza->appendName(name);
+                doNotOptimize(name.data());
+            }
+            nameNs[variant] = elapsedMs(start) * 1e6 / (calls / 10);
+        }
+        for (int variant = 0; variant < 2; variant++) {
+            std::cout << "Depth " << depth << " " << labels[variant] << ": build " << buildNs[variant] << " ns ("
+                      << allocations[variant] << " allocations), getPrice " << priceNs[variant] << " ns, appendName "
+                      << nameNs[variant] << " ns" << std::endl;
+        }
+        std::cout << "Depth " << depth << " speedup: getPrice " << (priceNs[0] / priceNs[1]) << "x, appendName "
+                  << (nameNs[0] / nameNs[1]) << "x, build " << (buildNs[0] / buildNs[1]) << "x" << std::endl;
+    }
+}
+
+void benchKitchenSimulation() {
+    std::cout << "\n=== Kitchen simulation: throughput by oven count ===\n";
+    
+    const unsigned int orderCount = 20000;
+    for (size_t ovens = 1; ovens <= 8; ovens *= 2) {
+        KitchenMetrics metrics;
+        {
+            Kitchen kitchen(ovens, 64, std::chrono::microseconds(20), std::chrono::microseconds(500));
+            for (unsigned int i = 1; i <= orderCount; i++) {
+                PlaceOrder* order = new PlaceOrder();
+                order->addPizza(PizzaFactory::createMenuPizza<MenuRecipes::MeatLovers>());
+                order->setRandomSeed(i * 2654435761u);
+                kitchen.submit(order);
+            }
+            kitchen.drain();
+            metrics = kitchen.getMetrics();
+        }
+        std::cout << ovens << " ovens: " << metrics.ordersPerSecond << " orders/s, " << metrics.retries
+                  << " retries, max depth started/pending/preparing " << metrics.maxQueueDepth[0] << "/"
+                  << metrics.maxQueueDepth[1] << "/" << metrics.maxQueueDepth[2] << std::endl;
+    }
+}
+
+void benchStateTransitions() {
+    std::cout << "\n=== Order state transitions ===\n";
+    
+    const size_t cycles = 1000000;
+    PlaceOrder order;
+    order.setRandomSeed(12345);
+    size_t transitions = 0;
+    size_t allocations = 0;
+    double ms = 0;
+    {
+        size_t allocationsBefore = allocationCount;
+        Clock::time_point start = Clock::now();
+        for (size_t i = 0; i < cycles; i++) {
+            while (order.getStatus() != "READY") {
+                order.processOrder();
+                transitions++;
+            }
+            order.setState(OrderStarted::instance());
+            transitions++;
+        }
+        ms = elapsedMs(start);
+        allocations = allocationCount - allocationsBefore;
+    }
+    
+    std::cout << transitions << " transitions in " << ms << " ms (" << (ms * 1e6 / transitions)
+              << " ns each), " << allocations << " allocations" << std::endl;
+}
+
+void benchEventSinks() {
+    std::cout << "\n=== Event sinks: 1M state-change events ===\n";
+    
+    const size_t events = 1000000;
+    EventSink* previous = EventLog::getSink();
+    std::ostringstream discard;
+    NullSink nullSink;
+    AsyncSink asyncSink(discard, 1 << 16);
+    EventSink* sinks[] = {&nullSink, &asyncSink};
+    const char* names[] = {"NullSink", "AsyncSink"};
+    
+    for (int s = 0; s < 2; s++) {
+        EventLog::setSink(sinks[s]);
+        Clock::time_point start = Clock::now();
+        for (size_t i = 0; i < events; i++) {
+            PIZZA_LOG(LOG_INFO, "Order state changed to: " << "PREPARING");
+        }
+        double callerMs = elapsedMs(start);
+        sinks[s]->flush();
+        std::cout << names[s] << ": caller " << callerMs << " ms, drained " << elapsedMs(start) << " ms" << std::endl;
+    }
+    EventLog::setSink(previous);
+}
+
+void benchJournalRecovery(size_t maxEvents) {
+    const size_t events = std::min<size_t>(10000000, maxEvents);
+    std::cout << "\n=== Order journal: " << events << " events ===\n";
+    
+    const std::string directory = "bench-journal";
+    const size_t writers = 4;
+    const size_t syncEvery = 64;
+    std::filesystem::remove_all(directory);
+    
+    std::string pepperoni, deluxe;
+    OrderSerializer::writePizza(PizzaFactory::createPepperoniPizza().get(), pepperoni);
+    OrderSerializer::writePizza(PizzaFactory::addExtraCheese(PizzaFactory::createVegetarianDeluxePizza()).get(), deluxe);
+    
+    // Each writer runs ten-event order lifecycles; three in four orders are closed
+    size_t syncs = 0;
+    double writeMs = 0;
+    {
+        OrderJournal journal(directory);
+        Clock::time_point start = Clock::now();
+        std::vector<std::thread> threads;
+        for (size_t w = 0; w < writers; w++) {
+            threads.emplace_back([&, w] {
+                const char pending = PHASE_PENDING, preparing = PHASE_PREPARING, ready = PHASE_READY, family = DISCOUNT_FAMILY;
+                size_t orders = events / 10 / writers;
+                for (size_t i = 0; i < orders; i++) {
+                    std::uint64_t id = i * writers + w + 1;
+                    journal.append(id, JOURNAL_ADD_PIZZA, pepperoni.data(), pepperoni.size());
+                    journal.append(id, JOURNAL_ADD_PIZZA, deluxe.data(), deluxe.size());
+                    journal.append(id, JOURNAL_SET_DISCOUNT, &family, 1);
+                    journal.append(id, JOURNAL_SET_STATE, &pending, 1);
+                    journal.append(id, JOURNAL_SET_STATE, &preparing, 1);
+                    journal.append(id, JOURNAL_SET_STATE, &pending, 1);
+                    journal.append(id, JOURNAL_CLEAR_ORDER);
+                    journal.append(id, JOURNAL_ADD_PIZZA, pepperoni.data(), pepperoni.size());
+                    journal.append(id, JOURNAL_SET_STATE, &ready, 1);
+                    std::uint64_t last = i % 4 == 0 ? journal.append(id, JOURNAL_SET_STATE, &preparing, 1) : journal.closeOrder(id);
+                    if (i % (syncEvery / 10) == 0) journal.sync(last);
+                }
+            });
+        }
+        for (auto& thread : threads) {
+            thread.join();
+        }
+        journal.sync();
+        writeMs = elapsedMs(start);
+        syncs = journal.getSyncCount();
+    }
+    std::cout << "Append: " << writeMs << " ms (" << (events / writeMs * 1000) << " events/s), "
+              << syncs << " group commits for " << (events / syncEvery) << " sync requests" << std::endl;
+    
+    size_t threadCounts[] = {1, 2, 4};
+    for (size_t threads : threadCounts) {
+        std::map<std::uint64_t, std::unique_ptr<PlaceOrder>> orders;
+        Clock::time_point start = Clock::now();
+        JournalRecoveryStats stats = OrderJournal::recover(directory, orders, threads);
+        double ms = elapsedMs(start);
+        std::cout << "Recover with " << threads << " thread(s): " << ms << " ms, " << stats.events << " events in "
+                  << stats.segments << " segments, " << stats.openOrders << " open orders" << std::endl;
+    }
+    std::filesystem::remove_all(directory);
+}
+
+void benchOrderIngest(size_t maxOrders) {
+    const size_t orders = std::min<size_t>(2000000, maxOrders * 2);
+    std::cout << "\n=== Order ingest: " << orders << " rows ===\n";
+    
+    const char* specs[] = {"pepperoni", "vegetarian+cheese", "meat-lovers+crust", "vegetarian-deluxe+cheese+crust"};
+    const char* discounts[] = {"regular", "bulk", "family"};
+    const char* paths[] = {"bench-orders.csv", "bench-orders.jsonl"};
+    {
+        std::ofstream csv(paths[0]);
+        std::ofstream jsonl(paths[1]);
+        csv << "order_id,pizzas,discount\n";
+        for (size_t i = 0; i < orders; i++) {
+            const char* first = specs[i % 4];
+            const char* second = specs[(i / 4) % 4];
+            const char* discount = discounts[i % 3];
+            csv << i << ',' << first << ';' << second << ',' << discount << '\n';
+            jsonl << "{\"id\": " << i << ", \"pizzas\": [\"" << first << "\", \"" << second
+                  << "\"], \"discount\": \"" << discount << "\"}\n";
+        }
+    }
+    
+    IngestFormat formats[] = {INGEST_CSV, INGEST_JSONL};
+    const char* names[] = {"CSV", "JSONL"};
+    size_t builderCounts[] = {1, 2, 4};
+    for (int f = 0; f < 2; f++) {
+        for (size_t builders : builderCounts) {
+            OrderIngester ingester(1024, 16, size_t(1) << 20, builders);
+            IngestStats stats = ingester.ingestFile(paths[f], formats[f]);
+            std::cout << names[f] << ", " << builders << " builder(s): " << stats.ordersPerSecond << " orders/s, "
+                      << (stats.bytesRead / stats.elapsedSeconds / 1e6) << " MB/s" << std::endl;
+            std::cout << "  parse->build full/empty waits " << stats.parsedQueue.fullWaits << "/" << stats.parsedQueue.emptyWaits
+                      << " (parser blocked " << stats.parsedQueue.producerBlockedMs << " ms), build->price "
+                      << stats.builtQueue.fullWaits << "/" << stats.builtQueue.emptyWaits
+                      << " (builders blocked " << stats.builtQueue.producerBlockedMs << " ms)" << std::endl;
+        }
+    }
+    std::remove(paths[0]);
+    std::remove(paths[1]);
+}
+
+void benchRuleDiscounts() {
+    std::cout << "\n=== Rule discounts: per-order cost vs rule count ===\n";
+    
+    const size_t orderCount = 20000;
+    const size_t rounds = 20;
+    std::vector<PlaceOrder*> orders = buildOrders(orderCount);
+    std::vector<Money> subtotals;
+    for (auto order : orders) {
+        subtotals.push_back(order->calculateSubtotal());
+    }
+    
+    const char* toppings[] = {"", "Pepperoni", "Mushrooms", "Cheese", "Salami", "Olives", "Onions", "Anchovies"};
+    const DiscountEffect effects[] = {PERCENT_OFF, AMOUNT_OFF, AMOUNT_OFF_EACH};
+    size_t ruleCounts[] = {1, 10, 100, 1000, 10000};
+    for (size_t ruleCount : ruleCounts) {
+        std::vector<DiscountRule> rules;
+        unsigned int seed = 42;
+        for (size_t i = 0; i < ruleCount; i++) {
+            seed = seed * 1103515245u + 12345u;
+            rules.push_back({"promo " + std::to_string(i), toppings[seed % 8], (seed >> 8) % 6,
+                             Money(double((seed >> 12) % 400)), effects[(seed >> 20) % 3], double(1 + (seed >> 24) % 20),
+                             (seed >> 16) % 16 == 0});
+        }
+        
+        Clock::time_point compileStart = Clock::now();
+        RuleDiscount engine(rules);
+        double compileMs = elapsedMs(compileStart);
+        
+        Money checksum;
+        Clock::time_point start = Clock::now();
+        for (size_t r = 0; r < rounds; r++) {
+            for (size_t i = 0; i < orderCount; i++) {
+                checksum += engine.applyDiscount(*orders[i], subtotals[i]);
+            }
+        }
+        double ms = elapsedMs(start);
+        std::cout << ruleCount << " rules: compile " << compileMs << " ms, " << (ms * 1e6 / (orderCount * rounds))
+                  << " ns/order (checksum " << checksum << ")" << std::endl;
+    }
+    
+    for (auto order : orders) {
+        delete order;
+    }
+}
+
+// Closed-loop POS clients over the Unix socket: each client runs whole
+// order sessions (create, two pizzas, discount, advance to READY, close)
+// and times every round trip. Stores are spread so every shard gets load.
+void benchOrderService(size_t sessionsPerClient) {
+    std::cout << "\n=== Order service: request latency by shard count ===\n";
+    
+    const std::string path = "pizzashop-bench.sock";
+    size_t cores = std::max(1u, std::thread::hardware_concurrency());
+    for (size_t shards = 1; shards <= std::max<size_t>(cores, 2); shards *= 2) {
+        size_t clientCount = 4 * shards;
+        OrderService service(shards);
+        OrderServer server(service, path);
+        server.start();
+        
+        std::vector<std::vector<double>> latencies(clientCount);
+        std::vector<std::thread> clients;
+        Clock::time_point start = Clock::now();
+        for (size_t c = 0; c < clientCount; c++) {
+            clients.emplace_back([&, c] {
+                OrderClient client(path);
+                std::vector<double>& samples = latencies[c];
+                auto timed = [&client, &samples](const ServiceRequest& request) {
+                    Clock::time_point sent = Clock::now();
+                    ServiceResponse response = client.call(request);
+                    samples.push_back(std::chrono::duration<double, std::micro>(Clock::now() - sent).count());
+                    return response;
+                };
+                for (size_t i = 0; i < sessionsPerClient; i++) {
+                    std::uint32_t store = static_cast<std::uint32_t>(c + i * clientCount);
+                    std::uint64_t id = timed(ServiceRequest{SERVICE_CREATE_ORDER, 0, 0, 0, store, 0}).orderId;
+                    timed(ServiceRequest{SERVICE_ADD_PIZZA, INGEST_PEPPERONI, SERVICE_EXTRA_CHEESE, 0, store, id});
+                    timed(ServiceRequest{SERVICE_ADD_PIZZA, static_cast<std::uint8_t>(i % 4), 0, 0, store, id});
+                    timed(ServiceRequest{SERVICE_SET_DISCOUNT, 0, 0, static_cast<std::uint8_t>(i % 3), store, id});
+                    ServiceResponse step;
+                    do {
+                        step = timed(ServiceRequest{SERVICE_ADVANCE, 0, 0, 0, store, id});
+                    } while (step.status == SERVICE_OK && step.phase != PHASE_READY);
+                    timed(ServiceRequest{SERVICE_CLOSE_ORDER, 0, 0, 0, store, id});
+                }
+            });
+        }
+        for (auto& client : clients) {
+            client.join();
+        }
+        double seconds = elapsedMs(start) / 1000;
+        server.stop();
+        
+        std::vector<double> all;
+        for (const auto& samples : latencies) {
+            all.insert(all.end(), samples.begin(), samples.end());
+        }
+        std::sort(all.begin(), all.end());
+        auto percentile = [&all](double p) { return all[std::min(all.size() - 1, static_cast<size_t>(p * all.size()))]; };
+        std::cout << shards << " shards, " << clientCount << " clients: " << all.size() << " requests, "
+                  << (all.size() / seconds) << " req/s, p50 " << percentile(0.50) << " us, p99 "
+                  << percentile(0.99) << " us" << std::endl;
+    }
+}
+
+OrderTask cookUntilReady(PlaceOrder& order) {
+    while (order.getStatus() != "READY") {
+        order.processOrder();
+        co_await OrderExecutor::yield();
+    }
+}
+
+OrderTask countWhenReady(PlaceOrder& order, std::atomic<size_t>& ready) {
+    bool reached = co_await order.untilState("READY");
+    if (reached) ready.fetch_add(1, std::memory_order_relaxed);
+}
+
+// Every order is in flight at once: a waiter suspended on READY plus a
+// cook that yields after each step, multiplexed over a few lane threads
+void benchOrderCoroutines(size_t maxOrders) {
+    std::cout << "\n=== Order coroutines: in-flight orders on executor lanes ===\n";
+    
+    size_t orderCount = std::max<size_t>(1000, maxOrders / 5);
+    std::vector<std::unique_ptr<PlaceOrder>> orders;
+    orders.reserve(orderCount);
+    for (size_t i = 0; i < orderCount; i++) {
+        orders.emplace_back(new PlaceOrder());
+        orders.back()->setRandomSeed(static_cast<unsigned int>(i + 1) * 2654435761u);
+    }
+    for (size_t laneCount = 1; laneCount <= 4; laneCount *= 2) {
+        for (auto& order : orders) {
+            order->setState(OrderStarted::instance());
+        }
+        std::atomic<size_t> ready(0);
+        OrderExecutor executor(laneCount);
+        size_t allocationsBefore = allocationCount;
+        Clock::time_point start = Clock::now();
+        for (size_t i = 0; i < orderCount; i++) {
+            executor.spawn(countWhenReady(*orders[i], ready), i);
+            executor.spawn(cookUntilReady(*orders[i]), i);
+        }
+        size_t peakTasks = executor.getLiveTasks();
+        executor.drain();
+        double ms = elapsedMs(start);
+        size_t allocations = allocationCount - allocationsBefore;
+        std::cout << laneCount << " lanes: " << orderCount << " orders (" << peakTasks << " tasks live after spawning), "
+                  << ready << " resumed at READY, " << (orderCount / ms * 1000) << " orders/s, "
+                  << (double(allocations) / orderCount) << " allocations per order" << std::endl;
+    }
+}
+
+// ==================== MICROBENCHMARKS ====================
+// Google Benchmark style cases: each body runs a given number of
+// iterations, and the suite grows that count until one run takes at least
+// minMs. The whole suite is then repeated at those counts, interleaved so
+// a slow patch on the host cannot skew every sample of one case. Results
+// are reported per iteration as the fastest wall time and the median heap
+// allocations, as a table and optionally as JSON for bench_compare.py.
+struct MicroResult {
+    std::string name;
+    size_t repetition;
+    size_t iterations;
+    double nsPerIteration;
+    double allocationsPerIteration;
+};
+
+class MicroSuite {
+private:
+    std::vector<MicroResult> results;
+    std::map<std::string, size_t> calibrated;
+    std::string filter;
+    double minMs;
+    size_t repetitions;
+    size_t repetition = 0;
+    
+    static double median(std::vector<double> values) {
+        std::sort(values.begin(), values.end());
+        size_t middle = values.size() / 2;
+        return values.size() % 2 == 1 ? values[middle] : (values[middle - 1] + values[middle]) / 2;
+    }
+    
+public:
+    MicroSuite(const std::string& filter, double minMs, size_t repetitions)
+        : filter(filter), minMs(minMs), repetitions(std::max<size_t>(1, repetitions)) {}
+    
+    // Runs every case in cases once per repetition, then prints the summary
+    void repeat(const std::function<void(MicroSuite&)>& cases) {
+        for (repetition = 0; repetition < repetitions; repetition++) {
+            cases(*this);
+        }
+        for (const MicroResult& first : results) {
+            if (first.repetition != 0) continue;
+            std::vector<double> times;
+            std::vector<double> allocations;
+            for (const MicroResult& result : results) {
+                if (result.name != first.name) continue;
+                times.push_back(result.nsPerIteration);
+                allocations.push_back(result.allocationsPerIteration);
+            }
+            std::cout << first.name << std::string(first.name.size() < 40 ? 40 - first.name.size() : 1, ' ')
+                      << *std::min_element(times.begin(), times.end()) << " ns  " << median(allocations)
+                      << " allocs  (" << first.iterations << " iterations, " << times.size() << " repetitions)"
+                      << std::endl;
+        }
+    }
+    
+    // body(iterations) must do its work exactly that many times
+    void run(const std::string& name, const std::function<void(size_t)>& body) {
+        if (!filter.empty() && name.find(filter) == std::string::npos) return;
+        std::map<std::string, size_t>::iterator known = calibrated.find(name);
+        if (known == calibrated.end()) body(1);
+        size_t iterations = known == calibrated.end() ? 1 : known->second;
+        while (true) {
+            size_t allocationsBefore = allocationCount;
+            Clock::time_point start = Clock::now();
+            body(iterations);
+            double ms = elapsedMs(start);
+            size_t allocations = allocationCount - allocationsBefore;
+            if (known != calibrated.end() || ms >= minMs || iterations >= (size_t(1) << 30)) {
+                calibrated[name] = iterations;
+                results.push_back({name, repetition, iterations, ms * 1e6 / iterations, double(allocations) / iterations});
+                return;
+            }
+            // Aim slightly past minMs, growing at most 10x per step like Google Benchmark
+            double scale = ms <= 0 ? 10.0 : std::min(10.0, std::max(1.5, 1.4 * minMs / ms));
+            iterations = static_cast<size_t>(iterations * scale) + 1;
+        }
+    }
+    
+    void writeJson(std::ostream& out) const {
+        out << "{\n  \"context\": {\"library\": \"pizzaShop\", \"time_unit\": \"ns\", \"min_time_ms\": " << minMs
+            << ", \"repetitions\": " << repetitions << "},\n  \"benchmarks\": [\n";
+        for (size_t i = 0; i < results.size(); i++) {
+            const MicroResult& result = results[i];
+            out << "    {\"name\": \"" << result.name << "\", \"run_name\": \"" << result.name
+                << "\", \"run_type\": \"iteration\", \"repetitions\": " << repetitions
+                << ", \"repetition_index\": " << result.repetition << ", \"iterations\": " << result.iterations
+                << ", \"real_time\": " << result.nsPerIteration << ", \"time_unit\": \"ns\", \"allocations\": "
+                << result.allocationsPerIteration << "}" << (i + 1 < results.size() ? "," : "") << "\n";
+        }
+        out << "  ]\n}\n";
+    }
+};
+
+void runMicrobenchmarks(MicroSuite& suite) {
+    const char* recipeNames[] = {"pepperoni", "vegetarian", "meat_lovers", "vegetarian_deluxe"};
+    PizzaPtr (*recipes[])() = {PizzaFactory::createPepperoniPizza, PizzaFactory::createVegetarianPizza,
+                               PizzaFactory::createMeatLoversPizza, PizzaFactory::createVegetarianDeluxePizza};
+    for (size_t r = 0; r < 4; r++) {
+        suite.run(std::string("factory/") + recipeNames[r], [&recipes, r](size_t iterations) {
+            for (size_t i = 0; i < iterations; i++) {
+                PizzaPtr pizza = recipes[r]();
+                doNotOptimize(pizza.get());
+            }
+        });
+    }
+    suite.run("factory/recipe_vegetarian_deluxe", [](size_t iterations) {
+        for (size_t i = 0; i < iterations; i++) {
+            PizzaPtr pizza = PizzaFactory::createMenuPizza<MenuRecipes::VegetarianDeluxe>();
+            doNotOptimize(pizza.get());
+        }
+    });
+    
+    size_t depths[] = {1, 4, 16, 64};
+    for (size_t depth : depths) {
+        suite.run("decorate/depth_" + std::to_string(depth), [depth](size_t iterations) {
+            for (size_t i = 0; i < iterations; i++) {
+                PizzaPtr pizza = buildAddOns(depth, false);
+                doNotOptimize(pizza.get());
+            }
+        });
+    }
+    for (size_t depth : depths) {
+        suite.run("add_on/depth_" + std::to_string(depth), [depth](size_t iterations) {
+            for (size_t i = 0; i < iterations; i++) {
+                PizzaPtr pizza = buildAddOns(depth, true);
+                doNotOptimize(pizza.get());
+            }
+        });
+    }
+    for (size_t depth : depths) {
+        PizzaPtr pizza = buildAddOns(depth, false);
+        suite.run("get_name/depth_" + std::to_string(depth), [&pizza](size_t iterations) {
+            for (size_t i = 0; i < iterations; i++) {
+                std::string name = pizza->getName();
+                doNotOptimize(name.data());
+            }
+        });
+        suite.run("get_price/depth_" + std::to_string(depth), [&pizza](size_t iterations) {
+            for (size_t i = 0; i < iterations; i++) {
+                Money price = pizza->getPrice();
+                doNotOptimize(price);
+            }
+        });
+    }
+    
+    size_t orderSizes[] = {10, 100, 1000};
+    for (size_t pizzas : orderSizes) {
+        PlaceOrder order;
+        for (size_t i = 0; i < pizzas; i++) {
+            order.addPizza(i % 2 == 0 ? PizzaFactory::createMeatLoversPizza() : buildAddOns(2, true));
+        }
+        order.setDiscountStrategy(new FamilyDiscount());
+        suite.run("calculate_total/pizzas_" + std::to_string(pizzas), [&order](size_t iterations) {
+            for (size_t i = 0; i < iterations; i++) {
+                Money total = order.calculateTotal();
+                doNotOptimize(total);
+            }
+        });
+    }
+    
+    // One add and one remove against a menu that already lists 1000 pizzas
+    {
+        std::vector<PizzaPtr> resident;
+        PizzaMenu menu;
+        for (size_t i = 0; i < 1000; i++) {
+            resident.push_back(PizzaFactory::createMenuPizza<MenuRecipes::Vegetarian>());
+            menu.addPizza(resident.back().get());
+        }
+        PizzaPtr visitor = PizzaFactory::createMenuPizza<MenuRecipes::Pepperoni>();
+        suite.run("menu/add_remove", [&menu, &visitor](size_t iterations) {
+            for (size_t i = 0; i < iterations; i++) {
+                menu.addPizza(visitor.get());
+                menu.removePizza(visitor.get());
+            }
+        });
+        suite.run("menu/snapshot_load", [&menu](size_t iterations) {
+            for (size_t i = 0; i < iterations; i++) {
+                std::shared_ptr<const MenuSnapshot> view = menu.snapshot();
+                doNotOptimize(view.get());
+            }
+        });
+        MenuReader reader(menu);
+        suite.run("menu/snapshot_read", [&reader](size_t iterations) {
+            for (size_t i = 0; i < iterations; i++) {
+                const MenuSnapshot& view = reader.current();
+                doNotOptimize(view.size());
+            }
+        });
+        // Each edit publishes a version that the next read materializes
+        suite.run("menu/edit_then_read", [&menu, &visitor, &reader](size_t iterations) {
+            for (size_t i = 0; i < iterations; i++) {
+                menu.addPizza(visitor.get());
+                doNotOptimize(reader.current().size());
+                menu.removePizza(visitor.get());
+            }
+        });
+    }
+    
+    // Per-event instrumentation cost; a thread's first event also attaches its shard
+    suite.run("metrics/count", [](size_t iterations) {
+        for (size_t i = 0; i < iterations; i++) {
+            PIZZA_COUNT(METRIC_ORDER_STEPS, 1);
+        }
+    });
+    suite.run("metrics/record", [](size_t iterations) {
+        for (size_t i = 0; i < iterations; i++) {
+            PIZZA_RECORD(METRIC_FAN_OUT_NS, i);
+        }
+    });
+    
+    size_t observerCounts[] = {1, 100, 10000};
+    for (size_t count : observerCounts) {
+        std::vector<NullObserver> observers(count);
+        PizzaMenu menu;
+        for (auto& observer : observers) {
+            menu.addObserver(&observer);
+        }
+        suite.run("menu/fan_out_" + std::to_string(count), [&menu](size_t iterations) {
+            for (size_t i = 0; i < iterations; i++) {
+                menu.notifyObservers("Pizza of the day: Pepperoni");
+            }
+        });
+    }
+}
+
+int main(int argc, char* argv[]) {
+    // ./bench [maxOrders] runs the throughput benches; ./bench --micro
+    // [--json=FILE] [--filter=SUBSTRING] [--min-ms=N] [--repetitions=N] runs
+    // the microbenchmarks; ./bench --service [maxOrders] runs only the order
+    // service load generator
+    size_t maxOrders = 1000000;
+    bool micro = false;
+    bool service = false;
+    std::string jsonPath;
+    std::string filter;
+    double minMs = 100;
+    size_t repetitions = 5;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--micro") {
+            micro = true;
+        } else if (arg == "--service") {
+            service = true;
+        } else if (arg.rfind("--json=", 0) == 0) {
+            jsonPath = arg.substr(7);
+        } else if (arg.rfind("--filter=", 0) == 0) {
+            filter = arg.substr(9);
+        } else if (arg.rfind("--min-ms=", 0) == 0) {
+            minMs = std::strtod(arg.c_str() + 9, nullptr);
+        } else if (arg.rfind("--repetitions=", 0) == 0) {
+            repetitions = std::strtoul(arg.c_str() + 14, nullptr, 10);
+        } else {
+            maxOrders = std::strtoul(arg.c_str(), nullptr, 10);
+        }
+    }
+    
+    std::cout << "=== Romeo's Pizza Shop Benchmarks ===\n";
+    
+    // Order and state events would otherwise be measured as console I/O
+    NullSink nullSink;
+    EventLog::setSink(&nullSink);
+    
+    if (micro) {
+        MicroSuite suite(filter, minMs, repetitions);
+        std::cout << "\n=== Microbenchmarks ===\n";
+        suite.repeat(runMicrobenchmarks);
+        if (!jsonPath.empty()) {
+            std::ofstream out(jsonPath);
+            suite.writeJson(out);
+            std::cout << "Results written to " << jsonPath << std::endl;
+        }
+        return 0;
+    }
+    size_t sessionsPerClient = std::max<size_t>(1, maxOrders / 2000);
+    if (service) {
+        benchOrderService(sessionsPerClient);
+        return 0;
+    }
+    
+    benchBatchPricing(maxOrders);
+    benchBatchedDiscounts();
+    benchObserverFanOut();
+    benchMenuChurn();
+    benchMenuSnapshots();
+    benchPizzaAllocations();
+    benchAddOnStacks();
+    benchKitchenSimulation();
+    benchStateTransitions();
+    benchEventSinks();
+    benchJournalRecovery(maxOrders * 10);
+    benchOrderIngest(maxOrders);
+    benchRuleDiscounts();
+    benchOrderCoroutines(maxOrders);
+    benchOrderService(sessionsPerClient);
+    
+    return 0;
+}
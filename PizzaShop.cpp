@@ -2,225 +2,1267 @@
 #include <cstdlib>
 #include <ctime>
 #include <algorithm>
+#include <cstring>
+#include <cstdio>
+#include <cerrno>
+#include <stdexcept>
+#include <typeinfo>
+#include <filesystem>
+#include <fstream>
+#include <charconv>
+#include <future>
+#include <random>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+#if defined(__GNUC__) && defined(__x86_64__)
+#include <immintrin.h>
+#define PIZZASHOP_AVX2_DISPATCH 1
+#endif
+
+// ==================== MONEY IMPLEMENTATION ====================
+std::ostream& operator<<(std::ostream& os, Money money) {
+    return os << money.toDouble();
+}
+
+// ==================== ORDER ARENA IMPLEMENTATION ====================
+namespace {
+thread_local PizzaArena* activeArena = nullptr;
+
+// Every Pizza allocation is prefixed with the arena that owns it (or nullptr
+// for the heap) so operator delete knows whether there is anything to free.
+const std::size_t kNodeHeader = alignof(std::max_align_t);
+
+std::size_t alignUp(std::size_t size) {
+    return (size + kNodeHeader - 1) & ~(kNodeHeader - 1);
+}
+}
+
+PizzaArena::PizzaArena(std::size_t blockSize)
+    : blockSize(blockSize), currentBlock(0), offset(0), used(0) {}
+
+PizzaArena::~PizzaArena() {
+    for (auto& block : blocks) {
+        ::operator delete(block.data);
+    }
+}
+
+void* PizzaArena::allocate(std::size_t size) {
+    size = alignUp(size);
+    while (currentBlock < blocks.size() && offset + size > blocks[currentBlock].size) {
+        currentBlock++;
+        offset = 0;
+    }
+    if (currentBlock == blocks.size()) {
+        std::size_t newSize = std::max(blockSize, size);
+        blocks.push_back({static_cast<char*>(::operator new(newSize)), newSize});
+        offset = 0;
+    }
+    void* result = blocks[currentBlock].data + offset;
+    offset += size;
+    used += size;
+    return result;
+}
+
+// Blocks are kept for the next order; only the cursor moves back.
+void PizzaArena::reset() {
+    currentBlock = 0;
+    offset = 0;
+    used = 0;
+}
+
+std::size_t PizzaArena::bytesUsed() const { return used; }
+
+PizzaArena* PizzaArena::current() { return activeArena; }
+
+PizzaArena::Scope::Scope(PizzaArena& arena) : previous(activeArena) { activeArena = &arena; }
+PizzaArena::Scope::~Scope() { activeArena = previous; }
 
 // ==================== COMPOSITE PATTERN IMPLEMENTATION ====================
-Pizza::Pizza(double p, std::string n) : price(p), name(n) {}
+Pizza::Pizza() : parent(nullptr), nameState(NAME_STALE) {}
+Pizza::Pizza(Money p, std::string_view n) : price(p), name(n), parent(nullptr), nameState(NAME_STALE) {}
 Pizza::~Pizza() {}
 
-Topping::Topping(double p, std::string n) : Pizza(p, n) {}
+// Shared catalog toppings have many parents and never change, so they are not linked.
+void Pizza::adopt(Pizza* child) {
+    if (!child->isShared()) child->parent = this;
+}
+
+void Pizza::invalidateName() {
+    for (Pizza* node = this; node != nullptr; node = node->parent) {
+        node->nameState.store(NAME_STALE, std::memory_order_relaxed);
+    }
+}
+
+bool Pizza::nameReady() const {
+    return nameState.load(std::memory_order_acquire) == NAME_READY;
+}
+
+// One reader claims the stale label and publishes it; readers racing with
+// it assemble their own copy rather than wait.
+std::string Pizza::cachedLabel() {
+    if (nameReady()) return cachedName;
+    std::uint8_t expected = NAME_STALE;
+    if (nameState.compare_exchange_strong(expected, NAME_BUILDING, std::memory_order_acquire)) {
+        cachedName.clear();
+        appendName(cachedName);
+        nameState.store(NAME_READY, std::memory_order_release);
+        return cachedName;
+    }
+    std::string label;
+    appendName(label);
+    return label;
+}
+
+void Pizza::appendName(std::string& out) { out += getName(); }
+
+// Uncached labels are assembled in one reused per-thread buffer.
+void Pizza::writeName(std::ostream& os) {
+    if (nameReady()) {
+        os << cachedName;
+        return;
+    }
+    thread_local std::string buffer;
+    buffer.clear();
+    appendName(buffer);
+    os << buffer;
+}
+
+void* Pizza::operator new(std::size_t size) {
+    PizzaArena* owner = activeArena;
+    char* raw;
+    if (owner != nullptr) {
+        raw = static_cast<char*>(owner->allocate(kNodeHeader + size));
+    } else {
+        raw = static_cast<char*>(::operator new(kNodeHeader + size));
+    }
+    *reinterpret_cast<PizzaArena**>(raw) = owner;
+    return raw + kNodeHeader;
+}
+
+void Pizza::operator delete(void* ptr) {
+    if (ptr == nullptr) return;
+    char* raw = static_cast<char*>(ptr) - kNodeHeader;
+    if (*reinterpret_cast<PizzaArena**>(raw) == nullptr) {
+        ::operator delete(raw);
+    }
+}
+void Pizza::flatten(PizzaRecord& record) {
+    record.addUnlisted(getName(), getPrice());
+}
+bool Pizza::isShared() const { return false; }
+
+void PizzaDeleter::operator()(Pizza* pizza) const {
+    if (pizza != nullptr && !pizza->isShared()) delete pizza;
+}
+
+Topping::Topping(Money p, std::string_view n) : Pizza(p, n), id(-1) {}
+Topping::Topping(Money p, std::string_view n, int catalogId) : Pizza(p, n), id(catalogId) {}
 std::string Topping::getName() { return name; }
-double Topping::getPrice() { return price; }
+void Topping::appendName(std::string& out) { out += name; }
+Money Topping::getPrice() { return price; }
+void Topping::flatten(PizzaRecord& record) {
+    if (id < 0) {
+        record.addUnlisted(name, price);
+        return;
+    }
+    record.toppingIds.push_back(id);
+    record.toppingPrices.push_back(price);
+}
+bool Topping::isShared() const { return id >= 0; }
+int Topping::getId() const { return id; }
+
+ToppingCatalog::ToppingCatalog() {}
 
-ToppingGroup::ToppingGroup(std::string n) : Pizza(0, n) {}
-ToppingGroup::~ToppingGroup() {
-    for (auto topping : toppings) {
-        delete topping;
+ToppingCatalog& ToppingCatalog::instance() {
+    static ToppingCatalog catalog;
+    return catalog;
+}
+
+int ToppingCatalog::intern(const std::string& name, Money price) {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = index.find(std::make_pair(name, price.getCents()));
+    if (it != index.end()) {
+        return it->second;
+    }
+    int id = static_cast<int>(entries.size());
+    entries.emplace_back(price, name, id);
+    index.emplace(std::make_pair(name, price.getCents()), id);
+    return id;
+}
+
+Topping* ToppingCatalog::get(const std::string& name, Money price) {
+    return get(intern(name, price));
+}
+
+Topping* ToppingCatalog::get(int id) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (id < 0 || static_cast<std::size_t>(id) >= entries.size()) {
+        return nullptr;
     }
+    return &entries[id];
+}
+
+std::size_t ToppingCatalog::size() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return entries.size();
 }
-void ToppingGroup::add(Pizza* component) {
-    toppings.push_back(component);
+
+ToppingGroup::ToppingGroup(std::string_view n) : Pizza(Money(), n) {}
+void ToppingGroup::reserve(std::size_t count) { toppings.reserve(count); }
+void ToppingGroup::add(PizzaPtr component) {
     price += component->getPrice();
+    adopt(component.get());
+    toppings.push_back(std::move(component));
+    invalidateName();
 }
-std::string ToppingGroup::getName() {
-    std::string result = name + " (";
+std::string ToppingGroup::getName() { return cachedLabel(); }
+void ToppingGroup::appendName(std::string& out) {
+    if (nameReady()) {
+        out += cachedName;
+        return;
+    }
+    out += name;
+    out += " (";
     for (size_t i = 0; i < toppings.size(); i++) {
-        result += toppings[i]->getName();
-        if (i < toppings.size() - 1) result += ", ";
+        toppings[i]->appendName(out);
+        if (i < toppings.size() - 1) out += ", ";
+    }
+    out += ")";
+}
+Money ToppingGroup::getPrice() { return price; }
+void ToppingGroup::flatten(PizzaRecord& record) {
+    for (const auto& topping : toppings) {
+        topping->flatten(record);
+    }
+}
+
+// ==================== COMPILE-TIME MENU RECIPES IMPLEMENTATION ====================
+MenuPizza::MenuPizza(const char* recipeName, const RecipeTopping* toppings, const int* toppingIds,
+                     std::size_t toppingCount, Money basePrice)
+    : Pizza(basePrice, std::string_view()), recipeName(recipeName), toppings(toppings),
+      toppingIds(toppingIds), toppingCount(toppingCount) {}
+
+std::string MenuPizza::getName() { return cachedLabel(); }
+Money MenuPizza::getPrice() { return price; }
+
+void MenuPizza::appendName(std::string& out) {
+    if (nameReady()) {
+        out += cachedName;
+        return;
+    }
+    out += recipeName;
+    out += " (";
+    for (std::size_t i = 0; i < toppingCount; i++) {
+        out += toppings[i].name;
+        if (i < toppingCount - 1) out += ", ";
+    }
+    out += ")";
+}
+
+void MenuPizza::flatten(PizzaRecord& record) {
+    record.toppingIds.insert(record.toppingIds.end(), toppingIds, toppingIds + toppingCount);
+    for (std::size_t i = 0; i < toppingCount; i++) {
+        record.toppingPrices.push_back(toppings[i].price);
     }
-    result += ")";
-    return result;
 }
-double ToppingGroup::getPrice() { return price; }
 
 // ==================== DECORATOR PATTERN IMPLEMENTATION ====================
-BasePizza::BasePizza(Pizza* t) : Pizza(t->getPrice(), t->getName()), toppings(t) {}
-BasePizza::~BasePizza() { delete toppings; }
-double BasePizza::getPrice() { return toppings->getPrice(); }
+BasePizza::BasePizza(PizzaPtr t) : toppings(std::move(t)) { adopt(toppings.get()); }
+Money BasePizza::getPrice() { return toppings->getPrice(); }
 std::string BasePizza::getName() { return toppings->getName(); }
+void BasePizza::appendName(std::string& out) { toppings->appendName(out); }
+void BasePizza::flatten(PizzaRecord& record) { toppings->flatten(record); }
 void BasePizza::printPizza() {
-    std::cout << "Pizza: " << getName() << " - R" << getPrice() << std::endl;
+    PIZZA_LOG(LOG_INFO, "Pizza: " << getName() << " - R" << getPrice());
 }
 
-PizzaDecorator::PizzaDecorator(Pizza* p) : Pizza(p->getPrice(), p->getName()), pizza(p) {}
-PizzaDecorator::~PizzaDecorator() { delete pizza; }
+PizzaDecorator::PizzaDecorator(PizzaPtr p) : pizza(std::move(p)) { adopt(pizza.get()); }
 
-ExtraCheese::ExtraCheese(Pizza* p, double cost) : PizzaDecorator(p), extraCost(cost) {}
-double ExtraCheese::getPrice() { return pizza->getPrice() + extraCost; }
-std::string ExtraCheese::getName() { return pizza->getName() + " with Extra Cheese"; }
+ExtraCheese::ExtraCheese(PizzaPtr p, Money cost) : PizzaDecorator(std::move(p)), extraCost(cost) {}
+Money ExtraCheese::getPrice() { return pizza->getPrice() + extraCost; }
+std::string ExtraCheese::getName() { return cachedLabel(); }
+void ExtraCheese::appendName(std::string& out) {
+    if (nameReady()) {
+        out += cachedName;
+        return;
+    }
+    pizza->appendName(out);
+    out += " with Extra Cheese";
+}
+void ExtraCheese::flatten(PizzaRecord& record) {
+    pizza->flatten(record);
+    record.surcharges.push_back(extraCost);
+}
 void ExtraCheese::printPizza() {
-    std::cout << "Pizza: " << getName() << " - R" << getPrice() << std::endl;
+    PIZZA_LOG(LOG_INFO, "Pizza: " << getName() << " - R" << getPrice());
 }
 
-StuffedCrust::StuffedCrust(Pizza* p, double cost) : PizzaDecorator(p), extraCost(cost) {}
-double StuffedCrust::getPrice() { return pizza->getPrice() + extraCost; }
-std::string StuffedCrust::getName() { return pizza->getName() + " with Stuffed Crust"; }
+StuffedCrust::StuffedCrust(PizzaPtr p, Money cost) : PizzaDecorator(std::move(p)), extraCost(cost) {}
+Money StuffedCrust::getPrice() { return pizza->getPrice() + extraCost; }
+std::string StuffedCrust::getName() { return cachedLabel(); }
+void StuffedCrust::appendName(std::string& out) {
+    if (nameReady()) {
+        out += cachedName;
+        return;
+    }
+    pizza->appendName(out);
+    out += " with Stuffed Crust";
+}
+void StuffedCrust::flatten(PizzaRecord& record) {
+    pizza->flatten(record);
+    record.surcharges.push_back(extraCost);
+}
 void StuffedCrust::printPizza() {
-    std::cout << "Pizza: " << getName() << " - R" << getPrice() << std::endl;
+    PIZZA_LOG(LOG_INFO, "Pizza: " << getName() << " - R" << getPrice());
+}
+
+// ==================== INLINE ADD-ONS IMPLEMENTATION ====================
+namespace {
+const char* addOnSuffix(const ExtraCheeseAddOn&) { return " with Extra Cheese"; }
+const char* addOnSuffix(const StuffedCrustAddOn&) { return " with Stuffed Crust"; }
+
+Money addOnCost(const AddOn& addOn) {
+    return std::visit([](const auto& a) { return a.cost; }, addOn);
+}
+}
+
+AddOnPizza::AddOnPizza(PizzaPtr p) : pizza(std::move(p)), count(0) { adopt(pizza.get()); }
+
+PizzaPtr AddOnPizza::add(PizzaPtr pizza, const AddOn& addOn) {
+    AddOnPizza* stack = dynamic_cast<AddOnPizza*>(pizza.get());
+    if (stack != nullptr && stack->push(addOn)) return pizza;
+    PizzaPtr wrapped = makePizza<AddOnPizza>(std::move(pizza));
+    static_cast<AddOnPizza*>(wrapped.get())->push(addOn);
+    return wrapped;
+}
+
+bool AddOnPizza::push(const AddOn& addOn) {
+    if (count == kCapacity) return false;
+    addOns[count++] = addOn;
+    surcharge += addOnCost(addOn);
+    invalidateName();
+    return true;
+}
+
+std::size_t AddOnPizza::size() const { return count; }
+
+Money AddOnPizza::getPrice() { return pizza->getPrice() + surcharge; }
+std::string AddOnPizza::getName() { return cachedLabel(); }
+void AddOnPizza::appendName(std::string& out) {
+    if (nameReady()) {
+        out += cachedName;
+        return;
+    }
+    pizza->appendName(out);
+    for (std::size_t i = 0; i < count; i++) {
+        std::visit([&out](const auto& a) { out += addOnSuffix(a); }, addOns[i]);
+    }
+}
+void AddOnPizza::flatten(PizzaRecord& record) {
+    pizza->flatten(record);
+    for (std::size_t i = 0; i < count; i++) {
+        record.surcharges.push_back(addOnCost(addOns[i]));
+    }
+}
+void AddOnPizza::printPizza() {
+    PIZZA_LOG(LOG_INFO, "Pizza: " << getName() << " - R" << getPrice());
+}
+
+// ==================== FLATTENED PIZZA RECORD IMPLEMENTATION ====================
+PizzaRecord PizzaRecord::compile(Pizza* pizza) {
+    PizzaRecord record;
+    pizza->flatten(record);
+    return record;
+}
+
+// Money sums are exact, so the order toppings and surcharges are added in no longer matters
+Money PizzaRecord::getPrice() const {
+    Money total;
+    for (Money p : toppingPrices) total += p;
+    for (Money s : surcharges) total += s;
+    return total;
+}
+
+void PizzaRecord::clear() {
+    toppingIds.clear();
+    toppingPrices.clear();
+    surcharges.clear();
+    unlistedNames.clear();
+}
+
+// Repeats of the same name share one slot
+void PizzaRecord::addUnlisted(std::string_view name, Money price) {
+    std::size_t slot = std::find(unlistedNames.begin(), unlistedNames.end(), name) - unlistedNames.begin();
+    if (slot == unlistedNames.size()) unlistedNames.emplace_back(name);
+    toppingIds.push_back(-1 - static_cast<int>(slot));
+    toppingPrices.push_back(price);
+}
+
+std::string PizzaRecord::toppingName(std::size_t index) const {
+    int id = toppingIds[index];
+    if (id < 0) return unlistedNames[static_cast<std::size_t>(-1 - id)];
+    return ToppingCatalog::instance().get(id)->getName();
 }
 
 // ==================== STRATEGY PATTERN IMPLEMENTATION ====================
+namespace {
+static_assert(sizeof(Money) == sizeof(std::int64_t) && std::is_standard_layout<Money>::value,
+              "packed kernels read Money arrays as int64 cents");
+
+// Packed lanes handle |cents| < 2^44. There cents * keepPercent is exact in
+// a double and the quotient by 100 is within 2^-8 of the true value, while
+// any true value that is not a tie lies at least 0.01 from one, so rounding
+// the double half away from zero matches Money::scaledBy bit for bit.
+const std::int64_t kPackedCentsLimit = std::int64_t(1) << 44;
+
+bool packable(const std::int64_t* cents, std::size_t count) {
+    bool inRange = true;
+    for (std::size_t i = 0; i < count; i++) {
+        inRange &= static_cast<std::uint64_t>(cents[i]) + kPackedCentsLimit < static_cast<std::uint64_t>(2 * kPackedCentsLimit);
+    }
+    return inRange;
+}
+
+#if defined(__SSE2__)
+// SSE2 has no int64 <-> double conversion, so both go through the 1.5 * 2^52
+// bias: that double's low mantissa bits hold any integer below 2^51 in magnitude.
+void scaleCentsSse2(const std::int64_t* in, std::int64_t* out, std::size_t count, std::int64_t keepPercent) {
+    const __m128i biasBits = _mm_set1_epi64x(0x4338000000000000LL);
+    const __m128d bias = _mm_castsi128_pd(biasBits);
+    const __m128d factor = _mm_set1_pd(static_cast<double>(keepPercent));
+    const __m128d hundred = _mm_set1_pd(100.0);
+    const __m128d half = _mm_set1_pd(0.5);
+    const __m128d one = _mm_set1_pd(1.0);
+    const __m128d signMask = _mm_set1_pd(-0.0);
+    for (std::size_t i = 0; i < count; i += 2) {
+        __m128i cents = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i));
+        __m128d value = _mm_sub_pd(_mm_castsi128_pd(_mm_add_epi64(cents, biasBits)), bias);
+        __m128d quotient = _mm_div_pd(_mm_mul_pd(value, factor), hundred);
+        __m128d sign = _mm_and_pd(quotient, signMask);
+        __m128d shifted = _mm_add_pd(_mm_xor_pd(quotient, sign), half);
+        // floor(shifted): round to nearest through the bias, then step back if that went up
+        __m128d rounded = _mm_sub_pd(_mm_add_pd(shifted, bias), bias);
+        rounded = _mm_sub_pd(rounded, _mm_and_pd(_mm_cmpgt_pd(rounded, shifted), one));
+        __m128d result = _mm_add_pd(_mm_xor_pd(rounded, sign), bias);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), _mm_sub_epi64(_mm_castpd_si128(result), biasBits));
+    }
+}
+#endif
+
+#if defined(PIZZASHOP_AVX2_DISPATCH)
+// Same arithmetic four lanes wide. Compiled for AVX2 regardless of -march and
+// only called once the CPU has reported AVX2 support.
+__attribute__((target("avx2")))
+void scaleCentsAvx2(const std::int64_t* in, std::int64_t* out, std::size_t count, std::int64_t keepPercent) {
+    const __m256i biasBits = _mm256_set1_epi64x(0x4338000000000000LL);
+    const __m256d bias = _mm256_castsi256_pd(biasBits);
+    const __m256d factor = _mm256_set1_pd(static_cast<double>(keepPercent));
+    const __m256d hundred = _mm256_set1_pd(100.0);
+    const __m256d half = _mm256_set1_pd(0.5);
+    const __m256d signMask = _mm256_set1_pd(-0.0);
+    for (std::size_t i = 0; i < count; i += 4) {
+        __m256i cents = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(in + i));
+        __m256d value = _mm256_sub_pd(_mm256_castsi256_pd(_mm256_add_epi64(cents, biasBits)), bias);
+        __m256d quotient = _mm256_div_pd(_mm256_mul_pd(value, factor), hundred);
+        __m256d sign = _mm256_and_pd(quotient, signMask);
+        __m256d rounded = _mm256_floor_pd(_mm256_add_pd(_mm256_xor_pd(quotient, sign), half));
+        __m256d result = _mm256_add_pd(_mm256_xor_pd(rounded, sign), bias);
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + i), _mm256_sub_epi64(_mm256_castpd_si256(result), biasBits));
+    }
+}
+#endif
+
+#if defined(__SSE2__)
+using CentsKernel = void (*)(const std::int64_t*, std::int64_t*, std::size_t, std::int64_t);
+
+// Picked once per process; SSE2 is the x86-64 baseline
+CentsKernel packedKernel() {
+#if defined(PIZZASHOP_AVX2_DISPATCH)
+    static const CentsKernel kernel = __builtin_cpu_supports("avx2") ? scaleCentsAvx2 : scaleCentsSse2;
+    return kernel;
+#else
+    return scaleCentsSse2;
+#endif
+}
+#endif
+
+// out[i] = in[i].scaledBy(keepPercent, 100) for 0 <= keepPercent <= 100.
+// Blocks with an out-of-range amount, and the tail, take the scalar path.
+void scalePrices(const Money* in, Money* out, std::size_t count, std::int64_t keepPercent) {
+    std::size_t i = 0;
+#if defined(__SSE2__)
+    const std::int64_t* cents = reinterpret_cast<const std::int64_t*>(in);
+    std::int64_t* scaled = reinterpret_cast<std::int64_t*>(out);
+    const CentsKernel kernel = packedKernel();
+    const std::size_t block = 64;
+    for (; i + block <= count; i += block) {
+        if (packable(cents + i, block)) {
+            kernel(cents + i, scaled + i, block, keepPercent);
+        } else {
+            for (std::size_t j = i; j < i + block; j++) out[j] = in[j].scaledBy(keepPercent, 100);
+        }
+    }
+    std::size_t pairs = (count - i) & ~std::size_t(1);
+    if (pairs != 0 && packable(cents + i, pairs)) {
+        scaleCentsSse2(cents + i, scaled + i, pairs, keepPercent);
+        i += pairs;
+    }
+#endif
+    for (; i < count; i++) {
+        out[i] = in[i].scaledBy(keepPercent, 100);
+    }
+}
+}
+
 DiscountStrategy::~DiscountStrategy() {}
 
-double RegularPrice::applyDiscount(double originalPrice) { return originalPrice; }
+// Scalar fallback for strategies without a vector kernel
+void DiscountStrategy::applyDiscount(const Money* in, Money* out, std::size_t count) {
+    for (std::size_t i = 0; i < count; i++) {
+        out[i] = applyDiscount(in[i]);
+    }
+}
+
+Money DiscountStrategy::applyDiscount(const PlaceOrder&, Money subtotal) {
+    return applyDiscount(subtotal);
+}
+
+void DiscountStrategy::applyDiscount(PlaceOrder* const*, const Money* subtotals, Money* out, std::size_t count) {
+    applyDiscount(subtotals, out, count);
+}
+
+Money RegularPrice::applyDiscount(Money originalPrice) { return originalPrice; }
+void RegularPrice::applyDiscount(const Money* in, Money* out, std::size_t count) {
+    if (in != out) std::copy(in, in + count, out);
+}
 std::string RegularPrice::getStrategyName() { return "Regular Price (0% discount)"; }
 
-double BulkDiscount::applyDiscount(double originalPrice) { return originalPrice * 0.9; }
+Money BulkDiscount::applyDiscount(Money originalPrice) { return originalPrice.scaledBy(90, 100); }
+void BulkDiscount::applyDiscount(const Money* in, Money* out, std::size_t count) {
+    scalePrices(in, out, count, 90);
+}
 std::string BulkDiscount::getStrategyName() { return "Bulk Discount (10% discount)"; }
 
-double FamilyDiscount::applyDiscount(double originalPrice) { return originalPrice * 0.85; }
+Money FamilyDiscount::applyDiscount(Money originalPrice) { return originalPrice.scaledBy(85, 100); }
+void FamilyDiscount::applyDiscount(const Money* in, Money* out, std::size_t count) {
+    scalePrices(in, out, count, 85);
+}
 std::string FamilyDiscount::getStrategyName() { return "Family Discount (15% discount)"; }
 
+// ==================== RULE-BASED DISCOUNTS IMPLEMENTATION ====================
+namespace {
+const int kNoRuleTable = -1;
+const int kUnresolvedTopping = -2;
+// Catalog ids interned after the engine was built are resolved on first sight
+const std::size_t kToppingIdSlack = 4096;
+}
+
+RuleDiscount::RuleDiscount(const std::vector<DiscountRule>& rules) {
+    std::shared_ptr<RuleBook> compiled(new RuleBook());
+    compiled->ruleCount = rules.size();
+    std::vector<const DiscountRule*> wholeOrder;
+    std::vector<std::vector<const DiscountRule*>> byTopping;
+    for (const auto& rule : rules) {
+        if (rule.topping.empty()) {
+            wholeOrder.push_back(&rule);
+            continue;
+        }
+        auto inserted = compiled->toppingTables.emplace(rule.topping, static_cast<int>(byTopping.size()));
+        if (inserted.second) byTopping.emplace_back();
+        byTopping[inserted.first->second].push_back(&rule);
+    }
+    compiled->orderRules = buildTable(wholeOrder);
+    for (auto& toppingGroup : byTopping) {
+        compiled->toppingRules.push_back(buildTable(toppingGroup));
+    }
+    
+    compiled->resolvedIds = ToppingCatalog::instance().size() + kToppingIdSlack;
+    compiled->tableOfTopping.reset(new std::atomic<int>[compiled->resolvedIds]);
+    for (std::size_t id = 0; id < compiled->resolvedIds; id++) {
+        compiled->tableOfTopping[id].store(kUnresolvedTopping, std::memory_order_relaxed);
+    }
+    book = compiled;
+}
+
+// One level per distinct minCount; level k holds every rule that a count of
+// levels[k].minCount satisfies, sorted by minSubtotal with running totals.
+RuleDiscount::RuleTable RuleDiscount::buildTable(std::vector<const DiscountRule*> rules) {
+    RuleTable table;
+    std::sort(rules.begin(), rules.end(), [](const DiscountRule* a, const DiscountRule* b) {
+        return a->minCount < b->minCount;
+    });
+    std::vector<const DiscountRule*> active;
+    for (std::size_t i = 0; i < rules.size();) {
+        std::size_t minCount = rules[i]->minCount;
+        for (; i < rules.size() && rules[i]->minCount == minCount; i++) {
+            active.push_back(rules[i]);
+        }
+        std::sort(active.begin(), active.end(), [](const DiscountRule* a, const DiscountRule* b) {
+            return a->minSubtotal < b->minSubtotal;
+        });
+        
+        RuleLevel level;
+        level.minCount = minCount;
+        RuleTotals running = {0, Money(), Money(), 0, Money(), Money()};
+        for (auto rule : active) {
+            if (rule->effect == PERCENT_OFF) {
+                // Percent to 0.01% steps, rounded the same way Money rounds rand to cents
+                std::int64_t basisPoints = Money(rule->value).getCents();
+                if (rule->stackable) {
+                    running.stackedBasisPoints += basisPoints;
+                } else {
+                    running.bestBasisPoints = std::max(running.bestBasisPoints, basisPoints);
+                }
+            } else {
+                Money& stacked = rule->effect == AMOUNT_OFF ? running.stackedAmount : running.stackedEach;
+                Money& best = rule->effect == AMOUNT_OFF ? running.bestAmount : running.bestEach;
+                if (rule->stackable) {
+                    stacked += Money(rule->value);
+                } else {
+                    best = std::max(best, Money(rule->value));
+                }
+            }
+            level.minSubtotals.push_back(rule->minSubtotal);
+            level.totals.push_back(running);
+        }
+        table.levels.push_back(std::move(level));
+    }
+    return table;
+}
+
+void RuleDiscount::RuleTable::accumulate(std::size_t count, Money subtotal, Money& stacked, Money& best) const {
+    auto level = std::upper_bound(levels.begin(), levels.end(), count,
+                                  [](std::size_t value, const RuleLevel& entry) { return value < entry.minCount; });
+    if (level == levels.begin()) return;
+    --level;
+    std::size_t matched = std::upper_bound(level->minSubtotals.begin(), level->minSubtotals.end(), subtotal)
+                          - level->minSubtotals.begin();
+    if (matched == 0) return;
+    const RuleTotals& totals = level->totals[matched - 1];
+    stacked += subtotal.scaledBy(totals.stackedBasisPoints, 10000) + totals.stackedAmount + totals.stackedEach * count;
+    best = std::max(best, std::max(subtotal.scaledBy(totals.bestBasisPoints, 10000),
+                                   std::max(totals.bestAmount, totals.bestEach * count)));
+}
+
+// Rules name toppings, records carry catalog ids; the mapping is memoized
+// per id. Concurrent first lookups race benignly to store the same value.
+int RuleDiscount::RuleBook::tableFor(int toppingId) const {
+    if (toppingId < 0) return kNoRuleTable;
+    std::size_t id = static_cast<std::size_t>(toppingId);
+    if (id < resolvedIds) {
+        int table = tableOfTopping[id].load(std::memory_order_relaxed);
+        if (table != kUnresolvedTopping) return table;
+    }
+    Topping* topping = ToppingCatalog::instance().get(toppingId);
+    int table = kNoRuleTable;
+    if (topping != nullptr) {
+        auto it = toppingTables.find(topping->getName());
+        if (it != toppingTables.end()) table = it->second;
+    }
+    if (id < resolvedIds) tableOfTopping[id].store(table, std::memory_order_relaxed);
+    return table;
+}
+
+Money RuleDiscount::discountFor(const PlaceOrder* order, Money subtotal) const {
+    Money stacked;
+    Money best;
+    std::size_t pizzaCount = order != nullptr ? order->getRecords().size() : 0;
+    book->orderRules.accumulate(pizzaCount, subtotal, stacked, best);
+    
+    if (order != nullptr && !book->toppingRules.empty()) {
+        thread_local std::vector<std::size_t> counts;
+        thread_local std::vector<int> touched;
+        if (counts.size() < book->toppingRules.size()) counts.resize(book->toppingRules.size(), 0);
+        touched.clear();
+        for (const auto& record : order->getRecords()) {
+            for (int id : record.toppingIds) {
+                int table = kNoRuleTable;
+                if (id >= 0) {
+                    table = book->tableFor(id);
+                } else {
+                    // Toppings outside the catalog match rules by name
+                    auto it = book->toppingTables.find(record.unlistedNames[static_cast<std::size_t>(-1 - id)]);
+                    if (it != book->toppingTables.end()) table = it->second;
+                }
+                if (table == kNoRuleTable) continue;
+                if (counts[table]++ == 0) touched.push_back(table);
+            }
+        }
+        for (int table : touched) {
+            book->toppingRules[table].accumulate(counts[table], subtotal, stacked, best);
+            counts[table] = 0;
+        }
+    }
+    return std::min(subtotal, std::max(stacked, best));
+}
+
+Money RuleDiscount::applyDiscount(Money originalPrice) {
+    return originalPrice - discountFor(nullptr, originalPrice);
+}
+
+Money RuleDiscount::applyDiscount(const PlaceOrder& order, Money subtotal) {
+    return subtotal - discountFor(&order, subtotal);
+}
+
+void RuleDiscount::applyDiscount(PlaceOrder* const* orders, const Money* subtotals, Money* out, std::size_t count) {
+    for (std::size_t i = 0; i < count; i++) {
+        out[i] = subtotals[i] - discountFor(orders[i], subtotals[i]);
+    }
+}
+
+std::string RuleDiscount::getStrategyName() {
+    return "Rule Discount (" + std::to_string(book->ruleCount) + " rules)";
+}
+
+std::size_t RuleDiscount::getRuleCount() const {
+    return book->ruleCount;
+}
+
 // ==================== OBSERVER PATTERN IMPLEMENTATION ====================
 Observer::~Observer() {}
 
-Customer::Customer(std::string n) : name(n) {}
+Customer::Customer(std::string_view n) : name(n) {}
 void Customer::update(const std::string& message) {
-    std::cout << "Customer " << name << " notified: " << message << std::endl;
+    PIZZA_LOG(LOG_INFO, "Customer " << name << " notified: " << message);
 }
 
 Website::Website() {}
 void Website::update(const std::string& message) {
-    std::cout << "Website updated: " << message << std::endl;
+    PIZZA_LOG(LOG_INFO, "Website updated: " << message);
+}
+
+MenuSnapshot::MenuSnapshot() : version(0), count(0) {}
+std::uint64_t MenuSnapshot::getVersion() const { return version; }
+std::size_t MenuSnapshot::size() const { return count; }
+const MenuItem& MenuSnapshot::operator[](std::size_t index) const {
+    return (*chunks[index / CHUNK_SIZE])[index % CHUNK_SIZE];
+}
+std::size_t MenuSnapshot::getChunkCount() const { return chunks.size(); }
+const std::shared_ptr<const MenuSnapshot::Chunk>& MenuSnapshot::getChunk(std::size_t chunk) const { return chunks[chunk]; }
+
+MenuReader::MenuReader(Menu& menu) : menu(menu), cached(menu.snapshot()) {}
+
+namespace {
+// Nesting depth of Observer::update calls on this thread. removeObserver
+// skips its grace period while it is non-zero: the snapshot being delivered
+// cannot expire until the caller's own update() returns.
+thread_local int notifyDepth = 0;
+
+struct NotifyScope {
+    NotifyScope() { notifyDepth++; }
+    ~NotifyScope() { notifyDepth--; }
+};
 }
 
+Menu::Menu()
+    : nextPizzaId(1), dispatcher(nullptr), observerSnapshot(std::make_shared<const std::vector<Observer*>>()),
+      menuSnapshot(std::make_shared<const MenuSnapshot>()), allChunksDirty(false), version(0) {}
+
 Menu::~Menu() {
     observers.clear();
     pizzas.clear();
 }
 
+// O(1): the stale snapshot is only remembered until its last reader lets
+// go of it. The next notification copies the live list.
+void Menu::retireObservers() {
+    retiredSnapshots.erase(std::remove_if(retiredSnapshots.begin(), retiredSnapshots.end(),
+                                          [](const std::weak_ptr<const std::vector<Observer*>>& s) { return s.expired(); }),
+                           retiredSnapshots.end());
+    std::shared_ptr<const std::vector<Observer*>> current = std::atomic_load(&observerSnapshot);
+    if (current) {
+        retiredSnapshots.push_back(current);
+        std::atomic_store(&observerSnapshot, std::shared_ptr<const std::vector<Observer*>>());
+    }
+}
+
 void Menu::addObserver(Observer* observer) { 
+    std::lock_guard<std::mutex> lock(menuMutex);
+    if (!observerIndex.emplace(observer, observers.size()).second) return;
     observers.push_back(observer); 
+    retireObservers();
 }
 
+// Returns only once no notification can still reach the observer, so it
+// may be destroyed straight away. Called from inside update() it returns
+// without waiting; the observer then stops receiving new notifications but
+// must outlive the ones already in flight.
 void Menu::removeObserver(Observer* observer) {
-    auto it = std::find(observers.begin(), observers.end(), observer);
-    if (it != observers.end()) {
-        observers.erase(it);
+    std::vector<std::weak_ptr<const std::vector<Observer*>>> draining;
+    {
+        std::lock_guard<std::mutex> lock(menuMutex);
+        auto it = observerIndex.find(observer);
+        if (it == observerIndex.end()) return;
+        std::size_t position = it->second;
+        observers[position] = observers.back();
+        observerIndex[observers[position]] = position;
+        observers.pop_back();
+        observerIndex.erase(observer);
+        retireObservers();
+        draining = retiredSnapshots;
+    }
+    if (notifyDepth > 0) return;
+    // Grace period: readers and queued events still holding an older snapshot finish first
+    for (const auto& snapshot : draining) {
+        while (!snapshot.expired()) {
+            std::this_thread::yield();
+        }
     }
+    std::atomic_thread_fence(std::memory_order_acquire);
 }
 
-void PizzaMenu::addPizza(Pizza* pizza) {
+// nullptr switches back to synchronous delivery
+void Menu::setDispatcher(NotificationDispatcher* asyncDispatcher) {
+    dispatcher = asyncDispatcher;
+}
+
+std::size_t Menu::getPizzaCount() {
+    std::lock_guard<std::mutex> lock(menuMutex);
+    return pizzas.size();
+}
+
+std::size_t Menu::getObserverCount() {
+    std::lock_guard<std::mutex> lock(menuMutex);
+    return observers.size();
+}
+
+// Matches the name the pizza had when it was added
+Pizza* Menu::findPizza(const std::string& name) {
+    std::lock_guard<std::mutex> lock(menuMutex);
+    auto it = pizzasByName.find(name);
+    return it == pizzasByName.end() ? nullptr : it->second.front();
+}
+
+Pizza* Menu::findPizza(std::size_t id) {
+    std::lock_guard<std::mutex> lock(menuMutex);
+    auto it = pizzasById.find(id);
+    return it == pizzasById.end() ? nullptr : it->second;
+}
+
+// 0 when the pizza is not on this menu
+std::size_t Menu::getPizzaId(Pizza* pizza) {
+    std::lock_guard<std::mutex> lock(menuMutex);
+    auto it = pizzaIndex.find(pizza);
+    return it == pizzaIndex.end() ? 0 : it->second.id;
+}
+
+std::shared_ptr<const MenuSnapshot> Menu::snapshot() {
+    std::shared_ptr<const MenuSnapshot> current = std::atomic_load(&menuSnapshot);
+    if (current->getVersion() == version.load(std::memory_order_acquire)) return current;
+    std::lock_guard<std::mutex> lock(menuMutex);
+    if (menuSnapshot->getVersion() != version.load(std::memory_order_relaxed)) {
+        rebuildSnapshot();
+    }
+    return menuSnapshot;
+}
+
+// Once more chunks are dirty than exist, the next rebuild redoes them all
+void Menu::markDirty(std::size_t position) {
+    if (allChunksDirty) return;
+    dirtyChunks.push_back(position / MenuSnapshot::CHUNK_SIZE);
+    if (dirtyChunks.size() > pizzas.size() / MenuSnapshot::CHUNK_SIZE + 1) {
+        allChunksDirty = true;
+        dirtyChunks.clear();
+    }
+}
+
+// Starts from the previous version's chunk table, so untouched chunks are shared
+void Menu::rebuildSnapshot() {
+    const std::size_t chunkSize = MenuSnapshot::CHUNK_SIZE;
+    std::shared_ptr<MenuSnapshot> next = std::make_shared<MenuSnapshot>();
+    next->version = version.load(std::memory_order_relaxed);
+    next->count = pizzas.size();
+    next->chunks = menuSnapshot->chunks;
+    next->chunks.resize((pizzas.size() + chunkSize - 1) / chunkSize);
+    
+    if (allChunksDirty) {
+        dirtyChunks.clear();
+        for (std::size_t chunk = 0; chunk < next->chunks.size(); chunk++) {
+            dirtyChunks.push_back(chunk);
+        }
+    } else {
+        std::sort(dirtyChunks.begin(), dirtyChunks.end());
+        dirtyChunks.erase(std::unique(dirtyChunks.begin(), dirtyChunks.end()), dirtyChunks.end());
+    }
+    for (std::size_t chunk : dirtyChunks) {
+        if (chunk >= next->chunks.size()) break;
+        std::size_t end = std::min(pizzas.size(), (chunk + 1) * chunkSize);
+        std::shared_ptr<MenuSnapshot::Chunk> items = std::make_shared<MenuSnapshot::Chunk>();
+        items->reserve(end - chunk * chunkSize);
+        for (std::size_t i = chunk * chunkSize; i < end; i++) {
+            const PizzaEntry& entry = pizzaIndex.find(pizzas[i])->second;
+            items->push_back(MenuItem{entry.id, pizzas[i], entry.name, pizzas[i]->getPrice()});
+        }
+        next->chunks[chunk] = std::move(items);
+    }
+    dirtyChunks.clear();
+    allChunksDirty = false;
+    std::atomic_store(&menuSnapshot, std::shared_ptr<const MenuSnapshot>(std::move(next)));
+}
+
+// A pizza is listed at most once; adding it again changes nothing.
+bool Menu::insertPizza(Pizza* pizza, std::string& name) {
+    std::lock_guard<std::mutex> lock(menuMutex);
+    if (pizzaIndex.count(pizza) != 0) return false;
+    name = pizza->getName();
+    std::size_t id = nextPizzaId++;
+    std::vector<Pizza*>& sameName = pizzasByName[name];
+    pizzaIndex.emplace(pizza, PizzaEntry{pizzas.size(), sameName.size(), id, name});
+    sameName.push_back(pizza);
+    pizzasById.emplace(id, pizza);
     pizzas.push_back(pizza);
-    notifyObservers("New pizza added to menu: " + pizza->getName());
+    markDirty(pizzas.size() - 1);
+    version.fetch_add(1, std::memory_order_release);
+    PIZZA_COUNT(METRIC_MENU_PIZZAS_ADDED, 1);
+    return true;
+}
+
+// Swap-removes from the dense list and from the pizza's name bucket.
+bool Menu::erasePizza(Pizza* pizza, std::string& name) {
+    std::lock_guard<std::mutex> lock(menuMutex);
+    auto it = pizzaIndex.find(pizza);
+    if (it == pizzaIndex.end()) return false;
+    PizzaEntry entry = std::move(it->second);
+    pizzaIndex.erase(it);
+    pizzasById.erase(entry.id);
+    
+    auto bucket = pizzasByName.find(entry.name);
+    std::vector<Pizza*>& sameName = bucket->second;
+    sameName[entry.namePosition] = sameName.back();
+    sameName.pop_back();
+    if (entry.namePosition < sameName.size()) {
+        pizzaIndex[sameName[entry.namePosition]].namePosition = entry.namePosition;
+    }
+    if (sameName.empty()) {
+        pizzasByName.erase(bucket);
+    }
+    
+    pizzas[entry.position] = pizzas.back();
+    pizzas.pop_back();
+    if (entry.position < pizzas.size()) {
+        pizzaIndex[pizzas[entry.position]].position = entry.position;
+    }
+    markDirty(entry.position);
+    markDirty(pizzas.size());
+    version.fetch_add(1, std::memory_order_release);
+    name = std::move(entry.name);
+    PIZZA_COUNT(METRIC_MENU_PIZZAS_REMOVED, 1);
+    return true;
+}
+
+// Observers added or removed mid-notification take effect from the next message.
+void Menu::deliver(const std::string& message) {
+    std::shared_ptr<const std::vector<Observer*>> snapshot = std::atomic_load(&observerSnapshot);
+    if (!snapshot) {
+        std::lock_guard<std::mutex> lock(menuMutex);
+        snapshot = std::atomic_load(&observerSnapshot);
+        if (!snapshot) {
+            snapshot = std::make_shared<const std::vector<Observer*>>(observers);
+            std::atomic_store(&observerSnapshot, snapshot);
+        }
+    }
+    PIZZA_COUNT(METRIC_NOTIFICATIONS, 1);
+    NotificationDispatcher* async = dispatcher;
+    if (async == nullptr) {
+        std::uint64_t start = PIZZA_METRICS_SAMPLE() ? PIZZA_METRICS_NOW() : 0;
+        NotifyScope scope;
+        for (auto observer : *snapshot) {
+            observer->update(message);
+        }
+        PIZZA_COUNT(METRIC_OBSERVER_UPDATES, snapshot->size());
+        if (start != 0) {
+            PIZZA_RECORD(METRIC_FAN_OUT_NS, PIZZA_METRICS_NOW() - start);
+        }
+        return;
+    }
+    async->post(snapshot, message);
+}
+
+void PizzaMenu::addPizza(Pizza* pizza) {
+    std::string name;
+    if (insertPizza(pizza, name)) {
+        notifyObservers("New pizza added to menu: " + name);
+    }
 }
 
 void PizzaMenu::removePizza(Pizza* pizza) {
-    auto it = std::find(pizzas.begin(), pizzas.end(), pizza);
-    if (it != pizzas.end()) {
-        pizzas.erase(it);
-        notifyObservers("Pizza removed from menu: " + pizza->getName());
+    std::string name;
+    if (erasePizza(pizza, name)) {
+        notifyObservers("Pizza removed from menu: " + name);
     }
 }
 
 void PizzaMenu::notifyObservers(const std::string& message) {
-    for (auto observer : observers) {
-        observer->update(message);
-    }
+    deliver(message);
 }
 
 void SpecialsMenu::addPizza(Pizza* pizza) {
-    pizzas.push_back(pizza);
-    notifyObservers("New special added: " + pizza->getName());
+    std::string name;
+    if (insertPizza(pizza, name)) {
+        notifyObservers("New special added: " + name);
+    }
 }
 
 void SpecialsMenu::removePizza(Pizza* pizza) {
-    auto it = std::find(pizzas.begin(), pizzas.end(), pizza);
-    if (it != pizzas.end()) {
-        pizzas.erase(it);
-        notifyObservers("Special removed: " + pizza->getName());
+    std::string name;
+    if (erasePizza(pizza, name)) {
+        notifyObservers("Special removed: " + name);
     }
 }
 
 void SpecialsMenu::notifyObservers(const std::string& message) {
-    for (auto observer : observers) {
-        observer->update(message);
-    }
+    deliver(message);
 }
 
 // ==================== STATE PATTERN IMPLEMENTATION ====================
+OrderPhase::OrderPhase(bool sharedInstance) : shared(sharedInstance) {}
 OrderPhase::~OrderPhase() {}
+bool OrderPhase::isShared() const { return shared; }
+
+OrderStarted::OrderStarted() : OrderPhase(false) {}
+OrderStarted::OrderStarted(bool sharedInstance) : OrderPhase(sharedInstance) {}
+OrderStarted* OrderStarted::instance() {
+    static OrderStarted state(true);
+    return &state;
+}
+
+Pending::Pending() : OrderPhase(false) {}
+Pending::Pending(bool sharedInstance) : OrderPhase(sharedInstance) {}
+Pending* Pending::instance() {
+    static Pending state(true);
+    return &state;
+}
+
+Preparing::Preparing() : OrderPhase(false) {}
+Preparing::Preparing(bool sharedInstance) : OrderPhase(sharedInstance) {}
+Preparing* Preparing::instance() {
+    static Preparing state(true);
+    return &state;
+}
+
+Ready::Ready() : OrderPhase(false) {}
+Ready::Ready(bool sharedInstance) : OrderPhase(sharedInstance) {}
+Ready* Ready::instance() {
+    static Ready state(true);
+    return &state;
+}
 
 void OrderStarted::handleState(PlaceOrder* order) {
-    std::cout << "Order has been received and is starting...\n";
-    order->setState(new Pending());
+    PIZZA_LOG(LOG_INFO, "Order has been received and is starting...");
+    order->setState(Pending::instance());
 }
 std::string OrderStarted::getStateName() const { return "ORDER STARTED"; }
 
 void Pending::handleState(PlaceOrder* order) {
-    std::cout << "Order is pending (e.g., awaiting kitchen availability)...\n";
-    order->setState(new Preparing());
+    PIZZA_LOG(LOG_INFO, "Order is pending (e.g., awaiting kitchen availability)...");
+    order->setState(Preparing::instance());
 }
 std::string Pending::getStateName() const { return "PENDING"; }
 
 void Preparing::handleState(PlaceOrder* order) {
-    std::cout << "Pizza is being prepared...\n";
+    PIZZA_LOG(LOG_INFO, "Pizza is being prepared...");
     
-    bool hasIssue = (std::rand() % 100) < 20;
+    bool hasIssue = order->rollPreparationIssue();
+    if (order->getPreparingSince() != 0) {
+        PIZZA_RECORD(METRIC_PREPARING_NS, PIZZA_METRICS_NOW() - order->getPreparingSince());
+    }
     
     if (hasIssue) {
-        std::cout << "*** Issue discovered! Moving back to PENDING. ***\n";
-        order->setState(new Pending());
+        PIZZA_LOG(LOG_WARNING, "*** Issue discovered! Moving back to PENDING. ***");
+        PIZZA_COUNT(METRIC_PREPARING_RETRIES, 1);
+        order->setState(Pending::instance());
     } else {
-        std::cout << "Preparation complete! Moving to READY.\n";
-        order->setState(new Ready());
+        PIZZA_LOG(LOG_INFO, "Preparation complete! Moving to READY.");
+        PIZZA_COUNT(METRIC_ORDERS_READY, 1);
+        order->setState(Ready::instance());
     }
 }
 std::string Preparing::getStateName() const { return "PREPARING"; }
 
 void Ready::handleState(PlaceOrder* order) {
     (void)order; // Suppress unused parameter warning
-    std::cout << "ORDER IS READY FOR PICKUP! :)\n";
+    PIZZA_LOG(LOG_INFO, "ORDER IS READY FOR PICKUP! :)");
 }
 std::string Ready::getStateName() const { return "READY"; }
 
 // ==================== MERGED PLACEORDER IMPLEMENTATION ====================
-PlaceOrder::PlaceOrder() : discountStrategy(new RegularPrice()), currentState(new OrderStarted()) {}
+PlaceOrder::PlaceOrder()
+    : discountStrategy(new RegularPrice()), currentState(OrderStarted::instance()), randomState(0),
+      journal(nullptr), journalId(0), preparingSince(0), stateWaiters(nullptr) {
+    PIZZA_COUNT(METRIC_ORDERS_CREATED, 1);
+}
 
+// Tearing the order down is not an order event, so nothing is journaled
 PlaceOrder::~PlaceOrder() {
+    while (stateWaiters != nullptr) {
+        StateWaiter* waiter = stateWaiters;
+        stateWaiters = waiter->next;
+        waiter->stateReached(false);
+    }
+    journal = nullptr;
     clearOrder();
     delete discountStrategy;
-    delete currentState;
+    if (!currentState->isShared()) delete currentState;
 }
 
-void PlaceOrder::addPizza(Pizza* pizza) { 
-    pizzas.push_back(pizza); 
+// Pizzas built under a PizzaArena::Scope on this arena are released in bulk
+// by clearOrder(), so they must not outlive the order or be handed to another.
+PizzaArena& PlaceOrder::getArena() {
+    return arena;
 }
 
+// The pizza is compiled on the way in; later edits to its tree are not re-priced.
+void PlaceOrder::addPizza(PizzaPtr pizza) { 
+    if (journal != nullptr) {
+        thread_local std::string payload;
+        payload.clear();
+        pizza->writeBinary(payload);
+        journal->append(journalId, JOURNAL_ADD_PIZZA, payload.data(), payload.size());
+    }
+    records.push_back(PizzaRecord::compile(pizza.get()));
+    pizzas.push_back(std::move(pizza));
+    PIZZA_COUNT(METRIC_PIZZAS_ORDERED, 1);
+}
+
+// A journaled order only accepts the built-in strategies, which replay can
+// rebuild from their code; anything else throws and stays owned by the caller.
 void PlaceOrder::setDiscountStrategy(DiscountStrategy* strategy) {
+    if (journal != nullptr) {
+        DiscountCode discount = OrderSerializer::discountCodeOf(strategy);
+        if (discount == DISCOUNT_CUSTOM) {
+            throw std::invalid_argument("PlaceOrder: journal " + strategy->getStrategyName() + ": strategy has no discount code");
+        }
+        char code = static_cast<char>(discount);
+        journal->append(journalId, JOURNAL_SET_DISCOUNT, &code, 1);
+    }
     delete discountStrategy;
     discountStrategy = strategy;
 }
 
-double PlaceOrder::calculateTotal() {
-    double total = 0;
-    for (auto pizza : pizzas) {
-        total += pizza->getPrice();
+Money PlaceOrder::calculateSubtotal() {
+    Money total;
+    for (const auto& record : records) {
+        total += record.getPrice();
     }
-    return discountStrategy->applyDiscount(total);
+    return total;
+}
+
+Money PlaceOrder::calculateTotal() {
+    return discountStrategy->applyDiscount(*this, calculateSubtotal());
 }
 
 int PlaceOrder::getPizzaCount() { 
     return pizzas.size(); 
 }
 
-double PlaceOrder::getTotal() { 
+Money PlaceOrder::getTotal() { 
     return calculateTotal(); 
 }
 
 void PlaceOrder::processOrder() {
+    PIZZA_COUNT(METRIC_ORDER_STEPS, 1);
     currentState->handleState(this);
 }
 
 void PlaceOrder::setState(OrderPhase* newState) {
-    if (currentState != nullptr) {
+    if (journal != nullptr) {
+        char code = static_cast<char>(OrderSerializer::phaseCodeOf(newState->getStateName()));
+        journal->append(journalId, JOURNAL_SET_STATE, &code, 1);
+    }
+    if (currentState != nullptr && !currentState->isShared()) {
         delete currentState;
     }
     currentState = newState;
-    std::cout << "Order state changed to: " << currentState->getStateName() << std::endl;
-}
-
-std::string PlaceOrder::getStatus() const {
-    return currentState->getStateName();
+#ifndef PIZZASHOP_NO_METRICS
+    preparingSince = typeid(*newState) == typeid(Preparing) && Metrics::sampleTick() ? Metrics::now() : 0;
+#endif
+    PIZZA_COUNT(METRIC_STATE_CHANGES, 1);
+    PIZZA_LOG(LOG_INFO, "Order state changed to: " << currentState->getStateName());
+    if (stateWaiters != nullptr) wakeStateWaiters();
+}
+
+// Matching waiters are unlinked before any is told, so one may wait again
+void PlaceOrder::wakeStateWaiters() {
+    PhaseCode phase = OrderSerializer::phaseCodeOf(currentState->getStateName());
+    StateWaiter* reached = nullptr;
+    StateWaiter** link = &stateWaiters;
+    while (*link != nullptr) {
+        StateWaiter* waiter = *link;
+        if (waiter->phase == phase) {
+            *link = waiter->next;
+            waiter->next = reached;
+            reached = waiter;
+        } else {
+            link = &waiter->next;
+        }
+    }
+    while (reached != nullptr) {
+        StateWaiter* waiter = reached;
+        reached = waiter->next;
+        waiter->stateReached(true);
+    }
+}
+
+bool PlaceOrder::waitForState(StateWaiter* waiter) {
+    if (OrderSerializer::phaseCodeOf(currentState->getStateName()) == waiter->phase) return false;
+    waiter->next = stateWaiters;
+    stateWaiters = waiter;
+    return true;
+}
+
+#if defined(__cpp_impl_coroutine)
+// Throws std::invalid_argument for a name no phase reports, which would
+// otherwise wait for ORDER STARTED
+OrderStateAwaiter PlaceOrder::untilState(const std::string& status) {
+    PhaseCode phase = OrderSerializer::phaseCodeOf(status);
+    if (phase == PHASE_ORDER_STARTED && status != OrderStarted::instance()->getStateName()) {
+        throw std::invalid_argument("PlaceOrder: untilState " + status + ": unknown order status");
+    }
+    return OrderStateAwaiter(*this, phase);
+}
+#endif
+
+std::string PlaceOrder::getStatus() const {
+    return currentState->getStateName();
+}
+
+// Seeded orders roll on their own generator and repeat exactly; unseeded
+// orders share one generator per thread, seeded from std::random_device.
+// Either way many orders can be prepared on different threads.
+void PlaceOrder::setRandomSeed(unsigned int seed) {
+    randomState = seed;
+}
+
+std::uint64_t PlaceOrder::getPreparingSince() const {
+    return preparingSince;
+}
+
+namespace {
+// xorshift32; state must be non-zero
+unsigned int nextRandom(unsigned int& state) {
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 5;
+    return state;
+}
+
+unsigned int& threadRandomState() {
+    thread_local unsigned int state = std::random_device()() | 1u;
+    return state;
+}
+}
+
+// 20% chance that preparation runs into an issue
+bool PlaceOrder::rollPreparationIssue() {
+    unsigned int& state = randomState != 0 ? randomState : threadRandomState();
+    return (nextRandom(state) % 100) < 20;
 }
 
 void PlaceOrder::printOrderSummary() {
@@ -233,69 +1275,2664 @@ void PlaceOrder::printOrderSummary() {
     if (!pizzas.empty()) {
         std::cout << "\nPizzas in order:\n";
         for (size_t i = 0; i < pizzas.size(); i++) {
-            std::cout << (i + 1) << ". " << pizzas[i]->getName() << " - R" << pizzas[i]->getPrice() << std::endl;
+            std::cout << (i + 1) << ". ";
+            pizzas[i]->writeName(std::cout);
+            std::cout << " - R" << pizzas[i]->getPrice() << std::endl;
         }
     }
 }
 
+const std::vector<PizzaPtr>& PlaceOrder::getPizzas() const {
+    return pizzas;
+}
+
+const std::vector<PizzaRecord>& PlaceOrder::getRecords() const {
+    return records;
+}
+
+DiscountStrategy* PlaceOrder::getDiscountStrategy() const {
+    return discountStrategy;
+}
+
+void PlaceOrder::attachJournal(OrderJournal* target, std::uint64_t orderId) {
+    journal = target;
+    journalId = orderId;
+}
+
 void PlaceOrder::clearOrder() {
-    for (auto pizza : pizzas) {
-        delete pizza;
+    // One clear record stands for the whole reset below
+    OrderJournal* attached = journal;
+    if (attached != nullptr) {
+        attached->append(journalId, JOURNAL_CLEAR_ORDER);
     }
+    journal = nullptr;
     pizzas.clear();
+    records.clear();
+    arena.reset();
     setDiscountStrategy(new RegularPrice());
-    setState(new OrderStarted());
+    setState(OrderStarted::instance());
+    journal = attached;
 }
 
 // ==================== PIZZA FACTORY IMPLEMENTATION ====================
-Pizza* PizzaFactory::createPepperoniPizza() {
-    ToppingGroup* pepperoni = new ToppingGroup("Pepperoni Pizza");
-    pepperoni->add(new Topping(10.00, "Dough"));
-    pepperoni->add(new Topping(5.00, "Tomato Sauce"));
-    pepperoni->add(new Topping(15.00, "Cheese"));
-    pepperoni->add(new Topping(20.00, "Pepperoni"));
-    return new BasePizza(pepperoni);
-}
-
-Pizza* PizzaFactory::createVegetarianPizza() {
-    ToppingGroup* vegetarian = new ToppingGroup("Vegetarian Pizza");
-    vegetarian->add(new Topping(10.00, "Dough"));
-    vegetarian->add(new Topping(5.00, "Tomato Sauce"));
-    vegetarian->add(new Topping(15.00, "Cheese"));
-    vegetarian->add(new Topping(12.00, "Mushrooms"));
-    vegetarian->add(new Topping(10.00, "Green Peppers"));
-    vegetarian->add(new Topping(8.00, "Onions"));
-    return new BasePizza(vegetarian);
-}
-
-Pizza* PizzaFactory::createMeatLoversPizza() {
-    ToppingGroup* meatLovers = new ToppingGroup("Meat Lovers Pizza");
-    meatLovers->add(new Topping(10.00, "Dough"));
-    meatLovers->add(new Topping(5.00, "Tomato Sauce"));
-    meatLovers->add(new Topping(15.00, "Cheese"));
-    meatLovers->add(new Topping(20.00, "Pepperoni"));
-    meatLovers->add(new Topping(25.00, "Beef Sausage"));
-    meatLovers->add(new Topping(22.00, "Salami"));
-    return new BasePizza(meatLovers);
-}
-
-Pizza* PizzaFactory::createVegetarianDeluxePizza() {
-    ToppingGroup* vegDeluxe = new ToppingGroup("Vegetarian Deluxe Pizza");
-    vegDeluxe->add(new Topping(10.00, "Dough"));
-    vegDeluxe->add(new Topping(5.00, "Tomato Sauce"));
-    vegDeluxe->add(new Topping(15.00, "Cheese"));
-    vegDeluxe->add(new Topping(12.00, "Mushrooms"));
-    vegDeluxe->add(new Topping(10.00, "Green Peppers"));
-    vegDeluxe->add(new Topping(8.00, "Onions"));
-    vegDeluxe->add(new Topping(18.00, "Feta Cheese"));
-    vegDeluxe->add(new Topping(15.00, "Olives"));
-    return new BasePizza(vegDeluxe);
-}
-
-Pizza* PizzaFactory::addExtraCheese(Pizza* pizza) {
-    return new ExtraCheese(pizza);
-}
-
-Pizza* PizzaFactory::addStuffedCrust(Pizza* pizza) {
-    return new StuffedCrust(pizza);
-}
\ No newline at end of file
+// Builds the full Composite/Decorator tree for a recipe out of shared catalog toppings
+PizzaPtr PizzaFactory::createFromToppings(const char* name, const RecipeTopping* toppings, std::size_t count) {
+    ToppingCatalog& catalog = ToppingCatalog::instance();
+    ToppingGroup* group = new ToppingGroup(name);
+    PizzaPtr owned(group);
+    group->reserve(count);
+    for (std::size_t i = 0; i < count; i++) {
+        group->add(PizzaPtr(catalog.get(toppings[i].name, toppings[i].price)));
+    }
+    return makePizza<BasePizza>(std::move(owned));
+}
+
+PizzaPtr PizzaFactory::createPepperoniPizza() {
+    const auto& recipe = MenuRecipes::Pepperoni;
+    return createFromToppings(recipe.name, recipe.toppings, recipe.size());
+}
+
+PizzaPtr PizzaFactory::createVegetarianPizza() {
+    const auto& recipe = MenuRecipes::Vegetarian;
+    return createFromToppings(recipe.name, recipe.toppings, recipe.size());
+}
+
+PizzaPtr PizzaFactory::createMeatLoversPizza() {
+    const auto& recipe = MenuRecipes::MeatLovers;
+    return createFromToppings(recipe.name, recipe.toppings, recipe.size());
+}
+
+PizzaPtr PizzaFactory::createVegetarianDeluxePizza() {
+    const auto& recipe = MenuRecipes::VegetarianDeluxe;
+    return createFromToppings(recipe.name, recipe.toppings, recipe.size());
+}
+
+PizzaPtr PizzaFactory::addExtraCheese(PizzaPtr pizza) {
+    return AddOnPizza::add(std::move(pizza), ExtraCheeseAddOn{kExtraCheeseCost});
+}
+
+PizzaPtr PizzaFactory::addStuffedCrust(PizzaPtr pizza) {
+    return AddOnPizza::add(std::move(pizza), StuffedCrustAddOn{kStuffedCrustCost});
+}
+
+// ==================== BINARY SERIALIZATION IMPLEMENTATION ====================
+namespace {
+const std::size_t kNodeHeaderSize = 5;
+const std::size_t kOrderHeaderSize = 12;
+const char kOrderMagic[4] = {'P', 'Z', 'O', 'R'};
+const int kMaxNodeDepth = 256;
+// Per-node bound on wire amounts. It also keeps any sum over a buffer that
+// fits in memory inside Money's range.
+const double kMaxWireAmount = 10000000.0;
+
+template <typename T>
+void appendRaw(std::string& out, T value) {
+    out.append(reinterpret_cast<const char*>(&value), sizeof(T));
+}
+
+template <typename T>
+T readRaw(const char* at) {
+    T value;
+    std::memcpy(&value, at, sizeof(T));
+    return value;
+}
+
+std::size_t beginNode(std::string& out, PizzaNodeTag tag) {
+    std::size_t start = out.size();
+    out.push_back(static_cast<char>(tag));
+    appendRaw<std::uint32_t>(out, 0);
+    return start;
+}
+
+void endNode(std::string& out, std::size_t start) {
+    std::uint32_t size = static_cast<std::uint32_t>(out.size() - start);
+    std::memcpy(&out[start + 1], &size, sizeof(size));
+}
+
+// Labels longer than a u16 can describe are truncated
+void appendLabel(std::string& out, const char* label, std::size_t length) {
+    std::uint16_t stored = static_cast<std::uint16_t>(std::min<std::size_t>(length, 0xFFFF));
+    appendRaw(out, stored);
+    out.append(label, stored);
+}
+
+// Amounts stay f64 rand on the wire; whole cents round-trip through a double exactly
+void appendMoney(std::string& out, Money amount) {
+    appendRaw(out, amount.toDouble());
+}
+
+void appendToppingNode(std::string& out, const char* name, std::size_t length, Money price) {
+    std::size_t start = beginNode(out, NODE_TOPPING);
+    appendMoney(out, price);
+    appendLabel(out, name, length);
+    endNode(out, start);
+}
+
+PizzaNodeTag addOnTag(const AddOn& addOn) {
+    return std::holds_alternative<ExtraCheeseAddOn>(addOn) ? NODE_EXTRA_CHEESE : NODE_STUFFED_CRUST;
+}
+
+bool validateNode(const char* data, std::size_t size, int depth);
+
+// False for NaN and infinities as well
+bool validAmount(const char* at) {
+    double amount = readRaw<double>(at);
+    return amount >= -kMaxWireAmount && amount <= kMaxWireAmount;
+}
+
+// Children must tile [offset, end) exactly
+bool validateChildren(const char* data, std::size_t offset, std::size_t end, std::size_t expected, int depth) {
+    std::size_t found = 0;
+    while (offset < end) {
+        if (end - offset < kNodeHeaderSize) return false;
+        std::uint32_t childSize = readRaw<std::uint32_t>(data + offset + 1);
+        if (childSize < kNodeHeaderSize || childSize > end - offset) return false;
+        if (!validateNode(data + offset, childSize, depth + 1)) return false;
+        offset += childSize;
+        found++;
+    }
+    return found == expected;
+}
+
+bool validateNode(const char* data, std::size_t size, int depth) {
+    if (depth > kMaxNodeDepth || size < kNodeHeaderSize) return false;
+    if (readRaw<std::uint32_t>(data + 1) != size) return false;
+    switch (static_cast<unsigned char>(data[0])) {
+        case NODE_TOPPING: {
+            if (size < kNodeHeaderSize + 10 || !validAmount(data + kNodeHeaderSize)) return false;
+            std::uint16_t length = readRaw<std::uint16_t>(data + kNodeHeaderSize + 8);
+            return size == kNodeHeaderSize + 10 + length;
+        }
+        case NODE_GROUP: {
+            if (size < kNodeHeaderSize + 6) return false;
+            std::uint16_t length = readRaw<std::uint16_t>(data + kNodeHeaderSize);
+            if (size < kNodeHeaderSize + 6 + std::size_t(length)) return false;
+            std::uint32_t count = readRaw<std::uint32_t>(data + kNodeHeaderSize + 2 + length);
+            return validateChildren(data, kNodeHeaderSize + 6 + length, size, count, depth);
+        }
+        case NODE_BASE:
+            return validateChildren(data, kNodeHeaderSize, size, 1, depth);
+        case NODE_EXTRA_CHEESE:
+        case NODE_STUFFED_CRUST:
+            if (size < kNodeHeaderSize + 8 || !validAmount(data + kNodeHeaderSize)) return false;
+            return validateChildren(data, kNodeHeaderSize + 8, size, 1, depth);
+        default:
+            return false;
+    }
+}
+}
+
+// Unknown leaf types are stored as a topping carrying their label and price
+void Pizza::writeBinary(std::string& out) {
+    std::string label = getName();
+    appendToppingNode(out, label.data(), label.size(), getPrice());
+}
+
+void Topping::writeBinary(std::string& out) {
+    appendToppingNode(out, name.data(), name.size(), price);
+}
+
+void ToppingGroup::writeBinary(std::string& out) {
+    std::size_t start = beginNode(out, NODE_GROUP);
+    appendLabel(out, name.data(), name.size());
+    appendRaw<std::uint32_t>(out, static_cast<std::uint32_t>(toppings.size()));
+    for (const auto& topping : toppings) {
+        topping->writeBinary(out);
+    }
+    endNode(out, start);
+}
+
+void MenuPizza::writeBinary(std::string& out) {
+    std::size_t base = beginNode(out, NODE_BASE);
+    std::size_t group = beginNode(out, NODE_GROUP);
+    appendLabel(out, recipeName, std::strlen(recipeName));
+    appendRaw<std::uint32_t>(out, static_cast<std::uint32_t>(toppingCount));
+    for (std::size_t i = 0; i < toppingCount; i++) {
+        appendToppingNode(out, toppings[i].name, std::strlen(toppings[i].name), toppings[i].price);
+    }
+    endNode(out, group);
+    endNode(out, base);
+}
+
+void BasePizza::writeBinary(std::string& out) {
+    std::size_t start = beginNode(out, NODE_BASE);
+    toppings->writeBinary(out);
+    endNode(out, start);
+}
+
+void ExtraCheese::writeBinary(std::string& out) {
+    std::size_t start = beginNode(out, NODE_EXTRA_CHEESE);
+    appendMoney(out, extraCost);
+    pizza->writeBinary(out);
+    endNode(out, start);
+}
+
+void StuffedCrust::writeBinary(std::string& out) {
+    std::size_t start = beginNode(out, NODE_STUFFED_CRUST);
+    appendMoney(out, extraCost);
+    pizza->writeBinary(out);
+    endNode(out, start);
+}
+
+// Written outermost add-on first, nesting exactly like the decorator chain
+void AddOnPizza::writeBinary(std::string& out) {
+    std::size_t starts[kCapacity];
+    for (std::size_t i = count; i-- > 0;) {
+        starts[i] = beginNode(out, addOnTag(addOns[i]));
+        appendMoney(out, addOnCost(addOns[i]));
+    }
+    pizza->writeBinary(out);
+    for (std::size_t i = 0; i < count; i++) {
+        endNode(out, starts[i]);
+    }
+}
+
+PizzaView::PizzaView() : data(nullptr), size(0) {}
+PizzaView::PizzaView(const char* data, std::size_t size) : data(data), size(size) {}
+
+bool PizzaView::open(const char* data, std::size_t size, PizzaView& view) {
+    if (data == nullptr || size < kNodeHeaderSize) return false;
+    std::uint32_t nodeSize = readRaw<std::uint32_t>(data + 1);
+    if (nodeSize > size || !validateNode(data, nodeSize, 0)) return false;
+    view = PizzaView(data, nodeSize);
+    return true;
+}
+
+PizzaNodeTag PizzaView::tag() const {
+    return data == nullptr ? NODE_INVALID : static_cast<PizzaNodeTag>(static_cast<unsigned char>(data[0]));
+}
+
+std::size_t PizzaView::byteSize() const { return size; }
+
+std::string_view PizzaView::label() const {
+    switch (tag()) {
+        case NODE_TOPPING:
+            return std::string_view(data + kNodeHeaderSize + 10, readRaw<std::uint16_t>(data + kNodeHeaderSize + 8));
+        case NODE_GROUP:
+            return std::string_view(data + kNodeHeaderSize + 2, readRaw<std::uint16_t>(data + kNodeHeaderSize));
+        default:
+            return std::string_view();
+    }
+}
+
+// Topping price or decorator surcharge
+Money PizzaView::cost() const {
+    switch (tag()) {
+        case NODE_TOPPING:
+        case NODE_EXTRA_CHEESE:
+        case NODE_STUFFED_CRUST:
+            return Money(readRaw<double>(data + kNodeHeaderSize));
+        default:
+            return Money();
+    }
+}
+
+std::size_t PizzaView::childCount() const {
+    switch (tag()) {
+        case NODE_GROUP:
+            return readRaw<std::uint32_t>(data + kNodeHeaderSize + 2 + label().size());
+        case NODE_BASE:
+        case NODE_EXTRA_CHEESE:
+        case NODE_STUFFED_CRUST:
+            return 1;
+        default:
+            return 0;
+    }
+}
+
+PizzaView PizzaView::child(std::size_t index) const {
+    std::size_t offset;
+    switch (tag()) {
+        case NODE_GROUP: offset = kNodeHeaderSize + 6 + label().size(); break;
+        case NODE_BASE: offset = kNodeHeaderSize; break;
+        case NODE_EXTRA_CHEESE:
+        case NODE_STUFFED_CRUST: offset = kNodeHeaderSize + 8; break;
+        default: return PizzaView();
+    }
+    for (std::size_t i = 0; i < index; i++) {
+        offset += readRaw<std::uint32_t>(data + offset + 1);
+    }
+    return PizzaView(data + offset, readRaw<std::uint32_t>(data + offset + 1));
+}
+
+// Same association as the tree: group children in order, then each surcharge outwards
+Money PizzaView::getPrice() const {
+    switch (tag()) {
+        case NODE_TOPPING:
+            return cost();
+        case NODE_GROUP: {
+            Money total;
+            std::size_t offset = kNodeHeaderSize + 6 + label().size();
+            for (std::size_t i = 0; i < childCount(); i++) {
+                PizzaView current(data + offset, readRaw<std::uint32_t>(data + offset + 1));
+                total += current.getPrice();
+                offset += current.size;
+            }
+            return total;
+        }
+        case NODE_BASE:
+            return child(0).getPrice();
+        case NODE_EXTRA_CHEESE:
+        case NODE_STUFFED_CRUST:
+            return child(0).getPrice() + cost();
+        default:
+            return Money();
+    }
+}
+
+void PizzaView::appendName(std::string& out) const {
+    switch (tag()) {
+        case NODE_TOPPING:
+            out += label();
+            break;
+        case NODE_GROUP: {
+            out += label();
+            out += " (";
+            std::size_t count = childCount();
+            for (std::size_t i = 0; i < count; i++) {
+                child(i).appendName(out);
+                if (i < count - 1) out += ", ";
+            }
+            out += ")";
+            break;
+        }
+        case NODE_BASE:
+            child(0).appendName(out);
+            break;
+        case NODE_EXTRA_CHEESE:
+            child(0).appendName(out);
+            out += " with Extra Cheese";
+            break;
+        case NODE_STUFFED_CRUST:
+            child(0).appendName(out);
+            out += " with Stuffed Crust";
+            break;
+        default:
+            break;
+    }
+}
+
+std::string PizzaView::getName() const {
+    std::string result;
+    appendName(result);
+    return result;
+}
+
+OrderView::OrderView() : data(nullptr), size(0) {}
+
+// Validates the whole buffer once; accessors afterwards trust it.
+bool OrderView::open(const char* data, std::size_t size, OrderView& view) {
+    if (data == nullptr || size < kOrderHeaderSize) return false;
+    if (std::memcmp(data, kOrderMagic, sizeof(kOrderMagic)) != 0) return false;
+    std::uint16_t version = readRaw<std::uint16_t>(data + 4);
+    if (version == 0 || version > OrderSerializer::FORMAT_VERSION) return false;
+    if (static_cast<unsigned char>(data[6]) > DISCOUNT_FAMILY) return false;
+    if (static_cast<unsigned char>(data[7]) > PHASE_READY) return false;
+    std::uint32_t count = readRaw<std::uint32_t>(data + 8);
+    if (!validateChildren(data, kOrderHeaderSize, size, count, 0)) return false;
+    view.data = data;
+    view.size = size;
+    return true;
+}
+
+std::uint16_t OrderView::getVersion() const { return readRaw<std::uint16_t>(data + 4); }
+DiscountCode OrderView::getDiscountCode() const { return static_cast<DiscountCode>(static_cast<unsigned char>(data[6])); }
+PhaseCode OrderView::getPhaseCode() const { return static_cast<PhaseCode>(static_cast<unsigned char>(data[7])); }
+std::size_t OrderView::getPizzaCount() const { return readRaw<std::uint32_t>(data + 8); }
+
+PizzaView OrderView::pizza(std::size_t index) const {
+    std::size_t offset = kOrderHeaderSize;
+    for (std::size_t i = 0; i < index; i++) {
+        offset += readRaw<std::uint32_t>(data + offset + 1);
+    }
+    return PizzaView(data + offset, readRaw<std::uint32_t>(data + offset + 1));
+}
+
+Money OrderView::getTotal() const {
+    Money total;
+    std::size_t offset = kOrderHeaderSize;
+    for (std::size_t i = 0; i < getPizzaCount(); i++) {
+        PizzaView view(data + offset, readRaw<std::uint32_t>(data + offset + 1));
+        total += view.getPrice();
+        offset += view.byteSize();
+    }
+    DiscountStrategy* strategy = OrderSerializer::createDiscount(getDiscountCode());
+    Money discounted = strategy->applyDiscount(total);
+    delete strategy;
+    return discounted;
+}
+
+void OrderSerializer::writePizza(Pizza* pizza, std::string& out) {
+    pizza->writeBinary(out);
+}
+
+// Throws std::invalid_argument, leaving out untouched, for an order whose
+// strategy is not one of the built-in three
+void OrderSerializer::writeOrder(PlaceOrder& order, std::string& out) {
+    DiscountCode discount = discountCodeOf(order.getDiscountStrategy());
+    if (discount == DISCOUNT_CUSTOM) {
+        throw std::invalid_argument("OrderSerializer: write " + order.getDiscountStrategy()->getStrategyName() +
+                                    ": strategy has no discount code");
+    }
+    out.append(kOrderMagic, sizeof(kOrderMagic));
+    appendRaw(out, FORMAT_VERSION);
+    out.push_back(static_cast<char>(discount));
+    out.push_back(static_cast<char>(phaseCodeOf(order.getStatus())));
+    appendRaw<std::uint32_t>(out, static_cast<std::uint32_t>(order.getPizzas().size()));
+    for (const auto& pizza : order.getPizzas()) {
+        pizza->writeBinary(out);
+    }
+}
+
+// Strategies outside the built-in three, such as RuleDiscount, are
+// DISCOUNT_CUSTOM; writers refuse those rather than record a code that
+// would read back as a different price
+DiscountCode OrderSerializer::discountCodeOf(DiscountStrategy* strategy) {
+    if (dynamic_cast<RegularPrice*>(strategy) != nullptr) return DISCOUNT_REGULAR;
+    if (dynamic_cast<BulkDiscount*>(strategy) != nullptr) return DISCOUNT_BULK;
+    if (dynamic_cast<FamilyDiscount*>(strategy) != nullptr) return DISCOUNT_FAMILY;
+    return DISCOUNT_CUSTOM;
+}
+
+DiscountStrategy* OrderSerializer::createDiscount(DiscountCode code) {
+    switch (code) {
+        case DISCOUNT_BULK: return new BulkDiscount();
+        case DISCOUNT_FAMILY: return new FamilyDiscount();
+        default: return new RegularPrice();
+    }
+}
+
+PhaseCode OrderSerializer::phaseCodeOf(const std::string& status) {
+    if (status == "PENDING") return PHASE_PENDING;
+    if (status == "PREPARING") return PHASE_PREPARING;
+    if (status == "READY") return PHASE_READY;
+    return PHASE_ORDER_STARTED;
+}
+
+OrderPhase* OrderSerializer::phaseFor(PhaseCode code) {
+    switch (code) {
+        case PHASE_PENDING: return Pending::instance();
+        case PHASE_PREPARING: return Preparing::instance();
+        case PHASE_READY: return Ready::instance();
+        default: return OrderStarted::instance();
+    }
+}
+
+PizzaPtr OrderSerializer::readPizza(const PizzaView& view) {
+    switch (view.tag()) {
+        case NODE_TOPPING:
+            return PizzaPtr(ToppingCatalog::instance().get(std::string(view.label()), view.cost()));
+        case NODE_GROUP: {
+            ToppingGroup* group = new ToppingGroup(view.label());
+            PizzaPtr owned(group);
+            group->reserve(view.childCount());
+            for (std::size_t i = 0; i < view.childCount(); i++) {
+                group->add(readPizza(view.child(i)));
+            }
+            return owned;
+        }
+        case NODE_BASE:
+            return makePizza<BasePizza>(readPizza(view.child(0)));
+        case NODE_EXTRA_CHEESE:
+            return makePizza<ExtraCheese>(readPizza(view.child(0)), view.cost());
+        case NODE_STUFFED_CRUST:
+            return makePizza<StuffedCrust>(readPizza(view.child(0)), view.cost());
+        default:
+            return nullptr;
+    }
+}
+
+// Replaces the order's contents; false (order untouched) if the buffer is malformed
+bool OrderSerializer::readOrder(const char* data, std::size_t size, PlaceOrder& order) {
+    OrderView view;
+    if (!OrderView::open(data, size, view)) return false;
+    order.clearOrder();
+    for (std::size_t i = 0; i < view.getPizzaCount(); i++) {
+        order.addPizza(readPizza(view.pizza(i)));
+    }
+    order.setDiscountStrategy(createDiscount(view.getDiscountCode()));
+    order.setState(phaseFor(view.getPhaseCode()));
+    return true;
+}
+
+// ==================== WORK-STEALING THREAD POOL IMPLEMENTATION ====================
+namespace {
+thread_local WorkStealingPool* currentPool = nullptr;
+thread_local std::size_t currentWorker = 0;
+}
+
+WorkStealingPool::WorkStealingPool(std::size_t threadCount)
+    : queued(0), nextQueue(0), stopping(false) {
+    if (threadCount == 0) {
+        threadCount = std::max(1u, std::thread::hardware_concurrency());
+    }
+    for (std::size_t i = 0; i < threadCount; i++) {
+        queues.push_back(std::unique_ptr<WorkQueue>(new WorkQueue()));
+    }
+    for (std::size_t i = 0; i < threadCount; i++) {
+        workers.emplace_back(&WorkStealingPool::workerLoop, this, i);
+    }
+}
+
+WorkStealingPool::~WorkStealingPool() {
+    {
+        std::lock_guard<std::mutex> lock(stateMutex);
+        stopping = true;
+    }
+    workAvailable.notify_all();
+    for (auto& worker : workers) {
+        worker.join();
+    }
+}
+
+void WorkStealingPool::submit(Batch& batch, std::function<void()> task) {
+    std::size_t target;
+    if (currentPool == this) {
+        target = currentWorker;
+    } else {
+        target = nextQueue.fetch_add(1) % queues.size();
+    }
+    {
+        std::lock_guard<std::mutex> lock(stateMutex);
+        batch.pending++;
+    }
+    {
+        std::lock_guard<std::mutex> lock(queues[target]->mutex);
+        queues[target]->tasks.push_back(Task{std::move(task), &batch});
+        queued++;
+    }
+    // Taking the state lock orders this wake-up after any worker's predicate check.
+    { std::lock_guard<std::mutex> lock(stateMutex); }
+    workAvailable.notify_one();
+}
+
+// Own deque from the back first, then steal from the front of the others.
+bool WorkStealingPool::runOne(std::size_t self) {
+    Task task = Task();
+    for (std::size_t i = 0; i < queues.size() && !task.run; i++) {
+        WorkQueue& queue = *queues[(self + i) % queues.size()];
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        if (queue.tasks.empty()) continue;
+        if (i == 0) {
+            task = std::move(queue.tasks.back());
+            queue.tasks.pop_back();
+        } else {
+            task = std::move(queue.tasks.front());
+            queue.tasks.pop_front();
+        }
+    }
+    if (!task.run) return false;
+    queued--;
+    
+    std::exception_ptr error;
+    try {
+        task.run();
+    } catch (...) {
+        error = std::current_exception();
+    }
+    
+    std::lock_guard<std::mutex> lock(stateMutex);
+    if (error && !task.batch->firstError) task.batch->firstError = error;
+    if (--task.batch->pending == 0) {
+        batchDone.notify_all();
+    }
+    return true;
+}
+
+void WorkStealingPool::workerLoop(std::size_t index) {
+    currentPool = this;
+    currentWorker = index;
+    while (true) {
+        if (runOne(index)) continue;
+        std::unique_lock<std::mutex> lock(stateMutex);
+        workAvailable.wait(lock, [this] { return stopping || queued > 0; });
+        if (stopping && queued == 0) return;
+    }
+}
+
+// Runs queued tasks, this batch's or not, until the batch is done; sleeps
+// only while its remaining tasks are running elsewhere. Rethrows the
+// batch's first task failure.
+void WorkStealingPool::wait(Batch& batch) {
+    std::size_t self = currentPool == this ? currentWorker : 0;
+    while (true) {
+        {
+            std::lock_guard<std::mutex> lock(stateMutex);
+            if (batch.pending == 0) break;
+        }
+        if (runOne(self)) continue;
+        std::unique_lock<std::mutex> lock(stateMutex);
+        batchDone.wait(lock, [&batch] { return batch.pending == 0; });
+        break;
+    }
+    std::lock_guard<std::mutex> lock(stateMutex);
+    if (batch.firstError) {
+        std::exception_ptr error = batch.firstError;
+        batch.firstError = nullptr;
+        std::rethrow_exception(error);
+    }
+}
+
+std::size_t WorkStealingPool::size() const {
+    return workers.size();
+}
+
+// ==================== BATCH PRICING IMPLEMENTATION ====================
+BatchPricer::BatchPricer(WorkStealingPool& pool, std::size_t grainSize)
+    : pool(pool), grainSize(std::max<std::size_t>(1, grainSize)) {}
+
+void BatchPricer::priceOrders(PlaceOrder* const* orders, std::size_t count, Money* totals) {
+    WorkStealingPool::Batch batch;
+    for (std::size_t begin = 0; begin < count; begin += grainSize) {
+        std::size_t end = std::min(count, begin + grainSize);
+        pool.submit(batch, [orders, totals, begin, end] {
+            for (std::size_t i = begin; i < end; i++) {
+                totals[i] = orders[i]->calculateTotal();
+            }
+        });
+    }
+    pool.wait(batch);
+}
+
+std::vector<Money> BatchPricer::priceOrders(const std::vector<PlaceOrder*>& orders) {
+    std::vector<Money> totals(orders.size());
+    priceOrders(orders.data(), orders.size(), totals.data());
+    return totals;
+}
+
+// Subtotals are gathered in parallel, then the discount runs as one vector pass per chunk.
+void BatchPricer::repriceWith(PlaceOrder* const* orders, std::size_t count, DiscountStrategy& strategy, Money* totals) {
+    WorkStealingPool::Batch batch;
+    for (std::size_t begin = 0; begin < count; begin += grainSize) {
+        std::size_t end = std::min(count, begin + grainSize);
+        pool.submit(batch, [orders, totals, begin, end, &strategy] {
+            for (std::size_t i = begin; i < end; i++) {
+                totals[i] = orders[i]->calculateSubtotal();
+            }
+            strategy.applyDiscount(orders + begin, totals + begin, totals + begin, end - begin);
+        });
+    }
+    pool.wait(batch);
+}
+
+// ==================== ASYNC NOTIFICATION DISPATCH IMPLEMENTATION ====================
+NotificationDispatcher::NotificationDispatcher(std::size_t threadCount, std::size_t fanOutGrain)
+    : pool(threadCount), fanOutGrain(std::max<std::size_t>(1, fanOutGrain)), stopping(false),
+      delivering(false), eventsDelivered(0), batchesDelivered(0), failedDeliveries(0) {
+    dispatcherThread = std::thread(&NotificationDispatcher::run, this);
+}
+
+// Everything already posted is delivered before the dispatcher shuts down.
+NotificationDispatcher::~NotificationDispatcher() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    queueChanged.notify_all();
+    dispatcherThread.join();
+}
+
+void NotificationDispatcher::post(std::shared_ptr<const std::vector<Observer*>> observers, const std::string& message) {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        queue.push_back(Event{std::move(observers), message});
+    }
+    queueChanged.notify_all();
+}
+
+void NotificationDispatcher::flush() {
+    std::unique_lock<std::mutex> lock(mutex);
+    queueChanged.wait(lock, [this] { return queue.empty() && !delivering; });
+}
+
+std::size_t NotificationDispatcher::getEventsDelivered() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return eventsDelivered;
+}
+
+std::size_t NotificationDispatcher::getBatchesDelivered() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return batchesDelivered;
+}
+
+std::size_t NotificationDispatcher::getFailedDeliveries() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return failedDeliveries;
+}
+
+void NotificationDispatcher::run() {
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true) {
+        queueChanged.wait(lock, [this] { return stopping || !queue.empty(); });
+        if (queue.empty()) return;
+        
+        std::deque<Event> pending;
+        pending.swap(queue);
+        delivering = true;
+        lock.unlock();
+        
+        std::size_t batches = 0;
+        std::size_t failed = 0;
+        std::size_t events = pending.size();
+        while (!pending.empty()) {
+            std::shared_ptr<const std::vector<Observer*>> observers = pending.front().observers;
+            std::vector<std::string> messages;
+            while (!pending.empty() && pending.front().observers == observers) {
+                messages.push_back(std::move(pending.front().message));
+                pending.pop_front();
+            }
+            // A throwing observer only loses the rest of its own chunk of this batch
+            try {
+                deliverBatch(observers, messages);
+            } catch (const std::exception& error) {
+                failed++;
+                PIZZA_LOG(LOG_ERROR, "NotificationDispatcher: deliver batch: " << error.what());
+            } catch (...) {
+                failed++;
+                PIZZA_LOG(LOG_ERROR, "NotificationDispatcher: deliver batch: observer threw a non-exception");
+            }
+            batches++;
+        }
+        
+        lock.lock();
+        eventsDelivered += events;
+        batchesDelivered += batches;
+        failedDeliveries += failed;
+        delivering = false;
+        queueChanged.notify_all();
+    }
+}
+
+void NotificationDispatcher::deliverBatch(const std::shared_ptr<const std::vector<Observer*>>& observers,
+                                          const std::vector<std::string>& messages) {
+    const std::vector<Observer*>& targets = *observers;
+    std::uint64_t start = PIZZA_METRICS_SAMPLE() ? PIZZA_METRICS_NOW() : 0;
+    WorkStealingPool::Batch batch;
+    for (std::size_t begin = 0; begin < targets.size(); begin += fanOutGrain) {
+        std::size_t end = std::min(targets.size(), begin + fanOutGrain);
+        pool.submit(batch, [&targets, &messages, begin, end] {
+            NotifyScope scope;
+            for (std::size_t i = begin; i < end; i++) {
+                for (const auto& message : messages) {
+                    targets[i]->update(message);
+                }
+            }
+        });
+    }
+    pool.wait(batch);
+    PIZZA_COUNT(METRIC_OBSERVER_UPDATES, targets.size() * messages.size());
+    if (start != 0) {
+        PIZZA_RECORD(METRIC_FAN_OUT_NS, PIZZA_METRICS_NOW() - start);
+    }
+}
+
+// ==================== KITCHEN SCHEDULER IMPLEMENTATION ====================
+Kitchen::Kitchen(std::size_t ovenCount, std::size_t queueCapacity,
+                 std::chrono::microseconds baseBackoff, std::chrono::microseconds maxBackoff)
+    : queueCapacity(std::max<std::size_t>(1, queueCapacity)), ovenCount(std::max<std::size_t>(1, ovenCount)),
+      baseBackoff(baseBackoff), maxBackoff(maxBackoff), metrics(), stopping(false) {
+    for (std::size_t i = 0; i < this->ovenCount; i++) {
+        ovens.emplace_back(&Kitchen::ovenLoop, this);
+    }
+}
+
+// Ovens finish the order in hand and stop; unfinished orders are discarded with the kitchen.
+Kitchen::~Kitchen() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    workAvailable.notify_all();
+    spaceAvailable.notify_all();
+    for (auto& oven : ovens) {
+        oven.join();
+    }
+}
+
+int Kitchen::phaseOf(const std::string& status) {
+    if (status == "ORDER STARTED") return STARTED;
+    if (status == "PENDING") return PENDING;
+    if (status == "PREPARING") return PREPARING;
+    return PHASE_COUNT;
+}
+
+// Throws std::runtime_error, leaving the order with the caller, once the
+// kitchen is shutting down: no oven would ever take it.
+void Kitchen::submit(PlaceOrder* order) {
+    int phase = phaseOf(order->getStatus());
+    std::unique_lock<std::mutex> lock(mutex);
+    if (phase != PHASE_COUNT) {
+        spaceAvailable.wait(lock, [this, phase] { return stopping || queues[phase].size() < queueCapacity; });
+    }
+    if (stopping) {
+        throw std::runtime_error("Kitchen: submit order: kitchen is shutting down");
+    }
+    if (metrics.submitted == 0) {
+        startTime = Clock::now();
+    }
+    orders.push_back(std::unique_ptr<PlaceOrder>(order));
+    metrics.submitted++;
+    
+    if (phase == PHASE_COUNT) {
+        readyOrders.push_back(order);
+        metrics.completed++;
+        orderReady.notify_all();
+        return;
+    }
+    queues[phase].push_back(Ticket{order, 0});
+    metrics.maxQueueDepth[phase] = std::max(metrics.maxQueueDepth[phase], queues[phase].size());
+    workAvailable.notify_one();
+}
+
+void Kitchen::drain() {
+    std::unique_lock<std::mutex> lock(mutex);
+    orderReady.wait(lock, [this] { return metrics.completed == metrics.submitted; });
+}
+
+KitchenMetrics Kitchen::getMetrics() {
+    std::lock_guard<std::mutex> lock(mutex);
+    KitchenMetrics snapshot = metrics;
+    for (int phase = 0; phase < PHASE_COUNT; phase++) {
+        snapshot.queueDepth[phase] = queues[phase].size();
+    }
+    snapshot.waitingForRetry = backoff.size();
+    if (metrics.submitted > 0) {
+        snapshot.elapsedSeconds = std::chrono::duration<double>(Clock::now() - startTime).count();
+        snapshot.ordersPerSecond = snapshot.elapsedSeconds > 0 ? metrics.completed / snapshot.elapsedSeconds : 0;
+    }
+    return snapshot;
+}
+
+std::vector<PlaceOrder*> Kitchen::getReadyOrders() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return readyOrders;
+}
+
+// Caller holds the lock
+std::size_t Kitchen::queuedTickets() const {
+    return queues[STARTED].size() + queues[PENDING].size() + queues[PREPARING].size();
+}
+
+// Caller holds the lock. Fills batch with up to kOvenBatch tickets, an even
+// share of what is queued per oven so one oven does not hoard the work.
+// Later phases go first so orders already in the oven finish before new
+// ones start; due retries rejoin the Pending queue.
+void Kitchen::takeTickets(std::vector<Ticket>& batch, Clock::time_point& wakeAt) {
+    Clock::time_point now = Clock::now();
+    while (!backoff.empty() && backoff.begin()->first <= now && queues[PENDING].size() < queueCapacity) {
+        queues[PENDING].push_back(backoff.begin()->second);
+        backoff.erase(backoff.begin());
+        metrics.maxQueueDepth[PENDING] = std::max(metrics.maxQueueDepth[PENDING], queues[PENDING].size());
+    }
+    wakeAt = backoff.empty() ? Clock::time_point::max() : backoff.begin()->first;
+    
+    std::size_t queued = queuedTickets();
+    std::size_t share = std::min(kOvenBatch, (queued + ovenCount - 1) / ovenCount);
+    for (int phase = PREPARING; phase >= STARTED && batch.size() < share; phase--) {
+        bool took = false;
+        while (!queues[phase].empty() && batch.size() < share) {
+            batch.push_back(queues[phase].front());
+            queues[phase].pop_front();
+            took = true;
+        }
+        if (took && phase == STARTED) spaceAvailable.notify_all();
+    }
+}
+
+// Caller holds the lock. Returns the ticket's new home: a queue, the
+// backoff area or the ready list. The routing oven rescans the queues
+// itself, so only the caller decides whether to wake another.
+void Kitchen::route(Ticket ticket, int from) {
+    int phase = phaseOf(ticket.order->getStatus());
+    if (phase == PHASE_COUNT) {
+        readyOrders.push_back(ticket.order);
+        metrics.completed++;
+        orderReady.notify_all();
+        return;
+    }
+    if (from == PREPARING && phase == PENDING) {
+        metrics.retries++;
+        ticket.retries++;
+        std::chrono::microseconds delay = baseBackoff * (1 << std::min<std::size_t>(ticket.retries - 1, 16));
+        backoff.emplace(Clock::now() + std::min(delay, maxBackoff), ticket);
+        return;
+    }
+    queues[phase].push_back(ticket);
+    metrics.maxQueueDepth[phase] = std::max(metrics.maxQueueDepth[phase], queues[phase].size());
+}
+
+// Each lock hold hands an oven a batch of tickets, which it steps outside
+// the lock; orders whose next queue is full stay in hand for another step.
+void Kitchen::ovenLoop() {
+    std::vector<Ticket> batch;
+    std::vector<int> from;
+    std::unique_lock<std::mutex> lock(mutex);
+    while (!stopping) {
+        Clock::time_point wakeAt;
+        takeTickets(batch, wakeAt);
+        if (batch.empty()) {
+            if (wakeAt == Clock::time_point::max()) {
+                workAvailable.wait(lock);
+            } else {
+                workAvailable.wait_until(lock, wakeAt);
+            }
+            continue;
+        }
+        
+        while (!batch.empty()) {
+            lock.unlock();
+            from.clear();
+            for (const auto& ticket : batch) {
+                from.push_back(phaseOf(ticket.order->getStatus()));
+                ticket.order->processOrder();
+            }
+            lock.lock();
+            metrics.transitions += batch.size();
+            std::size_t kept = 0;
+            for (std::size_t i = 0; i < batch.size(); i++) {
+                int next = phaseOf(batch[i].order->getStatus());
+                bool keep = next != PHASE_COUNT && !(from[i] == PREPARING && next == PENDING)
+                            && queues[next].size() >= queueCapacity && !stopping;
+                if (keep) {
+                    batch[kept++] = batch[i];
+                } else {
+                    route(batch[i], from[i]);
+                }
+            }
+            batch.resize(kept);
+        }
+        // One wake-up per batch, and only when there is work beyond this oven's next share
+        if (queuedTickets() > 1) workAvailable.notify_one();
+    }
+}
+
+// ==================== ORDER JOURNAL IMPLEMENTATION ====================
+namespace {
+const char kSegmentMagic[4] = {'P', 'Z', 'J', 'L'};
+const std::uint16_t kJournalVersion = 1;
+const std::size_t kSegmentHeaderSize = 24;
+const std::size_t kRecordHeaderSize = 25;
+const std::size_t kReplayChunk = 256;
+
+struct Crc32Table {
+    std::uint32_t entries[256];
+    
+    Crc32Table() {
+        for (std::uint32_t i = 0; i < 256; i++) {
+            std::uint32_t crc = i;
+            for (int bit = 0; bit < 8; bit++) {
+                crc = (crc & 1) ? 0xEDB88320u ^ (crc >> 1) : crc >> 1;
+            }
+            entries[i] = crc;
+        }
+    }
+};
+
+std::uint32_t crc32(const char* data, std::size_t length) {
+    static const Crc32Table table;
+    std::uint32_t crc = 0xFFFFFFFFu;
+    for (std::size_t i = 0; i < length; i++) {
+        crc = table.entries[(crc ^ static_cast<unsigned char>(data[i])) & 0xFF] ^ (crc >> 8);
+    }
+    return crc ^ 0xFFFFFFFFu;
+}
+
+std::size_t pageSize() {
+    static const std::size_t size = static_cast<std::size_t>(::sysconf(_SC_PAGESIZE));
+    return size;
+}
+
+[[noreturn]] void throwJournalError(const std::string& action, const std::string& path, int error) {
+    throw std::runtime_error("OrderJournal: " + action + " " + path + ": " + std::strerror(error));
+}
+
+std::string segmentPath(const std::string& directory, std::uint64_t index) {
+    char name[40];
+    std::snprintf(name, sizeof(name), "journal-%06llu.log", static_cast<unsigned long long>(index));
+    return directory + "/" + name;
+}
+
+// Segment files in index order
+std::vector<std::pair<std::uint64_t, std::string>> listSegments(const std::string& directory) {
+    std::vector<std::pair<std::uint64_t, std::string>> segments;
+    std::error_code error;
+    for (const auto& entry : std::filesystem::directory_iterator(directory, error)) {
+        std::string name = entry.path().filename().string();
+        if (name.size() <= 12 || name.compare(0, 8, "journal-") != 0 || name.compare(name.size() - 4, 4, ".log") != 0) {
+            continue;
+        }
+        std::string digits = name.substr(8, name.size() - 12);
+        if (digits.find_first_not_of("0123456789") != std::string::npos) continue;
+        segments.emplace_back(std::stoull(digits), entry.path().string());
+    }
+    std::sort(segments.begin(), segments.end());
+    return segments;
+}
+
+// Read-only view of a whole segment file for recovery
+class MappedSegment {
+public:
+    const char* data;
+    std::size_t size;
+    
+    explicit MappedSegment(const std::string& path) : data(nullptr), size(0) {
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) throwJournalError("cannot open", path, errno);
+        struct stat info;
+        if (::fstat(fd, &info) != 0) {
+            int error = errno;
+            ::close(fd);
+            throwJournalError("cannot stat", path, error);
+        }
+        if (info.st_size > 0) {
+            void* mapped = ::mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (mapped == MAP_FAILED) {
+                int error = errno;
+                ::close(fd);
+                throwJournalError("cannot map", path, error);
+            }
+            data = static_cast<const char*>(mapped);
+            size = static_cast<std::size_t>(info.st_size);
+            ::madvise(mapped, size, MADV_SEQUENTIAL);
+        }
+        ::close(fd);
+    }
+    
+    ~MappedSegment() {
+        if (data != nullptr) ::munmap(const_cast<char*>(data), size);
+    }
+    
+    MappedSegment(const MappedSegment&) = delete;
+    MappedSegment& operator=(const MappedSegment&) = delete;
+};
+
+bool validSegmentHeader(const char* data, std::size_t size) {
+    return size >= kSegmentHeaderSize && std::memcmp(data, kSegmentMagic, sizeof(kSegmentMagic)) == 0
+           && readRaw<std::uint16_t>(data + 4) == kJournalVersion;
+}
+
+// Visits every intact record in order. Returns false when the segment ends
+// in a torn or corrupt record rather than at a clean end.
+template <typename Visitor>
+bool scanSegment(const char* data, std::size_t size, Visitor visit) {
+    if (!validSegmentHeader(data, size)) return false;
+    std::size_t offset = kSegmentHeaderSize;
+    while (size - offset >= sizeof(std::uint32_t)) {
+        std::uint32_t recordSize = readRaw<std::uint32_t>(data + offset);
+        if (recordSize == 0) return true;
+        if (recordSize < kRecordHeaderSize || recordSize > size - offset) return false;
+        const char* record = data + offset;
+        if (crc32(record + 8, recordSize - 8) != readRaw<std::uint32_t>(record + 4)) return false;
+        visit(readRaw<std::uint64_t>(record + 8), readRaw<std::uint64_t>(record + 16),
+              static_cast<JournalEventType>(static_cast<unsigned char>(record[24])),
+              record + kRecordHeaderSize, recordSize - kRecordHeaderSize);
+        offset += recordSize;
+    }
+    return true;
+}
+
+// Net effect of one order's events over a run of records. Runs from
+// consecutive segments fold left to right, which is what lets each segment
+// be scanned on its own thread.
+struct OrderReplay {
+    bool reset;
+    bool closed;
+    int discount;   // -1 while untouched
+    int phase;
+    std::vector<PizzaView> pizzas;
+    
+    OrderReplay() : reset(false), closed(false), discount(-1), phase(-1) {}
+    
+    void apply(JournalEventType type, const char* payload, std::size_t length) {
+        switch (type) {
+            case JOURNAL_ADD_PIZZA: {
+                PizzaView view;
+                if (PizzaView::open(payload, length, view)) pizzas.push_back(view);
+                break;
+            }
+            case JOURNAL_SET_DISCOUNT:
+                if (length >= 1) discount = static_cast<unsigned char>(payload[0]);
+                break;
+            case JOURNAL_SET_STATE:
+                if (length >= 1 && static_cast<unsigned char>(payload[0]) <= PHASE_READY) {
+                    phase = static_cast<unsigned char>(payload[0]);
+                }
+                break;
+            case JOURNAL_CLEAR_ORDER:
+                reset = true;
+                pizzas.clear();
+                discount = DISCOUNT_REGULAR;
+                phase = PHASE_ORDER_STARTED;
+                break;
+            case JOURNAL_CLOSE_ORDER:
+                reset = true;
+                closed = true;
+                pizzas.clear();
+                discount = -1;
+                phase = -1;
+                return;
+            default:
+                return;
+        }
+        closed = false;
+    }
+    
+    void fold(OrderReplay& later) {
+        if (later.reset) {
+            *this = std::move(later);
+            return;
+        }
+        pizzas.insert(pizzas.end(), later.pizzas.begin(), later.pizzas.end());
+        if (later.discount >= 0) discount = later.discount;
+        if (later.phase >= 0) phase = later.phase;
+        closed = false;
+    }
+};
+}
+
+OrderJournal::OrderJournal(const std::string& directory, std::size_t segmentBytes)
+    : directory(directory), segmentBytes(std::max(segmentBytes, kSegmentHeaderSize + kRecordHeaderSize)),
+      segmentFd(-1), segmentData(nullptr), segmentIndex(0), writeOffset(0), syncedOffset(0),
+      nextSequence(1), durableSequence(0), syncCount(0), flushing(false) {
+    std::filesystem::create_directories(directory);
+    std::vector<std::pair<std::uint64_t, std::string>> segments = listSegments(directory);
+    
+    // Continue numbering after the newest intact record
+    for (auto it = segments.rbegin(); it != segments.rend(); ++it) {
+        MappedSegment existing(it->second);
+        if (!validSegmentHeader(existing.data, existing.size)) continue;
+        std::uint64_t last = readRaw<std::uint64_t>(existing.data + 16) - 1;
+        scanSegment(existing.data, existing.size,
+                    [&last](std::uint64_t sequence, std::uint64_t, JournalEventType, const char*, std::size_t) {
+                        last = std::max(last, sequence);
+                    });
+        nextSequence = last + 1;
+        break;
+    }
+    durableSequence = nextSequence - 1;
+    openSegment(segments.empty() ? 1 : segments.back().first + 1);
+}
+
+OrderJournal::~OrderJournal() {
+    std::unique_lock<std::mutex> lock(mutex);
+    flushDone.wait(lock, [this] { return !flushing; });
+    closeSegment();
+}
+
+// Preallocates and maps a fresh segment; the file and its directory entry
+// are made durable before any record lands in it.
+void OrderJournal::openSegment(std::uint64_t index) {
+    std::string path = segmentPath(directory, index);
+    int fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) throwJournalError("cannot create", path, errno);
+    if (::ftruncate(fd, static_cast<off_t>(segmentBytes)) != 0 || ::fsync(fd) != 0) {
+        int error = errno;
+        ::close(fd);
+        throwJournalError("cannot allocate", path, error);
+    }
+    void* mapped = ::mmap(nullptr, segmentBytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (mapped == MAP_FAILED) {
+        int error = errno;
+        ::close(fd);
+        throwJournalError("cannot map", path, error);
+    }
+    int directoryFd = ::open(directory.c_str(), O_RDONLY | O_DIRECTORY);
+    if (directoryFd >= 0) {
+        ::fsync(directoryFd);
+        ::close(directoryFd);
+    }
+    
+    segmentFd = fd;
+    segmentData = static_cast<char*>(mapped);
+    segmentIndex = index;
+    std::memcpy(segmentData, kSegmentMagic, sizeof(kSegmentMagic));
+    std::memcpy(segmentData + 4, &kJournalVersion, sizeof(kJournalVersion));
+    std::memcpy(segmentData + 8, &index, sizeof(index));
+    std::memcpy(segmentData + 16, &nextSequence, sizeof(nextSequence));
+    writeOffset = kSegmentHeaderSize;
+    syncedOffset = 0;
+}
+
+// Flushes and unmaps the current segment, trimming the unused tail of the
+// preallocation. Callers hold the mutex with no flush in flight.
+bool OrderJournal::closeSegment() {
+    if (segmentData == nullptr) return true;
+    std::size_t begin = syncedOffset & ~(pageSize() - 1);
+    bool flushed = ::msync(segmentData + begin, writeOffset - begin, MS_SYNC) == 0;
+    ::munmap(segmentData, segmentBytes);
+    bool trimmed = ::ftruncate(segmentFd, static_cast<off_t>(writeOffset)) == 0 && ::fsync(segmentFd) == 0;
+    ::close(segmentFd);
+    segmentData = nullptr;
+    segmentFd = -1;
+    return flushed && trimmed;
+}
+
+std::uint64_t OrderJournal::append(std::uint64_t orderId, JournalEventType type, const char* payload, std::size_t length) {
+    std::size_t recordSize = kRecordHeaderSize + length;
+    if (recordSize > segmentBytes - kSegmentHeaderSize) {
+        throw std::length_error("OrderJournal: record does not fit in a segment");
+    }
+    
+    std::unique_lock<std::mutex> lock(mutex);
+    if (writeOffset + recordSize > segmentBytes) {
+        // A leader may still be flushing the mapping we are about to drop
+        flushDone.wait(lock, [this] { return !flushing; });
+        std::uint64_t sealed = nextSequence - 1;
+        std::string path = segmentPath(directory, segmentIndex);
+        if (!closeSegment()) throwJournalError("cannot seal", path, errno);
+        durableSequence = std::max(durableSequence, sealed);
+        openSegment(segmentIndex + 1);
+    }
+    
+    std::uint64_t sequence = nextSequence++;
+    std::uint32_t size = static_cast<std::uint32_t>(recordSize);
+    char* record = segmentData + writeOffset;
+    std::memcpy(record + 8, &sequence, sizeof(sequence));
+    std::memcpy(record + 16, &orderId, sizeof(orderId));
+    record[24] = static_cast<char>(type);
+    if (length > 0) std::memcpy(record + kRecordHeaderSize, payload, length);
+    std::uint32_t crc = crc32(record + 8, recordSize - 8);
+    std::memcpy(record + 4, &crc, sizeof(crc));
+    std::memcpy(record, &size, sizeof(size));
+    writeOffset += recordSize;
+    return sequence;
+}
+
+std::uint64_t OrderJournal::closeOrder(std::uint64_t orderId) {
+    return append(orderId, JOURNAL_CLOSE_ORDER);
+}
+
+void OrderJournal::sync(std::uint64_t sequence) {
+    std::unique_lock<std::mutex> lock(mutex);
+    sequence = std::min(sequence, nextSequence - 1);
+    while (durableSequence < sequence) {
+        if (flushing) {
+            flushDone.wait(lock);
+            continue;
+        }
+        // Lead this batch: one msync covers every record appended so far
+        flushing = true;
+        std::uint64_t target = nextSequence - 1;
+        std::size_t begin = syncedOffset & ~(pageSize() - 1);
+        std::size_t end = writeOffset;
+        char* base = segmentData;
+        lock.unlock();
+        int result = ::msync(base + begin, end - begin, MS_SYNC);
+        int error = errno;
+        lock.lock();
+        flushing = false;
+        flushDone.notify_all();
+        if (result != 0) throwJournalError("cannot sync", segmentPath(directory, segmentIndex), error);
+        syncedOffset = std::max(syncedOffset, end);
+        durableSequence = std::max(durableSequence, target);
+        syncCount++;
+    }
+}
+
+void OrderJournal::sync() {
+    sync(getLastSequence());
+}
+
+std::uint64_t OrderJournal::getLastSequence() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return nextSequence - 1;
+}
+
+std::size_t OrderJournal::getSyncCount() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return syncCount;
+}
+
+JournalRecoveryStats OrderJournal::recover(const std::string& directory,
+                                           std::map<std::uint64_t, std::unique_ptr<PlaceOrder>>& orders,
+                                           std::size_t threadCount) {
+    std::vector<std::pair<std::uint64_t, std::string>> paths = listSegments(directory);
+    std::size_t count = paths.size();
+    std::vector<std::unique_ptr<MappedSegment>> segments(count);
+    std::vector<std::unordered_map<std::uint64_t, OrderReplay>> replays(count);
+    std::vector<std::size_t> events(count, 0);
+    std::vector<char> intact(count, 0);
+    WorkStealingPool pool(threadCount);
+    WorkStealingPool::Batch batch;
+    
+    // Segments are independent until the fold, so each is scanned on its own task
+    for (std::size_t i = 0; i < count; i++) {
+        pool.submit(batch, [&, i] {
+            segments[i].reset(new MappedSegment(paths[i].second));
+            intact[i] = scanSegment(segments[i]->data, segments[i]->size,
+                                    [&, i](std::uint64_t, std::uint64_t orderId, JournalEventType type,
+                                           const char* payload, std::size_t length) {
+                                        replays[i][orderId].apply(type, payload, length);
+                                        events[i]++;
+                                    });
+        });
+    }
+    pool.wait(batch);
+    
+    JournalRecoveryStats stats = {count, 0, 0, 0};
+    std::unordered_map<std::uint64_t, OrderReplay> merged;
+    for (std::size_t i = 0; i < count; i++) {
+        stats.events += events[i];
+        if (!intact[i]) stats.tornSegments++;
+        for (auto& entry : replays[i]) {
+            merged[entry.first].fold(entry.second);
+        }
+        replays[i].clear();
+    }
+    
+    std::vector<std::pair<std::uint64_t, OrderReplay*>> open;
+    for (auto& entry : merged) {
+        if (!entry.second.closed) open.emplace_back(entry.first, &entry.second);
+    }
+    
+    // Pizza views still point into the mapped segments, so rebuild before they are dropped
+    std::vector<std::unique_ptr<PlaceOrder>> rebuilt(open.size());
+    for (std::size_t begin = 0; begin < open.size(); begin += kReplayChunk) {
+        pool.submit(batch, [&, begin] {
+            std::size_t end = std::min(begin + kReplayChunk, open.size());
+            for (std::size_t j = begin; j < end; j++) {
+                const OrderReplay& replay = *open[j].second;
+                PlaceOrder* order = new PlaceOrder();
+                rebuilt[j].reset(order);
+                for (const auto& view : replay.pizzas) {
+                    order->addPizza(OrderSerializer::readPizza(view));
+                }
+                if (replay.discount > DISCOUNT_REGULAR) {
+                    order->setDiscountStrategy(OrderSerializer::createDiscount(static_cast<DiscountCode>(replay.discount)));
+                }
+                if (replay.phase > PHASE_ORDER_STARTED) {
+                    order->setState(OrderSerializer::phaseFor(static_cast<PhaseCode>(replay.phase)));
+                }
+            }
+        });
+    }
+    pool.wait(batch);
+    
+    for (std::size_t j = 0; j < open.size(); j++) {
+        orders[open[j].first] = std::move(rebuilt[j]);
+    }
+    stats.openOrders = open.size();
+    return stats;
+}
+
+// ==================== ORDER INGEST IMPLEMENTATION ====================
+namespace {
+typedef std::vector<IngestRecord> ParsedBatch;
+typedef std::vector<PlaceOrder*> BuiltBatch;
+
+bool isBlank(char c) {
+    return c == ' ' || c == '\t' || c == '\r';
+}
+
+std::string_view trim(std::string_view text) {
+    while (!text.empty() && isBlank(text.front())) text.remove_prefix(1);
+    while (!text.empty() && isBlank(text.back())) text.remove_suffix(1);
+    return text;
+}
+
+std::string_view unquote(std::string_view text) {
+    text = trim(text);
+    if (text.size() >= 2 && text.front() == '"' && text.back() == '"') {
+        text = trim(text.substr(1, text.size() - 2));
+    }
+    return text;
+}
+
+bool parseDiscountName(std::string_view text, DiscountCode& code) {
+    text = trim(text);
+    if (text.empty() || text == "regular") {
+        code = DISCOUNT_REGULAR;
+    } else if (text == "bulk") {
+        code = DISCOUNT_BULK;
+    } else if (text == "family") {
+        code = DISCOUNT_FAMILY;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+bool parseRecipeName(std::string_view text, std::uint8_t& recipe) {
+    if (text == "pepperoni") recipe = INGEST_PEPPERONI;
+    else if (text == "vegetarian") recipe = INGEST_VEGETARIAN;
+    else if (text == "meat-lovers") recipe = INGEST_MEAT_LOVERS;
+    else if (text == "vegetarian-deluxe") recipe = INGEST_VEGETARIAN_DELUXE;
+    else return false;
+    return true;
+}
+
+// recipe[+cheese][+crust]
+bool addPizzaSpec(std::string_view text, IngestRecord& record) {
+    if (record.pizzaCount == IngestRecord::MAX_PIZZAS) return false;
+    IngestPizza& pizza = record.pizzas[record.pizzaCount];
+    std::size_t plus = text.find('+');
+    if (!parseRecipeName(trim(text.substr(0, plus)), pizza.recipe)) return false;
+    pizza.extraCheese = false;
+    pizza.stuffedCrust = false;
+    while (plus != std::string_view::npos) {
+        std::size_t next = text.find('+', plus + 1);
+        std::string_view modifier = trim(text.substr(plus + 1, next == std::string_view::npos ? next : next - plus - 1));
+        if (modifier == "cheese") pizza.extraCheese = true;
+        else if (modifier == "crust") pizza.stuffedCrust = true;
+        else return false;
+        plus = next;
+    }
+    record.pizzaCount++;
+    return true;
+}
+
+bool parseOrderId(std::string_view text, std::uint64_t& id) {
+    text = unquote(text);
+    const char* end = text.data() + text.size();
+    std::from_chars_result result = std::from_chars(text.data(), end, id);
+    return !text.empty() && result.ec == std::errc() && result.ptr == end;
+}
+
+// id or order_id, pizzas and an optional discount column, quoted or not
+bool isCsvHeader(std::string_view line) {
+    std::size_t first = line.find(',');
+    if (first == std::string_view::npos) return false;
+    std::string_view id = unquote(line.substr(0, first));
+    if (id != "id" && id != "order_id") return false;
+    line.remove_prefix(first + 1);
+    std::size_t second = line.find(',');
+    if (unquote(line.substr(0, second)) != "pizzas") return false;
+    return second == std::string_view::npos || unquote(line.substr(second + 1)) == "discount";
+}
+
+// Just enough JSON for one flat order object per line. String contents are
+// taken raw: none of the fields we read ever need an escape.
+class JsonCursor {
+private:
+    std::string_view text;
+    std::size_t at;
+    
+public:
+    explicit JsonCursor(std::string_view text) : text(text), at(0) {}
+    
+    void skipSpace() {
+        while (at < text.size() && (isBlank(text[at]) || text[at] == '\n')) at++;
+    }
+    
+    bool consume(char expected) {
+        skipSpace();
+        if (at < text.size() && text[at] == expected) {
+            at++;
+            return true;
+        }
+        return false;
+    }
+    
+    bool atEnd() {
+        skipSpace();
+        return at == text.size();
+    }
+    
+    bool readString(std::string_view& out) {
+        if (!consume('"')) return false;
+        std::size_t begin = at;
+        while (at < text.size() && text[at] != '"') {
+            at += text[at] == '\\' ? 2 : 1;
+        }
+        if (at >= text.size()) return false;
+        out = text.substr(begin, at - begin);
+        at++;
+        return true;
+    }
+    
+    bool readUnsigned(std::uint64_t& value) {
+        skipSpace();
+        const char* end = text.data() + text.size();
+        std::from_chars_result result = std::from_chars(text.data() + at, end, value);
+        if (result.ec != std::errc()) return false;
+        at = result.ptr - text.data();
+        return true;
+    }
+    
+    // Steps over a value of any type we do not read
+    bool skipValue() {
+        skipSpace();
+        if (at >= text.size()) return false;
+        if (text[at] == '"') {
+            std::string_view ignored;
+            return readString(ignored);
+        }
+        int depth = 0;
+        while (at < text.size()) {
+            char c = text[at];
+            if (c == '"') {
+                std::string_view ignored;
+                if (!readString(ignored)) return false;
+                continue;
+            }
+            if (c == '{' || c == '[') {
+                depth++;
+            } else if (c == '}' || c == ']') {
+                if (depth == 0) return true;
+                depth--;
+            } else if (c == ',' && depth == 0) {
+                return true;
+            }
+            at++;
+            if (depth == 0 && (c == '}' || c == ']')) return true;
+        }
+        return depth == 0;
+    }
+};
+}
+
+OrderIngester::OrderIngester(std::size_t batchSize, std::size_t queueCapacity, std::size_t chunkBytes,
+                             std::size_t builderCount)
+    : batchSize(std::max<std::size_t>(batchSize, 1)), queueCapacity(queueCapacity),
+      chunkBytes(std::max<std::size_t>(chunkBytes, 1)), builderCount(std::max<std::size_t>(builderCount, 1)) {}
+
+void OrderIngester::setSink(OrderSink orderSink) {
+    sink = orderSink;
+}
+
+bool OrderIngester::parseCsvLine(std::string_view line, IngestRecord& record) {
+    std::size_t first = line.find(',');
+    if (first == std::string_view::npos) return false;
+    std::size_t second = line.find(',', first + 1);
+    std::string_view pizzas = unquote(line.substr(first + 1, second == std::string_view::npos ? second : second - first - 1));
+    std::string_view discount = second == std::string_view::npos ? std::string_view() : line.substr(second + 1);
+    
+    record.pizzaCount = 0;
+    if (!parseOrderId(line.substr(0, first), record.id) || !parseDiscountName(unquote(discount), record.discount)) {
+        return false;
+    }
+    while (!pizzas.empty()) {
+        std::size_t separator = pizzas.find(';');
+        if (!addPizzaSpec(trim(pizzas.substr(0, separator)), record)) return false;
+        if (separator == std::string_view::npos) break;
+        pizzas.remove_prefix(separator + 1);
+    }
+    return record.pizzaCount > 0;
+}
+
+bool OrderIngester::parseJsonLine(std::string_view line, IngestRecord& record) {
+    JsonCursor cursor(line);
+    record.pizzaCount = 0;
+    record.discount = DISCOUNT_REGULAR;
+    bool haveId = false;
+    if (!cursor.consume('{')) return false;
+    if (!cursor.consume('}')) {
+        do {
+            std::string_view key;
+            if (!cursor.readString(key) || !cursor.consume(':')) return false;
+            if (key == "id") {
+                if (!cursor.readUnsigned(record.id)) return false;
+                haveId = true;
+            } else if (key == "pizzas") {
+                if (!cursor.consume('[')) return false;
+                if (!cursor.consume(']')) {
+                    do {
+                        std::string_view spec;
+                        if (!cursor.readString(spec) || !addPizzaSpec(trim(spec), record)) return false;
+                    } while (cursor.consume(','));
+                    if (!cursor.consume(']')) return false;
+                }
+            } else if (key == "discount") {
+                std::string_view discount;
+                if (!cursor.readString(discount) || !parseDiscountName(discount, record.discount)) return false;
+            } else if (!cursor.skipValue()) {
+                return false;
+            }
+        } while (cursor.consume(','));
+        if (!cursor.consume('}')) return false;
+    }
+    return cursor.atEnd() && haveId && record.pizzaCount > 0;
+}
+
+// Decorators go on in a fixed order: extra cheese, then stuffed crust
+PizzaPtr OrderIngester::buildPizza(const IngestPizza& spec) {
+    PizzaPtr pizza;
+    switch (spec.recipe) {
+        case INGEST_VEGETARIAN: pizza = PizzaFactory::createMenuPizza<MenuRecipes::Vegetarian>(); break;
+        case INGEST_MEAT_LOVERS: pizza = PizzaFactory::createMenuPizza<MenuRecipes::MeatLovers>(); break;
+        case INGEST_VEGETARIAN_DELUXE: pizza = PizzaFactory::createMenuPizza<MenuRecipes::VegetarianDeluxe>(); break;
+        default: pizza = PizzaFactory::createMenuPizza<MenuRecipes::Pepperoni>(); break;
+    }
+    if (spec.extraCheese) pizza = PizzaFactory::addExtraCheese(std::move(pizza));
+    if (spec.stuffedCrust) pizza = PizzaFactory::addStuffedCrust(std::move(pizza));
+    return pizza;
+}
+
+PlaceOrder* OrderIngester::buildOrder(const IngestRecord& record) {
+    PlaceOrder* order = new PlaceOrder();
+    {
+        PizzaArena::Scope scope(order->getArena());
+        for (std::size_t i = 0; i < record.pizzaCount; i++) {
+            order->addPizza(buildPizza(record.pizzas[i]));
+        }
+    }
+    if (record.discount != DISCOUNT_REGULAR) {
+        order->setDiscountStrategy(OrderSerializer::createDiscount(record.discount));
+    }
+    return order;
+}
+
+IngestStats OrderIngester::ingest(std::istream& input, IngestFormat format) {
+    typedef std::chrono::steady_clock Clock;
+    
+    IngestStats stats = IngestStats();
+    IngestQueue<ParsedBatch> parsed(queueCapacity);
+    IngestQueue<BuiltBatch> built(queueCapacity);
+    std::atomic<std::size_t> ordersBuilt(0);
+    std::atomic<std::size_t> pizzasBuilt(0);
+    std::atomic<std::size_t> buildersLeft(builderCount);
+    std::mutex errorMutex;
+    std::exception_ptr firstError;
+    bool (*parseLine)(std::string_view, IngestRecord&) = format == INGEST_JSONL ? parseJsonLine : parseCsvLine;
+    
+    // Any failing stage shuts both queues so the others wind down
+    auto fail = [&](std::exception_ptr error) {
+        {
+            std::lock_guard<std::mutex> lock(errorMutex);
+            if (!firstError) firstError = error;
+        }
+        parsed.close();
+        built.close();
+    };
+    
+    Clock::time_point start = Clock::now();
+    
+    std::thread parser([&] {
+        try {
+            std::string buffer;
+            std::size_t carried = 0;
+            bool firstLine = true;
+            bool accepting = true;
+            ParsedBatch batch;
+            batch.reserve(batchSize);
+            
+            auto handleLine = [&](std::string_view line) {
+                line = trim(line);
+                if (line.empty()) return;
+                bool header = firstLine && format == INGEST_CSV && isCsvHeader(line);
+                firstLine = false;
+                if (header) return;
+                batch.emplace_back();
+                if (parseLine(line, batch.back())) {
+                    stats.rowsParsed++;
+                } else {
+                    batch.pop_back();
+                    stats.malformedRows++;
+                }
+                if (batch.size() == batchSize) {
+                    accepting = parsed.push(std::move(batch));
+                    batch = ParsedBatch();
+                    batch.reserve(batchSize);
+                }
+            };
+            
+            // Only the unfinished last line of a chunk is carried into the next one
+            while (accepting && input) {
+                buffer.resize(carried + chunkBytes);
+                input.read(&buffer[carried], chunkBytes);
+                std::size_t filled = carried + static_cast<std::size_t>(input.gcount());
+                stats.bytesRead += static_cast<std::size_t>(input.gcount());
+                std::size_t lineStart = 0;
+                while (accepting) {
+                    const void* newline = std::memchr(buffer.data() + lineStart, '\n', filled - lineStart);
+                    if (newline == nullptr) break;
+                    std::size_t lineEnd = static_cast<const char*>(newline) - buffer.data();
+                    handleLine(std::string_view(buffer.data() + lineStart, lineEnd - lineStart));
+                    lineStart = lineEnd + 1;
+                }
+                carried = filled - lineStart;
+                std::memmove(&buffer[0], buffer.data() + lineStart, carried);
+            }
+            if (accepting && carried > 0) handleLine(std::string_view(buffer.data(), carried));
+            if (accepting && !batch.empty()) parsed.push(std::move(batch));
+        } catch (...) {
+            fail(std::current_exception());
+        }
+        parsed.close();
+    });
+    
+    std::vector<std::thread> builders;
+    for (std::size_t b = 0; b < builderCount; b++) {
+        builders.emplace_back([&] {
+            BuiltBatch orders;
+            try {
+                ParsedBatch batch;
+                while (parsed.pop(batch)) {
+                    orders.reserve(batch.size());
+                    std::size_t pizzas = 0;
+                    for (const auto& record : batch) {
+                        orders.push_back(buildOrder(record));
+                        pizzas += record.pizzaCount;
+                    }
+                    ordersBuilt += orders.size();
+                    pizzasBuilt += pizzas;
+                    if (!built.push(std::move(orders))) break;
+                    orders = BuiltBatch();
+                }
+            } catch (...) {
+                fail(std::current_exception());
+            }
+            // Anything still held here never reached the price stage
+            for (auto order : orders) {
+                delete order;
+            }
+            if (--buildersLeft == 0) built.close();
+        });
+    }
+    
+    BuiltBatch orders;
+    std::size_t next = 0;
+    bool handedOff = false;
+    try {
+        while (built.pop(orders)) {
+            for (next = 0; next < orders.size(); next++) {
+                handedOff = false;
+                stats.revenue += orders[next]->calculateTotal();
+                stats.ordersPriced++;
+                handedOff = true;
+                if (sink) {
+                    sink(orders[next]);
+                } else {
+                    delete orders[next];
+                }
+            }
+        }
+    } catch (...) {
+        fail(std::current_exception());
+        // An order that failed to price is still ours; one the sink threw on is the sink's
+        for (next += handedOff ? 1 : 0; next < orders.size(); next++) {
+            delete orders[next];
+        }
+    }
+    
+    parser.join();
+    for (auto& builder : builders) {
+        builder.join();
+    }
+    while (built.pop(orders)) {
+        for (auto order : orders) {
+            delete order;
+        }
+    }
+    
+    stats.ordersBuilt = ordersBuilt;
+    stats.pizzasBuilt = pizzasBuilt;
+    stats.parsedQueue = parsed.getStats();
+    stats.builtQueue = built.getStats();
+    stats.elapsedSeconds = std::chrono::duration<double>(Clock::now() - start).count();
+    stats.ordersPerSecond = stats.elapsedSeconds > 0 ? stats.ordersPriced / stats.elapsedSeconds : 0;
+    if (firstError) std::rethrow_exception(firstError);
+    return stats;
+}
+
+IngestStats OrderIngester::ingestFile(const std::string& path, IngestFormat format) {
+    std::ifstream input(path, std::ios::binary);
+    if (!input) throw std::runtime_error("OrderIngester: cannot open " + path);
+    return ingest(input, format);
+}
+
+// ==================== ORDER SERVICE IMPLEMENTATION ====================
+namespace {
+template <typename T>
+void writeRaw(char* at, T value) {
+    std::memcpy(at, &value, sizeof(T));
+}
+
+[[noreturn]] void throwSocketError(const std::string& owner, const std::string& action, const std::string& path, int error) {
+    throw std::runtime_error(owner + ": " + action + " " + path + ": " + std::strerror(error));
+}
+
+bool readFully(int fd, char* data, std::size_t size) {
+    while (size > 0) {
+        ssize_t got = ::read(fd, data, size);
+        if (got < 0 && errno == EINTR) continue;
+        if (got <= 0) return false;
+        data += got;
+        size -= static_cast<std::size_t>(got);
+    }
+    return true;
+}
+
+// MSG_NOSIGNAL: a client hanging up must not SIGPIPE the server
+bool writeFully(int fd, const char* data, std::size_t size) {
+    while (size > 0) {
+        ssize_t sent = ::send(fd, data, size, MSG_NOSIGNAL);
+        if (sent < 0 && errno == EINTR) continue;
+        if (sent <= 0) return false;
+        data += sent;
+        size -= static_cast<std::size_t>(sent);
+    }
+    return true;
+}
+
+sockaddr_un socketAddress(const std::string& owner, const std::string& path) {
+    sockaddr_un address;
+    std::memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(address.sun_path)) throwSocketError(owner, "socket path too long", path, ENAMETOOLONG);
+    std::memcpy(address.sun_path, path.c_str(), path.size() + 1);
+    return address;
+}
+
+ServiceResponse unavailable(std::uint64_t orderId) {
+    ServiceResponse response = ServiceResponse();
+    response.status = SERVICE_UNAVAILABLE;
+    response.orderId = orderId;
+    return response;
+}
+}
+
+void ServiceRequest::encode(char* out) const {
+    writeRaw(out, op);
+    writeRaw(out + 1, recipe);
+    writeRaw(out + 2, flags);
+    writeRaw(out + 3, discount);
+    writeRaw(out + 4, storeId);
+    writeRaw(out + 8, orderId);
+}
+
+ServiceRequest ServiceRequest::decode(const char* in) {
+    ServiceRequest request;
+    request.op = readRaw<std::uint8_t>(in);
+    request.recipe = readRaw<std::uint8_t>(in + 1);
+    request.flags = readRaw<std::uint8_t>(in + 2);
+    request.discount = readRaw<std::uint8_t>(in + 3);
+    request.storeId = readRaw<std::uint32_t>(in + 4);
+    request.orderId = readRaw<std::uint64_t>(in + 8);
+    return request;
+}
+
+void ServiceResponse::encode(char* out) const {
+    writeRaw(out, status);
+    writeRaw(out + 1, phase);
+    writeRaw(out + 2, pizzaCount);
+    writeRaw<std::uint32_t>(out + 4, 0);
+    writeRaw(out + 8, orderId);
+    writeRaw(out + 16, total.getCents());
+}
+
+ServiceResponse ServiceResponse::decode(const char* in) {
+    ServiceResponse response;
+    response.status = readRaw<std::uint8_t>(in);
+    response.phase = readRaw<std::uint8_t>(in + 1);
+    response.pizzaCount = readRaw<std::uint16_t>(in + 2);
+    response.orderId = readRaw<std::uint64_t>(in + 8);
+    response.total = Money::fromCents(readRaw<std::int64_t>(in + 16));
+    return response;
+}
+
+OrderService::OrderService(std::size_t shardCount, EventSink* logSink) : logSink(logSink) {
+    if (shardCount == 0) shardCount = std::max(1u, std::thread::hardware_concurrency());
+    for (std::size_t i = 0; i < shardCount; i++) {
+        shards.push_back(std::unique_ptr<Shard>(new Shard()));
+    }
+    for (std::size_t i = 0; i < shardCount; i++) {
+        shards[i]->worker = std::thread(&OrderService::workerLoop, this, std::ref(*shards[i]), i);
+    }
+}
+
+// Requests already queued are answered before the workers exit
+OrderService::~OrderService() {
+    for (auto& shard : shards) {
+        std::lock_guard<std::mutex> lock(shard->mutex);
+        shard->stopping = true;
+        shard->wake.notify_one();
+    }
+    for (auto& shard : shards) {
+        shard->worker.join();
+    }
+}
+
+std::size_t OrderService::getShardCount() const { return shards.size(); }
+
+std::size_t OrderService::shardOf(std::uint32_t storeId) const { return storeId % shards.size(); }
+
+void OrderService::submit(const ServiceRequest& request, Callback done) {
+    Shard& shard = *shards[shardOf(request.storeId)];
+    {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        if (!shard.stopping) {
+            shard.mailbox.push_back(Call{request, std::move(done)});
+            shard.wake.notify_one();
+            return;
+        }
+    }
+    done(unavailable(request.orderId));
+}
+
+ServiceResponse OrderService::call(const ServiceRequest& request) {
+    std::promise<ServiceResponse> answer;
+    std::future<ServiceResponse> response = answer.get_future();
+    submit(request, [&answer](const ServiceResponse& result) { answer.set_value(result); });
+    return response.get();
+}
+
+// Each wakeup takes the whole mailbox, so a busy shard locks once per batch
+void OrderService::workerLoop(Shard& shard, std::size_t index) {
+    NullSink quiet;
+    EventLog::setThreadSink(logSink != nullptr ? logSink : &quiet);
+    std::vector<Call> batch;
+    for (;;) {
+        {
+            std::unique_lock<std::mutex> lock(shard.mutex);
+            shard.wake.wait(lock, [&shard] { return shard.stopping || !shard.mailbox.empty(); });
+            if (shard.mailbox.empty()) break;
+            batch.swap(shard.mailbox);
+        }
+        for (Call& call : batch) {
+            call.done(handle(shard, index, call.request));
+        }
+        batch.clear();
+    }
+    // Teardown logs too, so the shard's state goes with its thread
+    shard.orders.clear();
+    shard.stores.clear();
+    EventLog::setThreadSink(nullptr);
+}
+
+// A store's menu starts with every recipe listed
+OrderService::Store& OrderService::storeFor(Shard& shard, std::uint32_t storeId) {
+    std::unique_ptr<Store>& store = shard.stores[storeId];
+    if (!store) {
+        store.reset(new Store());
+        for (std::uint8_t recipe = INGEST_PEPPERONI; recipe <= INGEST_VEGETARIAN_DELUXE; recipe++) {
+            store->recipes[recipe] = OrderIngester::buildPizza(IngestPizza{recipe, false, false});
+            store->menu.addPizza(store->recipes[recipe].get());
+        }
+    }
+    return *store;
+}
+
+ServiceResponse OrderService::handle(Shard& shard, std::size_t index, const ServiceRequest& request) {
+    ServiceResponse response = ServiceResponse();
+    response.status = SERVICE_OK;
+    response.orderId = request.orderId;
+    
+    switch (request.op) {
+        case SERVICE_CREATE_ORDER: {
+            // Ids are unique across shards: shard i hands out i+1, i+1+n, ...
+            response.orderId = shard.nextOrder++ * shards.size() + index + 1;
+            OpenOrder& created = shard.orders[response.orderId];
+            created.storeId = request.storeId;
+            created.order.reset(new PlaceOrder());
+            created.order->setRandomSeed(static_cast<unsigned int>(response.orderId * 2654435761u));
+            response.phase = PHASE_ORDER_STARTED;
+            return response;
+        }
+        case SERVICE_LIST_RECIPE:
+        case SERVICE_UNLIST_RECIPE: {
+            if (request.recipe > INGEST_VEGETARIAN_DELUXE) {
+                response.status = SERVICE_BAD_REQUEST;
+                return response;
+            }
+            Store& store = storeFor(shard, request.storeId);
+            if (request.op == SERVICE_LIST_RECIPE) {
+                store.menu.addPizza(store.recipes[request.recipe].get());
+            } else {
+                store.menu.removePizza(store.recipes[request.recipe].get());
+            }
+            return response;
+        }
+        default:
+            break;
+    }
+    
+    auto found = shard.orders.find(request.orderId);
+    if (found == shard.orders.end() || found->second.storeId != request.storeId) {
+        response.status = SERVICE_UNKNOWN_ORDER;
+        return response;
+    }
+    PlaceOrder& order = *found->second.order;
+    switch (request.op) {
+        case SERVICE_ADD_PIZZA: {
+            if (request.recipe > INGEST_VEGETARIAN_DELUXE) {
+                response.status = SERVICE_BAD_REQUEST;
+                return response;
+            }
+            Store& store = storeFor(shard, request.storeId);
+            if (store.menu.getPizzaId(store.recipes[request.recipe].get()) == 0) {
+                response.status = SERVICE_NOT_ON_MENU;
+                return response;
+            }
+            IngestPizza spec{request.recipe, (request.flags & SERVICE_EXTRA_CHEESE) != 0,
+                             (request.flags & SERVICE_STUFFED_CRUST) != 0};
+            PizzaArena::Scope scope(order.getArena());
+            order.addPizza(OrderIngester::buildPizza(spec));
+            break;
+        }
+        case SERVICE_SET_DISCOUNT:
+            if (request.discount > DISCOUNT_FAMILY) {
+                response.status = SERVICE_BAD_REQUEST;
+                return response;
+            }
+            order.setDiscountStrategy(OrderSerializer::createDiscount(static_cast<DiscountCode>(request.discount)));
+            break;
+        case SERVICE_ADVANCE:
+            order.processOrder();
+            break;
+        case SERVICE_GET_ORDER:
+        case SERVICE_CLOSE_ORDER:
+            break;
+        default:
+            response.status = SERVICE_BAD_REQUEST;
+            return response;
+    }
+    
+    response.phase = OrderSerializer::phaseCodeOf(order.getStatus());
+    response.pizzaCount = static_cast<std::uint16_t>(order.getPizzaCount());
+    response.total = order.getTotal();
+    if (request.op == SERVICE_CLOSE_ORDER) {
+        shard.orders.erase(found);
+    }
+    return response;
+}
+
+OrderServer::OrderServer(OrderService& service, const std::string& socketPath)
+    : service(service), socketPath(socketPath), listenFd(-1), stopping(false) {}
+
+OrderServer::~OrderServer() {
+    stop();
+}
+
+void OrderServer::start() {
+    sockaddr_un address = socketAddress("OrderServer", socketPath);
+    listenFd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (listenFd < 0) throwSocketError("OrderServer", "cannot create socket for", socketPath, errno);
+    ::unlink(socketPath.c_str());
+    if (::bind(listenFd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0
+        || ::listen(listenFd, SOMAXCONN) != 0) {
+        int error = errno;
+        ::close(listenFd);
+        listenFd = -1;
+        throwSocketError("OrderServer", "cannot listen on", socketPath, error);
+    }
+    stopping = false;
+    acceptor = std::thread(&OrderServer::acceptLoop, this);
+}
+
+// Shutting the sockets down wakes the acceptor and every connection thread
+void OrderServer::stop() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (listenFd < 0) return;
+        stopping = true;
+        ::shutdown(listenFd, SHUT_RDWR);
+        for (const auto& connection : connections) {
+            ::shutdown(connection.fd, SHUT_RDWR);
+        }
+    }
+    acceptor.join();
+    std::vector<std::thread> exited;
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        drained.wait(lock, [this] { return connections.empty(); });
+        exited.swap(finished);
+    }
+    for (auto& thread : exited) {
+        thread.join();
+    }
+    ::close(listenFd);
+    listenFd = -1;
+    ::unlink(socketPath.c_str());
+}
+
+std::size_t OrderServer::getThreadCount() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return connections.size() + finished.size();
+}
+
+void OrderServer::acceptLoop() {
+    for (;;) {
+        int fd = ::accept4(listenFd, nullptr, nullptr, SOCK_CLOEXEC);
+        if (fd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) continue;
+            return;
+        }
+        std::vector<std::thread> exited;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (stopping) {
+                ::close(fd);
+                return;
+            }
+            exited.swap(finished);
+            connections.push_back(Connection{fd, std::thread(&OrderServer::serve, this, fd)});
+        }
+        // Already past their last use of the server; join just collects them
+        for (auto& thread : exited) {
+            thread.join();
+        }
+    }
+}
+
+void OrderServer::serve(int fd) {
+    char request[ServiceRequest::WIRE_SIZE];
+    char response[ServiceResponse::WIRE_SIZE];
+    while (readFully(fd, request, sizeof(request))) {
+        service.call(ServiceRequest::decode(request)).encode(response);
+        if (!writeFully(fd, response, sizeof(response))) break;
+    }
+    std::lock_guard<std::mutex> lock(mutex);
+    auto self = std::find_if(connections.begin(), connections.end(),
+                             [](const Connection& c) { return c.thread.get_id() == std::this_thread::get_id(); });
+    finished.push_back(std::move(self->thread));
+    connections.erase(self);
+    ::close(fd);
+    if (connections.empty()) drained.notify_all();
+}
+
+OrderClient::OrderClient(const std::string& socketPath) : fd(-1) {
+    sockaddr_un address = socketAddress("OrderClient", socketPath);
+    fd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) throwSocketError("OrderClient", "cannot create socket for", socketPath, errno);
+    if (::connect(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0) {
+        int error = errno;
+        ::close(fd);
+        throwSocketError("OrderClient", "cannot connect to", socketPath, error);
+    }
+}
+
+OrderClient::~OrderClient() {
+    ::close(fd);
+}
+
+ServiceResponse OrderClient::call(const ServiceRequest& request) {
+    char frame[ServiceResponse::WIRE_SIZE];
+    request.encode(frame);
+    if (!writeFully(fd, frame, ServiceRequest::WIRE_SIZE) || !readFully(fd, frame, ServiceResponse::WIRE_SIZE)) {
+        return unavailable(request.orderId);
+    }
+    return ServiceResponse::decode(frame);
+}
+
+ServiceResponse OrderClient::createOrder(std::uint32_t storeId) {
+    return call(ServiceRequest{SERVICE_CREATE_ORDER, 0, 0, 0, storeId, 0});
+}
+
+ServiceResponse OrderClient::addPizza(std::uint32_t storeId, std::uint64_t orderId, IngestRecipe recipe, std::uint8_t flags) {
+    return call(ServiceRequest{SERVICE_ADD_PIZZA, static_cast<std::uint8_t>(recipe), flags, 0, storeId, orderId});
+}
+
+ServiceResponse OrderClient::setDiscount(std::uint32_t storeId, std::uint64_t orderId, DiscountCode discount) {
+    return call(ServiceRequest{SERVICE_SET_DISCOUNT, 0, 0, static_cast<std::uint8_t>(discount), storeId, orderId});
+}
+
+ServiceResponse OrderClient::advance(std::uint32_t storeId, std::uint64_t orderId) {
+    return call(ServiceRequest{SERVICE_ADVANCE, 0, 0, 0, storeId, orderId});
+}
+
+ServiceResponse OrderClient::getOrder(std::uint32_t storeId, std::uint64_t orderId) {
+    return call(ServiceRequest{SERVICE_GET_ORDER, 0, 0, 0, storeId, orderId});
+}
+
+ServiceResponse OrderClient::closeOrder(std::uint32_t storeId, std::uint64_t orderId) {
+    return call(ServiceRequest{SERVICE_CLOSE_ORDER, 0, 0, 0, storeId, orderId});
+}
+
+// ==================== ORDER COROUTINES IMPLEMENTATION ====================
+StateWaiter::StateWaiter(PhaseCode phase) : phase(phase), next(nullptr) {}
+
+StateWaiter::~StateWaiter() {}
+
+#if defined(__cpp_impl_coroutine)
+OrderTask OrderTask::promise_type::get_return_object() {
+    return OrderTask(Handle::from_promise(*this));
+}
+
+std::suspend_never OrderTask::promise_type::final_suspend() noexcept {
+    executor->taskFinished();
+    return {};
+}
+
+void OrderTask::promise_type::unhandled_exception() {
+    executor->taskFailed(std::current_exception());
+}
+
+OrderTask::OrderTask(Handle handle) : handle(handle) {}
+
+OrderTask::OrderTask(OrderTask&& other) noexcept : handle(other.handle) {
+    other.handle = nullptr;
+}
+
+// Only a task that was never spawned still owns its frame
+OrderTask::~OrderTask() {
+    if (handle) handle.destroy();
+}
+
+OrderStateAwaiter::OrderStateAwaiter(PlaceOrder& order, PhaseCode phase)
+    : StateWaiter(phase), order(order), reached(false) {}
+
+bool OrderStateAwaiter::await_ready() {
+    reached = OrderSerializer::phaseCodeOf(order.getStatus()) == phase;
+    return reached;
+}
+
+// Nothing here may touch this after registering: the order may wake and
+// the task may resume before await_suspend returns
+bool OrderStateAwaiter::await_suspend(OrderTask::Handle awaiting) {
+    handle = awaiting;
+    reached = true;
+    return order.waitForState(this);
+}
+
+bool OrderStateAwaiter::await_resume() const {
+    return reached;
+}
+
+void OrderStateAwaiter::stateReached(bool wasReached) {
+    reached = wasReached;
+    handle.promise().executor->schedule(handle, handle.promise().lane);
+}
+
+OrderExecutor::OrderExecutor(std::size_t threadCount) : liveTasks(0) {
+    if (threadCount == 0) threadCount = std::max(1u, std::thread::hardware_concurrency());
+    for (std::size_t i = 0; i < threadCount; i++) {
+        lanes.push_back(std::unique_ptr<Lane>(new Lane()));
+    }
+    for (auto& lane : lanes) {
+        lane->worker = std::thread(&OrderExecutor::laneLoop, this, std::ref(*lane));
+    }
+}
+
+OrderExecutor::~OrderExecutor() {
+    for (auto& lane : lanes) {
+        std::lock_guard<std::mutex> lock(lane->mutex);
+        lane->stopping = true;
+        lane->wake.notify_one();
+    }
+    for (auto& lane : lanes) {
+        lane->worker.join();
+    }
+}
+
+void OrderExecutor::spawn(OrderTask task, std::size_t key) {
+    OrderTask::Handle handle = task.handle;
+    task.handle = nullptr;
+    handle.promise().executor = this;
+    handle.promise().lane = key % lanes.size();
+    liveTasks.fetch_add(1, std::memory_order_relaxed);
+    schedule(handle, handle.promise().lane);
+}
+
+void OrderExecutor::schedule(std::coroutine_handle<> handle, std::size_t lane) {
+    Lane& target = *lanes[lane];
+    std::lock_guard<std::mutex> lock(target.mutex);
+    target.ready.push_back(handle);
+    target.wake.notify_one();
+}
+
+OrderExecutor::YieldAwaiter OrderExecutor::yield() {
+    return YieldAwaiter();
+}
+
+void OrderExecutor::YieldAwaiter::await_suspend(OrderTask::Handle awaiting) const {
+    awaiting.promise().executor->schedule(awaiting, awaiting.promise().lane);
+}
+
+// Same batching as the order service: one lock per wakeup, not per task
+void OrderExecutor::laneLoop(Lane& lane) {
+    std::vector<std::coroutine_handle<>> batch;
+    for (;;) {
+        {
+            std::unique_lock<std::mutex> lock(lane.mutex);
+            lane.wake.wait(lock, [&lane] { return lane.stopping || !lane.ready.empty(); });
+            if (lane.ready.empty()) return;
+            batch.swap(lane.ready);
+        }
+        for (std::coroutine_handle<> handle : batch) {
+            handle.resume();
+        }
+        batch.clear();
+    }
+}
+
+void OrderExecutor::taskFinished() {
+    if (liveTasks.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+        std::lock_guard<std::mutex> lock(doneMutex);
+        allDone.notify_all();
+    }
+}
+
+void OrderExecutor::taskFailed(std::exception_ptr failure) {
+    std::lock_guard<std::mutex> lock(doneMutex);
+    if (!error) error = failure;
+}
+
+void OrderExecutor::drain() {
+    std::unique_lock<std::mutex> lock(doneMutex);
+    allDone.wait(lock, [this] { return liveTasks.load(std::memory_order_acquire) == 0; });
+    if (error) {
+        std::exception_ptr failure = error;
+        error = nullptr;
+        std::rethrow_exception(failure);
+    }
+}
+
+std::size_t OrderExecutor::getLaneCount() const { return lanes.size(); }
+
+std::size_t OrderExecutor::getLiveTasks() const { return liveTasks.load(std::memory_order_relaxed); }
+#endif
+
+// ==================== EVENT LOGGING IMPLEMENTATION ====================
+namespace {
+ConsoleSink defaultSink;
+std::atomic<EventSink*> installedSink(&defaultSink);
+std::atomic<bool> sinkDiscards(false);
+std::atomic<int> minimumLevel(LOG_DEBUG);
+thread_local EventSink* threadSink = nullptr;
+thread_local bool threadDiscards = false;
+}
+
+EventSink::~EventSink() {}
+void EventSink::flush() {}
+
+// One lock per line keeps lines from different threads intact.
+void ConsoleSink::write(LogLevel level, std::string message) {
+    (void)level;
+    std::lock_guard<std::mutex> lock(mutex);
+    std::cout << message << '\n';
+}
+
+void ConsoleSink::flush() {
+    std::lock_guard<std::mutex> lock(mutex);
+    std::cout.flush();
+}
+
+void NullSink::write(LogLevel level, std::string message) {
+    (void)level;
+    (void)message;
+}
+
+AsyncSink::AsyncSink(std::ostream& out, std::size_t capacity)
+    : out(out), enqueuePos(0), dequeuePos(0), stopping(false), writerSleeping(false) {
+    std::size_t size = 2;
+    while (size < capacity) size <<= 1;
+    slots.reset(new Slot[size]);
+    mask = size - 1;
+    for (std::size_t i = 0; i < size; i++) {
+        slots[i].sequence.store(i, std::memory_order_relaxed);
+    }
+    writer = std::thread(&AsyncSink::writerLoop, this);
+}
+
+AsyncSink::~AsyncSink() {
+    {
+        std::lock_guard<std::mutex> lock(wakeMutex);
+        stopping = true;
+    }
+    wake.notify_one();
+    writer.join();
+    while (drainOnce()) {
+    }
+    out.flush();
+}
+
+void AsyncSink::write(LogLevel level, std::string message) {
+    std::size_t pos = enqueuePos.load(std::memory_order_relaxed);
+    while (true) {
+        Slot& slot = slots[pos & mask];
+        std::size_t sequence = slot.sequence.load(std::memory_order_acquire);
+        if (sequence == pos) {
+            if (enqueuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                slot.level = level;
+                slot.message = std::move(message);
+                slot.sequence.store(pos + 1, std::memory_order_release);
+                // Pairs with the fence in writerLoop: either the writer sees
+                // this slot before sleeping or this sees it asleep. Only the
+                // first producer to see it asleep pays for the wakeup.
+                std::atomic_thread_fence(std::memory_order_seq_cst);
+                if (writerSleeping.load(std::memory_order_relaxed) && writerSleeping.exchange(false)) {
+                    std::lock_guard<std::mutex> lock(wakeMutex);
+                    wake.notify_one();
+                }
+                return;
+            }
+        } else if (sequence < pos) {
+            std::this_thread::yield();
+            pos = enqueuePos.load(std::memory_order_relaxed);
+        } else {
+            pos = enqueuePos.load(std::memory_order_relaxed);
+        }
+    }
+}
+
+// Single consumer: only the writer thread (or the destructor after it stops) drains.
+bool AsyncSink::drainOnce() {
+    std::size_t pos = dequeuePos.load(std::memory_order_relaxed);
+    Slot& slot = slots[pos & mask];
+    if (slot.sequence.load(std::memory_order_acquire) != pos + 1) {
+        return false;
+    }
+    std::string message = std::move(slot.message);
+    slot.message.clear();
+    slot.sequence.store(pos + mask + 1, std::memory_order_release);
+    dequeuePos.store(pos + 1, std::memory_order_release);
+    out << message << '\n';
+    return true;
+}
+
+bool AsyncSink::hasPending() const {
+    std::size_t pos = dequeuePos.load(std::memory_order_relaxed);
+    return slots[pos & mask].sequence.load(std::memory_order_acquire) == pos + 1;
+}
+
+void AsyncSink::writerLoop() {
+    while (!stopping) {
+        bool wrote = false;
+        while (drainOnce()) {
+            wrote = true;
+        }
+        if (wrote) {
+            out.flush();
+            continue;
+        }
+        // Bursts usually resume within a few yields; sleeping between them
+        // would cost a wakeup per message
+        for (int spin = 0; spin < 64 && !hasPending() && !stopping; spin++) {
+            std::this_thread::yield();
+        }
+        if (hasPending()) continue;
+        // One wait per round: a producer may clear the flag for a slot that
+        // was already drained, so every sleep must set it and look again
+        std::unique_lock<std::mutex> lock(wakeMutex);
+        writerSleeping.store(true, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (!stopping && !hasPending()) wake.wait(lock);
+        writerSleeping.store(false, std::memory_order_relaxed);
+    }
+}
+
+// Waits until everything written before the call has reached the stream.
+void AsyncSink::flush() {
+    std::size_t target = enqueuePos.load(std::memory_order_acquire);
+    while (dequeuePos.load(std::memory_order_acquire) < target) {
+        std::this_thread::yield();
+    }
+}
+
+// nullptr restores the default console sink
+void EventLog::setSink(EventSink* sink) {
+    if (sink == nullptr) sink = &defaultSink;
+    sinkDiscards = dynamic_cast<NullSink*>(sink) != nullptr;
+    installedSink = sink;
+}
+
+EventSink* EventLog::getSink() {
+    return installedSink;
+}
+
+void EventLog::setThreadSink(EventSink* sink) {
+    threadDiscards = dynamic_cast<NullSink*>(sink) != nullptr;
+    threadSink = sink;
+}
+
+void EventLog::setLevel(LogLevel level) {
+    minimumLevel = level;
+}
+
+bool EventLog::enabled(LogLevel level) {
+    if (level < minimumLevel.load(std::memory_order_relaxed) || level == LOG_OFF) return false;
+    return threadSink != nullptr ? !threadDiscards : !sinkDiscards.load(std::memory_order_relaxed);
+}
+
+void EventLog::log(LogLevel level, std::string message) {
+    EventSink* sink = threadSink != nullptr ? threadSink : installedSink.load();
+    sink->write(level, std::move(message));
+}
+
+// ==================== METRICS IMPLEMENTATION ====================
+namespace {
+std::mutex shardMutex;
+std::deque<MetricsShard> shards;
+std::vector<MetricsShard*> freeShards;
+
+// Returns the thread's shard to the pool when the thread exits. The counts
+// stay in it, so snapshots keep seeing them.
+struct ShardLease {
+    MetricsShard* shard = nullptr;
+    
+    ~ShardLease() {
+        if (shard == nullptr) return;
+        std::lock_guard<std::mutex> lock(shardMutex);
+        freeShards.push_back(shard);
+    }
+};
+
+const char* const kCounterNames[METRIC_COUNTER_COUNT] = {
+    "orders_created", "pizzas_ordered", "order_steps", "state_changes", "preparing_retries",
+    "orders_ready", "menu_pizzas_added", "menu_pizzas_removed", "notifications", "observer_updates"
+};
+
+const char* const kHistogramNames[METRIC_HISTOGRAM_COUNT] = {"preparing_ns", "fan_out_ns"};
+}
+
+std::atomic<unsigned int> Metrics::sampleEvery(16);
+
+MetricsShard::MetricsShard() {
+    for (auto& counter : counters) {
+        counter.store(0, std::memory_order_relaxed);
+    }
+    for (auto& histogram : histograms) {
+        for (auto& bucket : histogram.buckets) {
+            bucket.store(0, std::memory_order_relaxed);
+        }
+        histogram.count.store(0, std::memory_order_relaxed);
+        histogram.sum.store(0, std::memory_order_relaxed);
+        histogram.max.store(0, std::memory_order_relaxed);
+    }
+}
+
+// Slow path, once per thread: the lease hands the shard back at thread exit
+MetricsShard* Metrics::attachThread() {
+    thread_local ShardLease lease;
+    std::lock_guard<std::mutex> lock(shardMutex);
+    if (!freeShards.empty()) {
+        lease.shard = freeShards.back();
+        freeShards.pop_back();
+    } else {
+        shards.emplace_back();
+        lease.shard = &shards.back();
+    }
+    localShard = lease.shard;
+    return lease.shard;
+}
+
+void Metrics::setSampleEvery(unsigned int every) {
+    sampleEvery = std::max(1u, every);
+    sampleCountdown = 1;
+}
+
+unsigned int Metrics::getSampleEvery() {
+    return sampleEvery;
+}
+
+std::uint64_t Metrics::bucketUpperBound(int bucket) {
+    const int subBuckets = 1 << kMetricSubBucketBits;
+    if (bucket < subBuckets) return static_cast<std::uint64_t>(bucket);
+    int shift = (bucket >> kMetricSubBucketBits) - 1;
+    std::uint64_t lower = static_cast<std::uint64_t>(subBuckets + (bucket & (subBuckets - 1))) << shift;
+    return lower + ((std::uint64_t(1) << shift) - 1);
+}
+
+// Counts from a thread still recording may be one event apart between
+// fields, never torn within one.
+MetricsSnapshot Metrics::snapshot() {
+    MetricsSnapshot result;
+    std::lock_guard<std::mutex> lock(shardMutex);
+    for (const MetricsShard& shard : shards) {
+        for (int c = 0; c < METRIC_COUNTER_COUNT; c++) {
+            result.counters[c] += shard.counters[c].load(std::memory_order_relaxed);
+        }
+        for (int h = 0; h < METRIC_HISTOGRAM_COUNT; h++) {
+            const MetricsShard::Histogram& source = shard.histograms[h];
+            MetricsSnapshot::Histogram& target = result.histograms[h];
+            target.count += source.count.load(std::memory_order_relaxed);
+            target.sum += source.sum.load(std::memory_order_relaxed);
+            target.max = std::max(target.max, source.max.load(std::memory_order_relaxed));
+            for (int b = 0; b < kMetricBuckets; b++) {
+                target.buckets[b] += source.buckets[b].load(std::memory_order_relaxed);
+            }
+        }
+    }
+    return result;
+}
+
+const char* Metrics::nameOf(MetricCounter counter) {
+    return kCounterNames[counter];
+}
+
+const char* Metrics::nameOf(MetricHistogram histogram) {
+    return kHistogramNames[histogram];
+}
+
+MetricsSnapshot::MetricsSnapshot() {
+    for (auto& counter : counters) {
+        counter = 0;
+    }
+    for (auto& histogram : histograms) {
+        histogram.count = 0;
+        histogram.sum = 0;
+        histogram.max = 0;
+        histogram.buckets.assign(kMetricBuckets, 0);
+    }
+}
+
+std::uint64_t MetricsSnapshot::Histogram::percentile(double q) const {
+    if (count == 0) return 0;
+    std::uint64_t rank = static_cast<std::uint64_t>(q * count + 0.5);
+    rank = std::max<std::uint64_t>(1, std::min(rank, count));
+    std::uint64_t seen = 0;
+    for (int b = 0; b < kMetricBuckets; b++) {
+        seen += buckets[b];
+        if (seen >= rank) return std::min(Metrics::bucketUpperBound(b), max);
+    }
+    return max;
+}
+
+std::uint64_t MetricsSnapshot::counter(MetricCounter which) const {
+    return counters[which];
+}
+
+const MetricsSnapshot::Histogram& MetricsSnapshot::histogram(MetricHistogram which) const {
+    return histograms[which];
+}
+
+void MetricsSnapshot::writeText(std::ostream& out) const {
+    for (int c = 0; c < METRIC_COUNTER_COUNT; c++) {
+        const char* name = Metrics::nameOf(static_cast<MetricCounter>(c));
+        out << "# TYPE pizzashop_" << name << "_total counter\n";
+        out << "pizzashop_" << name << "_total " << counters[c] << "\n";
+    }
+    const double quantiles[] = {0.5, 0.9, 0.99, 0.999};
+    for (int h = 0; h < METRIC_HISTOGRAM_COUNT; h++) {
+        const char* name = Metrics::nameOf(static_cast<MetricHistogram>(h));
+        const Histogram& histogram = histograms[h];
+        out << "# TYPE pizzashop_" << name << " summary\n";
+        for (double q : quantiles) {
+            out << "pizzashop_" << name << "{quantile=\"" << q << "\"} " << histogram.percentile(q) << "\n";
+        }
+        out << "pizzashop_" << name << "_sum " << histogram.sum << "\n";
+        out << "pizzashop_" << name << "_count " << histogram.count << "\n";
+        out << "pizzashop_" << name << "_max " << histogram.max << "\n";
+    }
+}
@@ -6,131 +6,576 @@
 #include <string>
 #include <map>
 #include <list>
+#include <cstddef>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#include <functional>
+#include <atomic>
+#include <memory>
+#include <exception>
+#include <unordered_map>
+#include <chrono>
+#include <sstream>
+#include <cstdint>
+#include <string_view>
+#include <algorithm>
+#include <type_traits>
+#include <variant>
+#include <stdexcept>
+#if defined(__cpp_impl_coroutine)
+#include <coroutine>
+#endif
 
 // Forward declarations
 class Pizza;
 class Topping;
 class ToppingGroup;
+class ToppingCatalog;
 class BasePizza;
 class PizzaDecorator;
 class ExtraCheese;
 class StuffedCrust;
+class AddOnPizza;
 class DiscountStrategy;
 class RegularPrice;
 class BulkDiscount;
 class FamilyDiscount;
+class RuleDiscount;
 class Observer;
 class Customer;
 class Website;
 class Menu;
 class PizzaMenu;
 class SpecialsMenu;
+class MenuSnapshot;
+class MenuReader;
+class NotificationDispatcher;
 class OrderPhase;
 class OrderStarted;
 class Pending;
 class Preparing;
 class Ready;
+class PlaceOrder;
+struct PizzaRecord;
+class PizzaArena;
+class OrderJournal;
+class OrderService;
+class EventSink;
+class StateWaiter;
+class OrderStateAwaiter;
+
+// ==================== MONEY ====================
+// Currency amount held as whole cents. Adding Money is exact integer
+// arithmetic, so a total is the same whichever order its parts are summed
+// in. Conversions from double and every scaling round to the nearest cent,
+// halves away from zero. Converting from double is explicit and throws
+// std::invalid_argument for NaN, infinities and amounts whose cents would
+// not fit in 64 bits.
+class Money {
+private:
+    std::int64_t cents;
+    
+    static constexpr double kMaxAmount = 9.2e16;
+    
+    static constexpr std::int64_t roundedQuotient(std::int64_t numerator, std::int64_t denominator) {
+        return numerator >= 0 ? (2 * numerator + denominator) / (2 * denominator)
+                              : -((-2 * numerator + denominator) / (2 * denominator));
+    }
+    
+public:
+    constexpr Money() : cents(0) {}
+    constexpr explicit Money(double amount) : cents(0) {
+        if (!isRepresentable(amount)) {
+            throw std::invalid_argument("Money: convert amount: not a finite amount in range");
+        }
+        cents = static_cast<std::int64_t>(amount * 100.0 + (amount < 0 ? -0.5 : 0.5));
+    }
+    static constexpr Money fromCents(std::int64_t value) {
+        Money money;
+        money.cents = value;
+        return money;
+    }
+    
+    // False for NaN too, so readers can screen untrusted amounts
+    static constexpr bool isRepresentable(double amount) {
+        return amount > -kMaxAmount && amount < kMaxAmount;
+    }
+    
+    constexpr std::int64_t getCents() const { return cents; }
+    constexpr double toDouble() const { return cents / 100.0; }
+    
+    // this * numerator / denominator, e.g. scaledBy(85, 100) for 15% off.
+    // Exact for amounts up to about R90 billion per 100-denominator.
+    constexpr Money scaledBy(std::int64_t numerator, std::int64_t denominator) const {
+        return fromCents(roundedQuotient(cents * numerator, denominator));
+    }
+    
+    constexpr Money& operator+=(Money other) { cents += other.cents; return *this; }
+    constexpr Money& operator-=(Money other) { cents -= other.cents; return *this; }
+    friend constexpr Money operator+(Money a, Money b) { return fromCents(a.cents + b.cents); }
+    friend constexpr Money operator-(Money a, Money b) { return fromCents(a.cents - b.cents); }
+    friend constexpr Money operator-(Money a) { return fromCents(-a.cents); }
+    // Whole counts only; fractional factors must say how to round, via scaledBy
+    template <typename Count, typename = typename std::enable_if<std::is_integral<Count>::value>::type>
+    friend constexpr Money operator*(Money a, Count count) { return fromCents(a.cents * static_cast<std::int64_t>(count)); }
+    
+    friend constexpr bool operator==(Money a, Money b) { return a.cents == b.cents; }
+    friend constexpr bool operator!=(Money a, Money b) { return a.cents != b.cents; }
+    friend constexpr bool operator<(Money a, Money b) { return a.cents < b.cents; }
+    friend constexpr bool operator<=(Money a, Money b) { return a.cents <= b.cents; }
+    friend constexpr bool operator>(Money a, Money b) { return a.cents > b.cents; }
+    friend constexpr bool operator>=(Money a, Money b) { return a.cents >= b.cents; }
+};
+
+// Prints like the equivalent double, e.g. 103.7
+std::ostream& operator<<(std::ostream& os, Money money);
+
+// ==================== ORDER ARENA ====================
+// Bump allocator for Pizza nodes. While a PizzaArena::Scope is active on a
+// thread, every Pizza created there is carved out of the arena. Deleting such
+// a node still runs its destructor but frees nothing; the arena hands all of
+// its memory back at once in reset().
+class PizzaArena {
+private:
+    struct Block {
+        char* data;
+        std::size_t size;
+    };
+    std::vector<Block> blocks;
+    std::size_t blockSize;
+    std::size_t currentBlock;
+    std::size_t offset;
+    std::size_t used;
+    
+public:
+    explicit PizzaArena(std::size_t blockSize = 4096);
+    ~PizzaArena();
+    PizzaArena(const PizzaArena&) = delete;
+    PizzaArena& operator=(const PizzaArena&) = delete;
+    
+    void* allocate(std::size_t size);
+    void reset();
+    std::size_t bytesUsed() const;
+    static PizzaArena* current();
+    
+    // Routes Pizza allocations on this thread into an arena until destroyed
+    class Scope {
+    private:
+        PizzaArena* previous;
+        
+    public:
+        explicit Scope(PizzaArena& arena);
+        ~Scope();
+        Scope(const Scope&) = delete;
+        Scope& operator=(const Scope&) = delete;
+    };
+};
 
 // ==================== COMPOSITE PATTERN ====================
 class Pizza {
 protected:
-    double price;
+    Money price;
     std::string name;
     
+    // Memoized label for composite and decorator nodes. Stale caches are
+    // rebuilt on the next getName(); invalidateName() also clears every
+    // ancestor so the whole chain picks up a ToppingGroup::add. The first
+    // reader publishes the label, so a finished tree can be named from
+    // many threads; mutating a tree still needs its single owner.
+    enum : std::uint8_t { NAME_STALE, NAME_BUILDING, NAME_READY };
+    Pizza* parent;
+    std::string cachedName;
+    std::atomic<std::uint8_t> nameState;
+    void adopt(Pizza* child);
+    void invalidateName();
+    bool nameReady() const;
+    std::string cachedLabel();
+    
+    // Wrapper nodes answer getName()/getPrice() from their child and keep
+    // no label or price of their own
+    Pizza();
+    
 public:
-    Pizza(double p, std::string n);
+    Pizza(Money p, std::string_view n);
     virtual ~Pizza();
+    // Children link back to their parent, so nodes stay put; ownership of a
+    // tree moves by moving its PizzaPtr
+    Pizza(const Pizza&) = delete;
+    Pizza& operator=(const Pizza&) = delete;
     virtual std::string getName() = 0;
-    virtual double getPrice() = 0;
+    virtual Money getPrice() = 0;
+    virtual void appendName(std::string& out);
+    void writeName(std::ostream& os);
+    virtual void flatten(PizzaRecord& record);
+    virtual void writeBinary(std::string& out);
+    virtual bool isShared() const;
+    
+    static void* operator new(std::size_t size);
+    static void operator delete(void* ptr);
+};
+
+// Owning handle for a Pizza tree. Shared catalog toppings belong to the
+// catalog, so the deleter leaves them alone; arena nodes are destroyed and
+// their memory is left for the arena's reset().
+struct PizzaDeleter {
+    void operator()(Pizza* pizza) const;
 };
+using PizzaPtr = std::unique_ptr<Pizza, PizzaDeleter>;
+
+// e.g. makePizza<Topping>(Money(10.00), "Dough")
+template <typename Node, typename... Args>
+PizzaPtr makePizza(Args&&... args) {
+    return PizzaPtr(new Node(std::forward<Args>(args)...));
+}
 
 class Topping : public Pizza {
+private:
+    int id;
+    
 public:
-    Topping(double p, std::string n);
+    Topping(Money p, std::string_view n);
+    Topping(Money p, std::string_view n, int catalogId);
     std::string getName() override;
-    double getPrice() override;
+    void appendName(std::string& out) override;
+    Money getPrice() override;
+    void flatten(PizzaRecord& record) override;
+    void writeBinary(std::string& out) override;
+    bool isShared() const override;
+    int getId() const;
+};
+
+// ==================== TOPPING CATALOG (FLYWEIGHT) ====================
+// Process-wide registry of immutable Topping instances keyed by name and
+// price. Catalog toppings carry a small integer id, are shared by every
+// group that adds them and are never deleted by their owners.
+class ToppingCatalog {
+private:
+    std::deque<Topping> entries;
+    std::map<std::pair<std::string, std::int64_t>, int> index;
+    mutable std::mutex mutex;
+    
+    ToppingCatalog();
+    
+public:
+    static ToppingCatalog& instance();
+    int intern(const std::string& name, Money price);
+    Topping* get(const std::string& name, Money price);
+    Topping* get(int id);
+    std::size_t size() const;
 };
 
 class ToppingGroup : public Pizza {
 private:
-    std::vector<Pizza*> toppings;
+    std::vector<PizzaPtr> toppings;
     
 public:
-    ToppingGroup(std::string n);
-    ~ToppingGroup();
-    void add(Pizza* component);
+    ToppingGroup(std::string_view n);
+    void reserve(std::size_t count);
+    void add(PizzaPtr component);
     std::string getName() override;
-    double getPrice() override;
+    void appendName(std::string& out) override;
+    Money getPrice() override;
+    void flatten(PizzaRecord& record) override;
+    void writeBinary(std::string& out) override;
+};
+
+// ==================== COMPILE-TIME MENU RECIPES ====================
+struct RecipeTopping {
+    const char* name;
+    Money price;
+};
+
+// Fixed menu pizza described entirely at compile time
+template <std::size_t N>
+struct PizzaRecipe {
+    const char* name;
+    RecipeTopping toppings[N];
+    
+    constexpr std::size_t size() const { return N; }
+    
+    constexpr Money basePrice() const {
+        Money total;
+        for (std::size_t i = 0; i < N; i++) {
+            total += toppings[i].price;
+        }
+        return total;
+    }
+};
+
+namespace MenuRecipes {
+inline constexpr PizzaRecipe<4> Pepperoni = {"Pepperoni Pizza", {
+    {"Dough", Money(10.00)}, {"Tomato Sauce", Money(5.00)}, {"Cheese", Money(15.00)},
+    {"Pepperoni", Money(20.00)}}};
+
+inline constexpr PizzaRecipe<6> Vegetarian = {"Vegetarian Pizza", {
+    {"Dough", Money(10.00)}, {"Tomato Sauce", Money(5.00)}, {"Cheese", Money(15.00)},
+    {"Mushrooms", Money(12.00)}, {"Green Peppers", Money(10.00)}, {"Onions", Money(8.00)}}};
+
+inline constexpr PizzaRecipe<6> MeatLovers = {"Meat Lovers Pizza", {
+    {"Dough", Money(10.00)}, {"Tomato Sauce", Money(5.00)}, {"Cheese", Money(15.00)},
+    {"Pepperoni", Money(20.00)}, {"Beef Sausage", Money(25.00)}, {"Salami", Money(22.00)}}};
+
+inline constexpr PizzaRecipe<8> VegetarianDeluxe = {"Vegetarian Deluxe Pizza", {
+    {"Dough", Money(10.00)}, {"Tomato Sauce", Money(5.00)}, {"Cheese", Money(15.00)},
+    {"Mushrooms", Money(12.00)}, {"Green Peppers", Money(10.00)}, {"Onions", Money(8.00)},
+    {"Feta Cheese", Money(18.00)}, {"Olives", Money(15.00)}}};
+}
+
+// A whole menu pizza in one node. Name and topping table point into the
+// constexpr recipe and the price is precomputed, so materializing one is a
+// single allocation. It reads exactly like the equivalent BasePizza tree.
+class MenuPizza : public Pizza {
+private:
+    const char* recipeName;
+    const RecipeTopping* toppings;
+    const int* toppingIds;
+    std::size_t toppingCount;
+    
+public:
+    MenuPizza(const char* recipeName, const RecipeTopping* toppings, const int* toppingIds,
+              std::size_t toppingCount, Money basePrice);
+    std::string getName() override;
+    Money getPrice() override;
+    void appendName(std::string& out) override;
+    void flatten(PizzaRecord& record) override;
+    void writeBinary(std::string& out) override;
 };
 
 // ==================== DECORATOR PATTERN ====================
 class BasePizza : public Pizza {
 private:
-    Pizza* toppings;
+    PizzaPtr toppings;
     
 public:
-    BasePizza(Pizza* t);
-    ~BasePizza();
-    double getPrice() override;
+    BasePizza(PizzaPtr t);
+    Money getPrice() override;
     std::string getName() override;
+    void appendName(std::string& out) override;
+    void flatten(PizzaRecord& record) override;
+    void writeBinary(std::string& out) override;
     void printPizza();
 };
 
 class PizzaDecorator : public Pizza {
 protected:
-    Pizza* pizza;
+    PizzaPtr pizza;
     
 public:
-    PizzaDecorator(Pizza* p);
-    virtual ~PizzaDecorator();
+    PizzaDecorator(PizzaPtr p);
 };
 
+// Default surcharges, shared by the decorators and the inline add-ons
+inline constexpr Money kExtraCheeseCost(12.00);
+inline constexpr Money kStuffedCrustCost(20.00);
+
 class ExtraCheese : public PizzaDecorator {
 private:
-    double extraCost;
+    Money extraCost;
     
 public:
-    ExtraCheese(Pizza* p, double cost = 12.00);
-    double getPrice() override;
+    ExtraCheese(PizzaPtr p, Money cost = kExtraCheeseCost);
+    Money getPrice() override;
     std::string getName() override;
+    void appendName(std::string& out) override;
+    void flatten(PizzaRecord& record) override;
+    void writeBinary(std::string& out) override;
     void printPizza();
 };
 
 class StuffedCrust : public PizzaDecorator {
 private:
-    double extraCost;
+    Money extraCost;
     
 public:
-    StuffedCrust(Pizza* p, double cost = 20.00);
-    double getPrice() override;
+    StuffedCrust(PizzaPtr p, Money cost = kStuffedCrustCost);
+    Money getPrice() override;
     std::string getName() override;
+    void appendName(std::string& out) override;
+    void flatten(PizzaRecord& record) override;
+    void writeBinary(std::string& out) override;
     void printPizza();
 };
 
+// ==================== INLINE ADD-ONS ====================
+// Closed-set alternative to a chain of ExtraCheese/StuffedCrust decorators:
+// one node holds the base pizza and up to kCapacity add-ons inline, so a
+// stack of add-ons costs one allocation and one virtual hop instead of one
+// per layer. Names, prices, records and the binary encoding match the
+// equivalent decorator chain exactly.
+struct ExtraCheeseAddOn {
+    Money cost = kExtraCheeseCost;
+};
+
+struct StuffedCrustAddOn {
+    Money cost = kStuffedCrustCost;
+};
+
+using AddOn = std::variant<ExtraCheeseAddOn, StuffedCrustAddOn>;
+
+class AddOnPizza : public Pizza {
+public:
+    static constexpr std::size_t kCapacity = 8;
+    
+private:
+    PizzaPtr pizza;
+    AddOn addOns[kCapacity];
+    std::size_t count;
+    Money surcharge;
+    
+public:
+    AddOnPizza(PizzaPtr p);
+    // Appends in place when pizza is an AddOnPizza with room left, otherwise
+    // wraps it in a new node; full nodes nest like decorators do
+    static PizzaPtr add(PizzaPtr pizza, const AddOn& addOn);
+    bool push(const AddOn& addOn);
+    std::size_t size() const;
+    
+    Money getPrice() override;
+    std::string getName() override;
+    void appendName(std::string& out) override;
+    void flatten(PizzaRecord& record) override;
+    void writeBinary(std::string& out) override;
+    void printPizza();
+};
+
+// ==================== FLATTENED PIZZA RECORD ====================
+// Struct-of-arrays snapshot of a Pizza tree. Compiling walks the
+// Composite/Decorator nodes once; pricing is then a loop over contiguous
+// arrays instead of virtual calls on individually allocated nodes.
+// Compiling never adds to the ToppingCatalog: a topping outside it gets the
+// record-local id -1 - i, with its name kept in unlistedNames[i].
+struct PizzaRecord {
+    std::vector<int> toppingIds;
+    std::vector<Money> toppingPrices;
+    std::vector<Money> surcharges;
+    std::vector<std::string> unlistedNames;
+
+    static PizzaRecord compile(Pizza* pizza);
+    Money getPrice() const;
+    void clear();
+    void addUnlisted(std::string_view name, Money price);
+    std::string toppingName(std::size_t index) const;
+};
+
 // ==================== STRATEGY PATTERN ====================
 class DiscountStrategy {
 public:
     virtual ~DiscountStrategy();
-    virtual double applyDiscount(double originalPrice) = 0;
+    virtual Money applyDiscount(Money originalPrice) = 0;
+    virtual void applyDiscount(const Money* in, Money* out, std::size_t count);
     virtual std::string getStrategyName() = 0;
+    
+    // Order-aware entry points used by PlaceOrder and BatchPricer. The
+    // defaults only look at the subtotal, so percentage strategies keep
+    // their scalar and vector kernels.
+    virtual Money applyDiscount(const PlaceOrder& order, Money subtotal);
+    virtual void applyDiscount(PlaceOrder* const* orders, const Money* subtotals, Money* out, std::size_t count);
 };
 
 class RegularPrice : public DiscountStrategy {
 public:
-    double applyDiscount(double originalPrice) override;
+    using DiscountStrategy::applyDiscount;
+    Money applyDiscount(Money originalPrice) override;
+    void applyDiscount(const Money* in, Money* out, std::size_t count) override;
     std::string getStrategyName() override;
 };
 
 class BulkDiscount : public DiscountStrategy {
 public:
-    double applyDiscount(double originalPrice) override;
+    using DiscountStrategy::applyDiscount;
+    Money applyDiscount(Money originalPrice) override;
+    void applyDiscount(const Money* in, Money* out, std::size_t count) override;
     std::string getStrategyName() override;
 };
 
 class FamilyDiscount : public DiscountStrategy {
 public:
-    double applyDiscount(double originalPrice) override;
+    using DiscountStrategy::applyDiscount;
+    Money applyDiscount(Money originalPrice) override;
+    void applyDiscount(const Money* in, Money* out, std::size_t count) override;
+    std::string getStrategyName() override;
+};
+
+// ==================== RULE-BASED DISCOUNTS ====================
+// A rule looks either at the whole order (topping empty: count is the
+// number of pizzas) or at one topping by name (count is how often it occurs
+// across the order's pizzas). It applies once count >= minCount and the
+// subtotal >= minSubtotal. Stackable rules add up; every other rule only
+// competes on its own. The order gets whichever is larger, the stacked sum
+// or the best single rule, and never more than its subtotal.
+enum DiscountEffect {
+    PERCENT_OFF,        // value percent of the subtotal, to 0.01%
+    AMOUNT_OFF,         // value rand off the order
+    AMOUNT_OFF_EACH     // value rand per pizza / per topping occurrence
+};
+
+struct DiscountRule {
+    std::string name;
+    std::string topping;
+    std::size_t minCount;
+    Money minSubtotal;
+    DiscountEffect effect;
+    double value;
+    bool stackable;
+};
+
+// Rules are compiled once, in the constructor, into per-topping tables of
+// prefix sums and maxima keyed by the two thresholds. Pricing an order is a
+// single pass over its toppings plus two binary searches per table touched,
+// so cost does not grow with the number of rules. Copies share the compiled
+// rules, so handing each order its own copy is cheap; the compiled form is
+// immutable and safe to use from many threads.
+class RuleDiscount : public DiscountStrategy {
+private:
+    struct RuleTotals {
+        std::int64_t stackedBasisPoints;
+        Money stackedAmount;
+        Money stackedEach;
+        std::int64_t bestBasisPoints;
+        Money bestAmount;
+        Money bestEach;
+    };
+    
+    // All rules with minCount <= minCount, ordered by minSubtotal
+    struct RuleLevel {
+        std::size_t minCount;
+        std::vector<Money> minSubtotals;
+        std::vector<RuleTotals> totals;
+    };
+    
+    struct RuleTable {
+        std::vector<RuleLevel> levels;
+        void accumulate(std::size_t count, Money subtotal, Money& stacked, Money& best) const;
+    };
+    
+    struct RuleBook {
+        std::size_t ruleCount;
+        RuleTable orderRules;
+        std::vector<RuleTable> toppingRules;
+        std::unordered_map<std::string, int> toppingTables;
+        std::unique_ptr<std::atomic<int>[]> tableOfTopping;   // catalog id -> table, -1 none, -2 unresolved
+        std::size_t resolvedIds;
+        
+        int tableFor(int toppingId) const;
+    };
+    
+    std::shared_ptr<const RuleBook> book;
+    
+    static RuleTable buildTable(std::vector<const DiscountRule*> rules);
+    Money discountFor(const PlaceOrder* order, Money subtotal) const;
+    
+public:
+    explicit RuleDiscount(const std::vector<DiscountRule>& rules);
+    
+    using DiscountStrategy::applyDiscount;
+    // Without an order only whole-order rules with minCount 0 can match
+    Money applyDiscount(Money originalPrice) override;
+    Money applyDiscount(const PlaceOrder& order, Money subtotal) override;
+    void applyDiscount(PlaceOrder* const* orders, const Money* subtotals, Money* out, std::size_t count) override;
     std::string getStrategyName() override;
+    std::size_t getRuleCount() const;
 };
 
 // ==================== OBSERVER PATTERN ====================
@@ -145,7 +590,7 @@ private:
     std::string name;
     
 public:
-    Customer(std::string n);
+    Customer(std::string_view n);
     void update(const std::string& message) override;
 };
 
@@ -155,20 +600,132 @@ public:
     void update(const std::string& message) override;
 };
 
+// One listed pizza as a snapshot saw it
+struct MenuItem {
+    std::size_t id;
+    Pizza* pizza;       // only safe to use while the pizza is still listed
+    std::string name;
+    Money price;
+};
+
+// Immutable listing of a menu at one version, in the menu's listing order.
+// Items sit in fixed-size chunks shared between versions; a new version
+// rebuilds only the chunks that edits touched since the one before.
+class MenuSnapshot {
+public:
+    static const std::size_t CHUNK_SIZE = 64;
+    typedef std::vector<MenuItem> Chunk;
+    
+private:
+    std::uint64_t version;
+    std::size_t count;
+    std::vector<std::shared_ptr<const Chunk>> chunks;
+    friend class Menu;
+    
+public:
+    MenuSnapshot();
+    std::uint64_t getVersion() const;
+    std::size_t size() const;
+    const MenuItem& operator[](std::size_t index) const;
+    std::size_t getChunkCount() const;
+    const std::shared_ptr<const Chunk>& getChunk(std::size_t chunk) const;
+};
+
+// Menus list pizzas without owning them; keep the PizzaPtr alive while a
+// pizza is listed. Safe to use from many threads. Writers serialize on
+// menuMutex and every edit is O(1): pizzas and observers live in dense
+// vectors with hash indexes and are swap-removed, so listing order is not
+// preserved across removals. Each pizza and observer is listed at most
+// once.
+//
+// Adding or removing a pizza bumps getVersion(). snapshot() returns an
+// immutable, versioned MenuSnapshot, rebuilt on the first read after a
+// change and sharing untouched chunks with the previous one; MenuReader
+// caches it per reader.
+//
+// Notification iterates an immutable observer snapshot without taking the
+// menu lock; edits only retire the current snapshot and the next
+// notification rebuilds it. removeObserver waits for readers of retired
+// snapshots before returning, unless called from inside update().
 class Menu {
 protected:
+    struct PizzaEntry {
+        std::size_t position;
+        std::size_t namePosition;
+        std::size_t id;
+        std::string name;
+    };
+    
     std::vector<Observer*> observers;
+    std::unordered_map<Observer*, std::size_t> observerIndex;
     std::vector<Pizza*> pizzas;
+    std::unordered_map<Pizza*, PizzaEntry> pizzaIndex;
+    std::unordered_map<std::size_t, Pizza*> pizzasById;
+    std::unordered_map<std::string, std::vector<Pizza*>> pizzasByName;
+    std::size_t nextPizzaId;
+    std::atomic<NotificationDispatcher*> dispatcher;
+    std::shared_ptr<const std::vector<Observer*>> observerSnapshot;
+    std::vector<std::weak_ptr<const std::vector<Observer*>>> retiredSnapshots;
+    std::mutex menuMutex;
+    
+    // Every edit bumps version; the snapshot for it is built on first read
+    std::shared_ptr<const MenuSnapshot> menuSnapshot;
+    std::vector<std::size_t> dirtyChunks;
+    bool allChunksDirty;
+    std::atomic<std::uint64_t> version;
+    
+    // Caller holds menuMutex
+    void retireObservers();
+    void markDirty(std::size_t position);
+    void rebuildSnapshot();
+    
+    // Index maintenance for addPizza/removePizza; false if nothing changed.
+    // The name is captured once on insert and reused for the notification.
+    bool insertPizza(Pizza* pizza, std::string& name);
+    bool erasePizza(Pizza* pizza, std::string& name);
+    
+    // Fans a message out to every observer, or queues it on the dispatcher
+    void deliver(const std::string& message);
     
 public:
+    Menu();
     virtual ~Menu();
     void addObserver(Observer* observer);
     void removeObserver(Observer* observer);
+    void setDispatcher(NotificationDispatcher* asyncDispatcher);
+    std::size_t getPizzaCount();
+    std::size_t getObserverCount();
+    Pizza* findPizza(const std::string& name);
+    Pizza* findPizza(std::size_t id);
+    std::size_t getPizzaId(Pizza* pizza);
+    
+    // Changes with every add or remove, so an observer that remembers the
+    // version it last rendered can skip a refresh when nothing changed
+    std::uint64_t getVersion() const { return version.load(std::memory_order_acquire); }
+    // Current listing without taking the menu lock unless this version was
+    // never read before; holding it keeps that version alive
+    std::shared_ptr<const MenuSnapshot> snapshot();
     virtual void addPizza(Pizza* pizza) = 0;
     virtual void removePizza(Pizza* pizza) = 0;
     virtual void notifyObservers(const std::string& message) = 0;
 };
 
+// Per-reader cache of a menu's snapshot. While the menu is unchanged,
+// current() is one atomic load, with no lock and no reference count traffic.
+class MenuReader {
+private:
+    Menu& menu;
+    std::shared_ptr<const MenuSnapshot> cached;
+    
+public:
+    explicit MenuReader(Menu& menu);
+    // Stays valid until the next call
+    const MenuSnapshot& current() {
+        if (cached->getVersion() != menu.getVersion()) cached = menu.snapshot();
+        return *cached;
+    }
+};
+
 class PizzaMenu : public Menu {
 public:
     void addPizza(Pizza* pizza) override;
@@ -186,33 +743,64 @@ public:
 // ==================== STATE PATTERN ====================
 class PlaceOrder;
 
+// The phases carry no data, so each has one shared instance() that
+// transitions hand around without allocating. Shared instances are never
+// deleted; heap-allocated phases passed to setState are still owned and
+// deleted by the order as before.
 class OrderPhase {
+private:
+    bool shared;
+    
+protected:
+    explicit OrderPhase(bool sharedInstance = false);
+    
 public:
     virtual ~OrderPhase();
     virtual void handleState(PlaceOrder* order) = 0;
     virtual std::string getStateName() const = 0;
+    bool isShared() const;
 };
 
 class OrderStarted : public OrderPhase {
+private:
+    explicit OrderStarted(bool sharedInstance);
+    
 public:
+    OrderStarted();
+    static OrderStarted* instance();
     void handleState(PlaceOrder* order) override;
     std::string getStateName() const override;
 };
 
 class Pending : public OrderPhase {
+private:
+    explicit Pending(bool sharedInstance);
+    
 public:
+    Pending();
+    static Pending* instance();
     void handleState(PlaceOrder* order) override;
     std::string getStateName() const override;
 };
 
 class Preparing : public OrderPhase {
+private:
+    explicit Preparing(bool sharedInstance);
+    
 public:
+    Preparing();
+    static Preparing* instance();
     void handleState(PlaceOrder* order) override;
     std::string getStateName() const override;
 };
 
 class Ready : public OrderPhase {
+private:
+    explicit Ready(bool sharedInstance);
+    
 public:
+    Ready();
+    static Ready* instance();
     void handleState(PlaceOrder* order) override;
     std::string getStateName() const override;
 };
@@ -220,40 +808,1120 @@ public:
 // ==================== MERGED PLACEORDER CLASS ====================
 class PlaceOrder {
 private:
-    std::vector<Pizza*> pizzas;
+    std::vector<PizzaPtr> pizzas;
+    std::vector<PizzaRecord> records;
     DiscountStrategy* discountStrategy;
     OrderPhase* currentState;
+    PizzaArena arena;
+    unsigned int randomState;
+    OrderJournal* journal;
+    std::uint64_t journalId;
+    std::uint64_t preparingSince;
+    StateWaiter* stateWaiters;
+    
+    void wakeStateWaiters();
     
 public:
     PlaceOrder();
     ~PlaceOrder();
+    PizzaArena& getArena();
     
     // Order management methods
-    void addPizza(Pizza* pizza);
+    void addPizza(PizzaPtr pizza);
     void setDiscountStrategy(DiscountStrategy* strategy);
-    double calculateTotal();
+    Money calculateSubtotal();
+    Money calculateTotal();
     int getPizzaCount();
-    double getTotal();
+    Money getTotal();
     
     // State management methods
     void processOrder();
     void setState(OrderPhase* newState);
     std::string getStatus() const;
+    void setRandomSeed(unsigned int seed);
+    bool rollPreparationIssue();
+    // Metrics::now() when the order entered Preparing, if this visit is
+    // sampled for timing; otherwise 0
+    std::uint64_t getPreparingSince() const;
     
     // Additional utility methods
     void printOrderSummary();
     void clearOrder();
+    const std::vector<PizzaPtr>& getPizzas() const;
+    const std::vector<PizzaRecord>& getRecords() const;
+    DiscountStrategy* getDiscountStrategy() const;
+    
+    // Every later change is appended to the journal before it is applied;
+    // pass nullptr to stop journaling.
+    void attachJournal(OrderJournal* journal, std::uint64_t orderId);
+    
+    // Tells waiter once the order enters waiter->phase; returns false without
+    // registering when it is already there. Waiters still registered when
+    // the order is destroyed are told it was never reached.
+    bool waitForState(StateWaiter* waiter);
+#if defined(__cpp_impl_coroutine)
+    // co_await order.untilState("READY") from an OrderTask; yields whether
+    // the state was reached (false if the order was destroyed first). GCC 12
+    // miscompiles co_await as an if condition, so bind the result first.
+    // Unknown status names throw std::invalid_argument.
+    OrderStateAwaiter untilState(const std::string& status);
+#endif
 };
 
 // ==================== Creation methods ====================
 class PizzaFactory {
+private:
+    static PizzaPtr createFromToppings(const char* name, const RecipeTopping* toppings, std::size_t count);
+    
+public:
+    static PizzaPtr createPepperoniPizza();
+    static PizzaPtr createVegetarianPizza();
+    static PizzaPtr createMeatLoversPizza();
+    static PizzaPtr createVegetarianDeluxePizza();
+    static PizzaPtr addExtraCheese(PizzaPtr pizza);
+    static PizzaPtr addStuffedCrust(PizzaPtr pizza);
+    
+    // e.g. createMenuPizza<MenuRecipes::Pepperoni>()
+    template <const auto& Recipe>
+    static PizzaPtr createMenuPizza();
+};
+
+template <const auto& Recipe>
+PizzaPtr PizzaFactory::createMenuPizza() {
+    constexpr Money price = Recipe.basePrice();
+    // Catalog ids are resolved once per recipe, on first use
+    static const std::vector<int> ids = [] {
+        std::vector<int> resolved;
+        for (std::size_t i = 0; i < Recipe.size(); i++) {
+            resolved.push_back(ToppingCatalog::instance().intern(Recipe.toppings[i].name, Recipe.toppings[i].price));
+        }
+        return resolved;
+    }();
+    return makePizza<MenuPizza>(Recipe.name, Recipe.toppings, ids.data(), Recipe.size(), price);
+}
+
+// ==================== BINARY SERIALIZATION ====================
+// Versioned binary form of orders and Composite/Decorator trees, in host
+// (little-endian) byte order. Every node is
+//     tag u8 | size u32 | payload
+// where size covers the whole node, so readers can skip subtrees:
+//     TOPPING        price f64 | nameLen u16 | name
+//     GROUP          nameLen u16 | name | childCount u32 | children
+//     BASE           child
+//     EXTRA_CHEESE   cost f64 | child
+//     STUFFED_CRUST  cost f64 | child
+// An order is
+//     "PZOR" | version u16 | discount u8 | state u8 | pizzaCount u32 | pizzas
+// MenuPizza nodes are written as the BASE/GROUP tree they stand for.
+// Readers reject a price or cost that is not finite or exceeds R10 million
+// either way, and a discount byte other than the built-in three.
+enum PizzaNodeTag {
+    NODE_INVALID = 0,
+    NODE_TOPPING = 1,
+    NODE_GROUP = 2,
+    NODE_BASE = 3,
+    NODE_EXTRA_CHEESE = 4,
+    NODE_STUFFED_CRUST = 5
+};
+
+enum DiscountCode { DISCOUNT_REGULAR = 0, DISCOUNT_BULK = 1, DISCOUNT_FAMILY = 2, DISCOUNT_CUSTOM = 255 };
+enum PhaseCode { PHASE_ORDER_STARTED = 0, PHASE_PENDING = 1, PHASE_PREPARING = 2, PHASE_READY = 3 };
+
+// Zero-copy reader over one serialized pizza node. Only valid inside a
+// buffer accepted by OrderView::open or PizzaView::open, and only for as
+// long as that buffer lives.
+class PizzaView {
+private:
+    const char* data;
+    std::size_t size;
+    
+public:
+    PizzaView();
+    PizzaView(const char* data, std::size_t size);
+    static bool open(const char* data, std::size_t size, PizzaView& view);
+    
+    PizzaNodeTag tag() const;
+    std::string_view label() const;
+    Money cost() const;
+    std::size_t childCount() const;
+    PizzaView child(std::size_t index) const;
+    std::size_t byteSize() const;
+    
+    Money getPrice() const;
+    void appendName(std::string& out) const;
+    std::string getName() const;
+};
+
+class OrderView {
+private:
+    const char* data;
+    std::size_t size;
+    
+public:
+    OrderView();
+    static bool open(const char* data, std::size_t size, OrderView& view);
+    
+    std::uint16_t getVersion() const;
+    DiscountCode getDiscountCode() const;
+    PhaseCode getPhaseCode() const;
+    std::size_t getPizzaCount() const;
+    PizzaView pizza(std::size_t index) const;
+    Money getTotal() const;
+};
+
+class OrderSerializer {
+public:
+    static const std::uint16_t FORMAT_VERSION = 1;
+    
+    static void writePizza(Pizza* pizza, std::string& out);
+    static void writeOrder(PlaceOrder& order, std::string& out);
+    static DiscountCode discountCodeOf(DiscountStrategy* strategy);
+    static DiscountStrategy* createDiscount(DiscountCode code);
+    static PhaseCode phaseCodeOf(const std::string& status);
+    static OrderPhase* phaseFor(PhaseCode code);
+    
+    // Rebuild heap trees; toppings come back as shared catalog entries
+    static PizzaPtr readPizza(const PizzaView& view);
+    static bool readOrder(const char* data, std::size_t size, PlaceOrder& order);
+};
+
+// ==================== WORK-STEALING THREAD POOL ====================
+// Fixed set of workers, each with its own deque. Workers pop their own
+// work LIFO and steal FIFO from the others when they run dry. Tasks
+// submitted from inside a task stay on the submitting worker's deque.
+// Every task belongs to a Batch, and wait(batch) covers only that batch.
+// The waiting thread runs queued tasks until its batch is done, so
+// waiting from inside a task does not deadlock the pool.
+class WorkStealingPool {
+public:
+    // Completion latch for one group of tasks: its own count and first
+    // failure. Must outlive wait(); the pool guards both fields.
+    class Batch {
+        friend class WorkStealingPool;
+        std::size_t pending;
+        std::exception_ptr firstError;
+        
+    public:
+        Batch() : pending(0) {}
+        Batch(const Batch&) = delete;
+        Batch& operator=(const Batch&) = delete;
+    };
+    
+private:
+    struct Task {
+        std::function<void()> run;
+        Batch* batch;
+    };
+    
+    struct WorkQueue {
+        std::deque<Task> tasks;
+        std::mutex mutex;
+    };
+    
+    std::vector<std::unique_ptr<WorkQueue>> queues;
+    std::vector<std::thread> workers;
+    std::mutex stateMutex;
+    std::condition_variable workAvailable;
+    std::condition_variable batchDone;
+    std::atomic<std::size_t> queued;
+    std::atomic<std::size_t> nextQueue;
+    bool stopping;
+    
+    bool runOne(std::size_t self);
+    void workerLoop(std::size_t index);
+    
+public:
+    explicit WorkStealingPool(std::size_t threadCount = 0);
+    ~WorkStealingPool();
+    WorkStealingPool(const WorkStealingPool&) = delete;
+    WorkStealingPool& operator=(const WorkStealingPool&) = delete;
+    
+    void submit(Batch& batch, std::function<void()> task);
+    void wait(Batch& batch);
+    std::size_t size() const;
+};
+
+// ==================== BATCH PRICING ====================
+// Prices many orders across a WorkStealingPool. Each order is still priced
+// by its own calculateTotal() on one thread, so results are bit-identical
+// to a serial loop regardless of scheduling.
+class BatchPricer {
+private:
+    WorkStealingPool& pool;
+    std::size_t grainSize;
+    
+public:
+    explicit BatchPricer(WorkStealingPool& pool, std::size_t grainSize = 256);
+    void priceOrders(PlaceOrder* const* orders, std::size_t count, Money* totals);
+    std::vector<Money> priceOrders(const std::vector<PlaceOrder*>& orders);
+    
+    // Prices every order under one promo strategy, ignoring each order's own
+    void repriceWith(PlaceOrder* const* orders, std::size_t count, DiscountStrategy& strategy, Money* totals);
+};
+
+// ==================== ASYNC NOTIFICATION DISPATCH ====================
+// Takes observer fan-out off the caller's thread. Menus post events onto a
+// queue; a dispatcher thread drains everything queued so far, coalesces
+// consecutive events for the same observer list into one batch and splits
+// the batch's observers across a worker pool. Batches are delivered one at
+// a time, so every observer still sees messages in posting order.
+// Observers must stay alive until flush() returns. An observer that throws
+// is logged at LOG_ERROR and counted in getFailedDeliveries(); it only
+// loses the rest of its own chunk of that batch.
+class NotificationDispatcher {
+private:
+    struct Event {
+        std::shared_ptr<const std::vector<Observer*>> observers;
+        std::string message;
+    };
+    
+    WorkStealingPool pool;
+    std::size_t fanOutGrain;
+    std::deque<Event> queue;
+    std::mutex mutex;
+    std::condition_variable queueChanged;
+    bool stopping;
+    bool delivering;
+    std::size_t eventsDelivered;
+    std::size_t batchesDelivered;
+    std::size_t failedDeliveries;
+    std::thread dispatcherThread;
+    
+    void run();
+    void deliverBatch(const std::shared_ptr<const std::vector<Observer*>>& observers,
+                      const std::vector<std::string>& messages);
+    
 public:
-    static Pizza* createPepperoniPizza();
-    static Pizza* createVegetarianPizza();
-    static Pizza* createMeatLoversPizza();
-    static Pizza* createVegetarianDeluxePizza();
-    static Pizza* addExtraCheese(Pizza* pizza);
-    static Pizza* addStuffedCrust(Pizza* pizza);
+    explicit NotificationDispatcher(std::size_t threadCount = 0, std::size_t fanOutGrain = 1024);
+    ~NotificationDispatcher();
+    NotificationDispatcher(const NotificationDispatcher&) = delete;
+    NotificationDispatcher& operator=(const NotificationDispatcher&) = delete;
+    
+    void post(std::shared_ptr<const std::vector<Observer*>> observers, const std::string& message);
+    void flush();
+    std::size_t getEventsDelivered();
+    std::size_t getBatchesDelivered();
+    std::size_t getFailedDeliveries();     // batches in which an observer threw
+};
+
+// ==================== KITCHEN SCHEDULER ====================
+struct KitchenMetrics {
+    std::size_t submitted;
+    std::size_t completed;
+    std::size_t transitions;
+    std::size_t retries;
+    std::size_t queueDepth[3];      // ORDER STARTED, PENDING, PREPARING
+    std::size_t maxQueueDepth[3];
+    std::size_t waitingForRetry;
+    double elapsedSeconds;
+    double ordersPerSecond;
+};
+
+// Owns submitted orders and drives each one to READY on a pool of oven
+// threads. Every phase has its own bounded queue; submit() blocks while the
+// ORDER STARTED queue is full, and an oven whose next queue is full keeps
+// working the order itself. Ovens take tickets in small batches, an even
+// share of the queued work each, and step them outside the lock. A
+// Preparing -> Pending failure parks the order with exponential backoff
+// before it is queued again. Seed orders with PlaceOrder::setRandomSeed
+// for reproducible simulations.
+class Kitchen {
+private:
+    typedef std::chrono::steady_clock Clock;
+    enum Phase { STARTED, PENDING, PREPARING, PHASE_COUNT };
+    
+    struct Ticket {
+        PlaceOrder* order;
+        std::size_t retries;
+    };
+    
+    std::deque<Ticket> queues[PHASE_COUNT];
+    std::multimap<Clock::time_point, Ticket> backoff;
+    std::vector<std::unique_ptr<PlaceOrder>> orders;
+    std::vector<PlaceOrder*> readyOrders;
+    std::size_t queueCapacity;
+    std::size_t ovenCount;
+    std::chrono::microseconds baseBackoff;
+    std::chrono::microseconds maxBackoff;
+    KitchenMetrics metrics;
+    Clock::time_point startTime;
+    std::mutex mutex;
+    std::condition_variable workAvailable;
+    std::condition_variable spaceAvailable;
+    std::condition_variable orderReady;
+    bool stopping;
+    std::vector<std::thread> ovens;
+    
+    static constexpr std::size_t kOvenBatch = 32;
+    
+    static int phaseOf(const std::string& status);
+    std::size_t queuedTickets() const;
+    void takeTickets(std::vector<Ticket>& batch, Clock::time_point& wakeAt);
+    void route(Ticket ticket, int from);
+    void ovenLoop();
+    
+public:
+    Kitchen(std::size_t ovenCount = 4, std::size_t queueCapacity = 256,
+            std::chrono::microseconds baseBackoff = std::chrono::microseconds(100),
+            std::chrono::microseconds maxBackoff = std::chrono::microseconds(10000));
+    ~Kitchen();
+    Kitchen(const Kitchen&) = delete;
+    Kitchen& operator=(const Kitchen&) = delete;
+    
+    void submit(PlaceOrder* order);
+    void drain();
+    KitchenMetrics getMetrics();
+    std::vector<PlaceOrder*> getReadyOrders();
+};
+
+// ==================== ORDER JOURNAL ====================
+// Write-ahead log of PlaceOrder events in fixed-size, memory-mapped segment
+// files (journal-NNNNNN.log) under one directory. A segment starts with
+//     "PZJL" | version u16 | reserved u16 | index u64 | firstSequence u64
+// followed by records
+//     size u32 | crc u32 | sequence u64 | orderId u64 | type u8 | payload
+// where size covers the whole record and crc everything after it. A zero
+// size or a bad crc ends a segment, so a torn tail is dropped on recovery.
+enum JournalEventType {
+    JOURNAL_ADD_PIZZA = 1,      // payload: one serialized pizza node
+    JOURNAL_SET_DISCOUNT = 2,   // payload: DiscountCode u8
+    JOURNAL_SET_STATE = 3,      // payload: PhaseCode u8
+    JOURNAL_CLEAR_ORDER = 4,
+    JOURNAL_CLOSE_ORDER = 5     // order finished; not rebuilt on recovery
+};
+
+struct JournalRecoveryStats {
+    std::size_t segments;
+    std::size_t events;
+    std::size_t openOrders;
+    std::size_t tornSegments;
+};
+
+// append() only copies into the mapped segment. sync() is a group commit:
+// the first caller flushes everything appended so far with one msync while
+// later callers wait for that flush instead of issuing their own. Appending
+// always starts a fresh segment, so reopening a directory never rewrites
+// existing records.
+class OrderJournal {
+private:
+    std::string directory;
+    std::size_t segmentBytes;
+    int segmentFd;
+    char* segmentData;
+    std::uint64_t segmentIndex;
+    std::size_t writeOffset;
+    std::size_t syncedOffset;
+    std::uint64_t nextSequence;
+    std::uint64_t durableSequence;
+    std::size_t syncCount;
+    bool flushing;
+    std::mutex mutex;
+    std::condition_variable flushDone;
+    
+    void openSegment(std::uint64_t index);
+    bool closeSegment();
+    
+public:
+    static const std::size_t DEFAULT_SEGMENT_BYTES = std::size_t(64) << 20;
+    
+    explicit OrderJournal(const std::string& directory, std::size_t segmentBytes = DEFAULT_SEGMENT_BYTES);
+    ~OrderJournal();
+    OrderJournal(const OrderJournal&) = delete;
+    OrderJournal& operator=(const OrderJournal&) = delete;
+    
+    // Returns the record's sequence number
+    std::uint64_t append(std::uint64_t orderId, JournalEventType type, const char* payload = nullptr, std::size_t length = 0);
+    std::uint64_t closeOrder(std::uint64_t orderId);
+    
+    // Blocks until every record up to sequence is on disk
+    void sync(std::uint64_t sequence);
+    void sync();
+    std::uint64_t getLastSequence();
+    std::size_t getSyncCount();
+    
+    // Scans the segments in parallel and rebuilds every order that was not
+    // closed, keyed by order id. Rebuilt orders are not attached to a journal.
+    static JournalRecoveryStats recover(const std::string& directory,
+                                        std::map<std::uint64_t, std::unique_ptr<PlaceOrder>>& orders,
+                                        std::size_t threadCount = 0);
+};
+
+// ==================== ORDER INGEST ====================
+// Streams POS order exports into priced PlaceOrders. One row is one order:
+//     CSV    id,pizzas,discount            e.g. 42,pepperoni+cheese;vegetarian,family
+//     JSONL  {"id": 42, "pizzas": ["pepperoni+cheese", "vegetarian"], "discount": "family"}
+// A pizza is a menu recipe (pepperoni, vegetarian, meat-lovers,
+// vegetarian-deluxe) followed by any of +cheese and +crust; the discount
+// (regular, bulk, family) may be left out. A first CSV row naming the
+// columns (id or order_id, pizzas, discount) is skipped as a header.
+enum IngestFormat { INGEST_CSV, INGEST_JSONL };
+enum IngestRecipe { INGEST_PEPPERONI, INGEST_VEGETARIAN, INGEST_MEAT_LOVERS, INGEST_VEGETARIAN_DELUXE };
+
+struct IngestPizza {
+    std::uint8_t recipe;
+    bool extraCheese;
+    bool stuffedCrust;
+};
+
+// Fixed-size so the parse stage never allocates per row
+struct IngestRecord {
+    static const std::size_t MAX_PIZZAS = 16;
+    
+    std::uint64_t id;
+    DiscountCode discount;
+    std::size_t pizzaCount;
+    IngestPizza pizzas[MAX_PIZZAS];
+};
+
+// Queue between two stages. fullWaits counts pushes that found the queue
+// full (the downstream stage is the bottleneck), emptyWaits pops that found
+// it empty (the upstream stage is).
+struct IngestQueueStats {
+    std::size_t batches;
+    std::size_t fullWaits;
+    std::size_t emptyWaits;
+    std::size_t maxDepth;
+    double producerBlockedMs;
+    double consumerBlockedMs;
+};
+
+struct IngestStats {
+    std::size_t bytesRead;
+    std::size_t rowsParsed;
+    std::size_t malformedRows;
+    std::size_t ordersBuilt;
+    std::size_t ordersPriced;
+    std::size_t pizzasBuilt;
+    Money revenue;
+    IngestQueueStats parsedQueue;   // parse -> build
+    IngestQueueStats builtQueue;    // build -> price
+    double elapsedSeconds;
+    double ordersPerSecond;
+};
+
+// Blocking, bounded FIFO of batches. close() wakes everyone: pops drain
+// what is left and then fail, pushes fail straight away.
+template <typename T>
+class IngestQueue {
+private:
+    typedef std::chrono::steady_clock Clock;
+    
+    std::deque<T> items;
+    std::size_t capacity;
+    bool closed;
+    IngestQueueStats stats;
+    std::mutex mutex;
+    std::condition_variable notFull;
+    std::condition_variable notEmpty;
+    
+public:
+    explicit IngestQueue(std::size_t capacity) : capacity(capacity == 0 ? 1 : capacity), closed(false), stats() {}
+    
+    // On failure the caller keeps the item
+    bool push(T&& item) {
+        std::unique_lock<std::mutex> lock(mutex);
+        if (!closed && items.size() >= capacity) {
+            stats.fullWaits++;
+            Clock::time_point start = Clock::now();
+            notFull.wait(lock, [this] { return closed || items.size() < capacity; });
+            stats.producerBlockedMs += std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+        }
+        if (closed) return false;
+        items.push_back(std::move(item));
+        stats.batches++;
+        stats.maxDepth = std::max(stats.maxDepth, items.size());
+        notEmpty.notify_one();
+        return true;
+    }
+    
+    bool pop(T& item) {
+        std::unique_lock<std::mutex> lock(mutex);
+        if (!closed && items.empty()) {
+            stats.emptyWaits++;
+            Clock::time_point start = Clock::now();
+            notEmpty.wait(lock, [this] { return closed || !items.empty(); });
+            stats.consumerBlockedMs += std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+        }
+        if (items.empty()) return false;
+        item = std::move(items.front());
+        items.pop_front();
+        notFull.notify_one();
+        return true;
+    }
+    
+    void close() {
+        std::lock_guard<std::mutex> lock(mutex);
+        closed = true;
+        notFull.notify_all();
+        notEmpty.notify_all();
+    }
+    
+    IngestQueueStats getStats() {
+        std::lock_guard<std::mutex> lock(mutex);
+        return stats;
+    }
+};
+
+// Runs parse -> build -> price on separate threads joined by bounded
+// queues of batches; the file is read in fixed-size chunks, never whole.
+// Builders put each order's pizzas in that order's arena. Priced orders go
+// to the sink, which takes ownership even if it throws; without a sink
+// they are deleted. Parsing is cheap next to building an order (its arena
+// block, a PizzaRecord per pizza) and freeing it again, so when the stages
+// share a core, extra builders only add queue contention.
+class OrderIngester {
+public:
+    typedef std::function<void(PlaceOrder*)> OrderSink;
+    
+private:
+    std::size_t batchSize;
+    std::size_t queueCapacity;
+    std::size_t chunkBytes;
+    std::size_t builderCount;
+    OrderSink sink;
+    
+public:
+    OrderIngester(std::size_t batchSize = 1024, std::size_t queueCapacity = 16,
+                  std::size_t chunkBytes = std::size_t(1) << 20, std::size_t builderCount = 1);
+    void setSink(OrderSink orderSink);
+    
+    IngestStats ingest(std::istream& input, IngestFormat format);
+    IngestStats ingestFile(const std::string& path, IngestFormat format);
+    
+    static bool parseCsvLine(std::string_view line, IngestRecord& record);
+    static bool parseJsonLine(std::string_view line, IngestRecord& record);
+    static PizzaPtr buildPizza(const IngestPizza& spec);
+    static PlaceOrder* buildOrder(const IngestRecord& record);
+};
+
+// ==================== ORDER SERVICE ====================
+// Multi-store order service. Store storeId belongs to shard
+// storeId % shardCount, which owns that store's menu and orders; only the
+// shard's worker thread touches them, so shards share nothing but their
+// own mailbox. Workers log through EventLog::setThreadSink, never the
+// installed sink: to the sink given to the service, or nowhere by default.
+// An AsyncSink keeps that path lock-free. Requests and responses are
+// fixed-size little-endian frames
+//     request   op u8 | recipe u8 | flags u8 | discount u8 | storeId u32 | orderId u64
+//     response  status u8 | phase u8 | pizzas u16 | reserved u32 | orderId u64 | total cents i64
+enum ServiceOp {
+    SERVICE_CREATE_ORDER = 1,
+    SERVICE_ADD_PIZZA = 2,      // recipe: IngestRecipe, flags: ServiceFlag bits
+    SERVICE_SET_DISCOUNT = 3,   // discount: DiscountCode other than custom
+    SERVICE_ADVANCE = 4,        // one processOrder() step
+    SERVICE_GET_ORDER = 5,
+    SERVICE_CLOSE_ORDER = 6,
+    SERVICE_LIST_RECIPE = 7,    // recipe goes back on the store's menu
+    SERVICE_UNLIST_RECIPE = 8   // recipe can no longer be ordered at this store
+};
+
+enum ServiceFlag { SERVICE_EXTRA_CHEESE = 1, SERVICE_STUFFED_CRUST = 2 };
+
+enum ServiceStatus {
+    SERVICE_OK = 0,
+    SERVICE_UNKNOWN_ORDER = 1,
+    SERVICE_BAD_REQUEST = 2,
+    SERVICE_NOT_ON_MENU = 3,
+    SERVICE_UNAVAILABLE = 4     // service stopping or connection lost
+};
+
+struct ServiceRequest {
+    static const std::size_t WIRE_SIZE = 16;
+    
+    std::uint8_t op;
+    std::uint8_t recipe;
+    std::uint8_t flags;
+    std::uint8_t discount;
+    std::uint32_t storeId;
+    std::uint64_t orderId;
+    
+    void encode(char* out) const;
+    static ServiceRequest decode(const char* in);
+};
+
+struct ServiceResponse {
+    static const std::size_t WIRE_SIZE = 24;
+    
+    std::uint8_t status;
+    std::uint8_t phase;         // PhaseCode
+    std::uint16_t pizzaCount;
+    std::uint64_t orderId;
+    Money total;
+    
+    void encode(char* out) const;
+    static ServiceResponse decode(const char* in);
+};
+
+class OrderService {
+public:
+    typedef std::function<void(const ServiceResponse&)> Callback;
+    
+private:
+    struct Call {
+        ServiceRequest request;
+        Callback done;
+    };
+    
+    // The menu lists the store's recipe pizzas, so it is declared after them
+    struct Store {
+        PizzaPtr recipes[4];    // indexed by IngestRecipe
+        PizzaMenu menu;
+    };
+    
+    struct OpenOrder {
+        std::uint32_t storeId;
+        std::unique_ptr<PlaceOrder> order;
+    };
+    
+    // Everything below the mailbox is touched only by the worker thread
+    struct Shard {
+        std::vector<Call> mailbox;
+        std::mutex mutex;
+        std::condition_variable wake;
+        bool stopping;
+        
+        std::unordered_map<std::uint32_t, std::unique_ptr<Store>> stores;
+        std::unordered_map<std::uint64_t, OpenOrder> orders;
+        std::uint64_t nextOrder;
+        std::thread worker;
+    };
+    
+    std::vector<std::unique_ptr<Shard>> shards;
+    EventSink* logSink;
+    
+    void workerLoop(Shard& shard, std::size_t index);
+    ServiceResponse handle(Shard& shard, std::size_t index, const ServiceRequest& request);
+    static Store& storeFor(Shard& shard, std::uint32_t storeId);
+    
+public:
+    // 0 shards means one per hardware thread. logSink must outlive the service.
+    explicit OrderService(std::size_t shardCount = 0, EventSink* logSink = nullptr);
+    ~OrderService();
+    OrderService(const OrderService&) = delete;
+    OrderService& operator=(const OrderService&) = delete;
+    
+    std::size_t getShardCount() const;
+    std::size_t shardOf(std::uint32_t storeId) const;
+    
+    // done runs on the shard's worker thread; it must not block
+    void submit(const ServiceRequest& request, Callback done);
+    ServiceResponse call(const ServiceRequest& request);
+};
+
+// Unix-domain-socket front end for an OrderService. Each client connection
+// gets a thread that answers its requests in order, one frame at a time;
+// clients open more connections for concurrency. A connection thread parks
+// itself on the finished list when its client hangs up, and the acceptor
+// joins those before taking the next connection.
+class OrderServer {
+private:
+    struct Connection {
+        int fd;
+        std::thread thread;
+    };
+    
+    OrderService& service;
+    std::string socketPath;
+    int listenFd;
+    std::thread acceptor;
+    std::vector<Connection> connections;
+    std::vector<std::thread> finished;
+    std::mutex mutex;
+    std::condition_variable drained;
+    bool stopping;
+    
+    void acceptLoop();
+    void serve(int fd);
+    
+public:
+    OrderServer(OrderService& service, const std::string& socketPath);
+    ~OrderServer();
+    OrderServer(const OrderServer&) = delete;
+    OrderServer& operator=(const OrderServer&) = delete;
+    
+    // Throws std::runtime_error if the socket cannot be bound
+    void start();
+    void stop();
+    // Live connection threads plus exited ones not yet joined
+    std::size_t getThreadCount();
+};
+
+// Blocking client for OrderServer; one request in flight per connection.
+// A lost connection answers SERVICE_UNAVAILABLE.
+class OrderClient {
+private:
+    int fd;
+    
+public:
+    // Throws std::runtime_error if the server cannot be reached
+    explicit OrderClient(const std::string& socketPath);
+    ~OrderClient();
+    OrderClient(const OrderClient&) = delete;
+    OrderClient& operator=(const OrderClient&) = delete;
+    
+    ServiceResponse call(const ServiceRequest& request);
+    ServiceResponse createOrder(std::uint32_t storeId);
+    ServiceResponse addPizza(std::uint32_t storeId, std::uint64_t orderId, IngestRecipe recipe, std::uint8_t flags = 0);
+    ServiceResponse setDiscount(std::uint32_t storeId, std::uint64_t orderId, DiscountCode discount);
+    ServiceResponse advance(std::uint32_t storeId, std::uint64_t orderId);
+    ServiceResponse getOrder(std::uint32_t storeId, std::uint64_t orderId);
+    ServiceResponse closeOrder(std::uint32_t storeId, std::uint64_t orderId);
+};
+
+// ==================== ORDER COROUTINES ====================
+// Observer for one PlaceOrder state. The waiter is linked into the order
+// in place, so a coroutine waiting on an order never allocates.
+class StateWaiter {
+public:
+    PhaseCode phase;
+    StateWaiter* next;
+    
+    explicit StateWaiter(PhaseCode phase);
+    virtual ~StateWaiter();
+    virtual void stateReached(bool reached) = 0;
+};
+
+#if defined(__cpp_impl_coroutine)
+class OrderExecutor;
+
+// Fire-and-forget coroutine run by an OrderExecutor. It starts suspended,
+// runs once spawned and frees its own frame when it finishes.
+class OrderTask {
+public:
+    struct promise_type {
+        OrderExecutor* executor = nullptr;
+        std::size_t lane = 0;
+        
+        OrderTask get_return_object();
+        std::suspend_always initial_suspend() noexcept { return {}; }
+        std::suspend_never final_suspend() noexcept;
+        void return_void() {}
+        void unhandled_exception();
+    };
+    typedef std::coroutine_handle<promise_type> Handle;
+    
+private:
+    Handle handle;
+    friend class OrderExecutor;
+    
+public:
+    explicit OrderTask(Handle handle);
+    OrderTask(OrderTask&& other) noexcept;
+    OrderTask& operator=(OrderTask&&) = delete;
+    ~OrderTask();
 };
 
+// Resumes the awaiting task on its executor lane once the order reaches the state
+class OrderStateAwaiter : public StateWaiter {
+private:
+    PlaceOrder& order;
+    OrderTask::Handle handle;
+    bool reached;
+    
+public:
+    OrderStateAwaiter(PlaceOrder& order, PhaseCode phase);
+    // Linked into the order by address, so it must not move
+    OrderStateAwaiter(const OrderStateAwaiter&) = delete;
+    OrderStateAwaiter& operator=(const OrderStateAwaiter&) = delete;
+    bool await_ready();
+    bool await_suspend(OrderTask::Handle awaiting);
+    bool await_resume() const;
+    void stateReached(bool reached) override;
+};
+
+// Multiplexes OrderTasks over a few threads. Each thread drains its own
+// lane, and spawn() pins a task to lane key % laneCount, so tasks spawned
+// with the same key (e.g. an order id) never run concurrently and may
+// share an order without locks. Suspended tasks cost only their frame.
+class OrderExecutor {
+private:
+    struct Lane {
+        std::vector<std::coroutine_handle<>> ready;
+        std::mutex mutex;
+        std::condition_variable wake;
+        bool stopping;
+        std::thread worker;
+    };
+    
+    std::vector<std::unique_ptr<Lane>> lanes;
+    std::atomic<std::size_t> liveTasks;
+    std::mutex doneMutex;
+    std::condition_variable allDone;
+    std::exception_ptr error;
+    
+    void laneLoop(Lane& lane);
+    
+public:
+    struct YieldAwaiter {
+        bool await_ready() const noexcept { return false; }
+        void await_suspend(OrderTask::Handle awaiting) const;
+        void await_resume() const noexcept {}
+    };
+    
+    // 0 threads means one per hardware thread
+    explicit OrderExecutor(std::size_t threadCount = 0);
+    // Finishes what is queued; tasks still waiting on an order are abandoned,
+    // so destroy or finish those orders first
+    ~OrderExecutor();
+    OrderExecutor(const OrderExecutor&) = delete;
+    OrderExecutor& operator=(const OrderExecutor&) = delete;
+    
+    void spawn(OrderTask task, std::size_t key = 0);
+    void schedule(std::coroutine_handle<> handle, std::size_t lane);
+    // co_await OrderExecutor::yield() requeues the task behind its lane's other work
+    static YieldAwaiter yield();
+    void taskFinished();
+    void taskFailed(std::exception_ptr failure);
+    
+    // Blocks until every spawned task has finished; rethrows the first task failure
+    void drain();
+    std::size_t getLaneCount() const;
+    std::size_t getLiveTasks() const;
+};
+#endif
+
+// ==================== EVENT LOGGING ====================
+// Order, state, observer and printPizza output goes through PIZZA_LOG to the
+// installed EventSink instead of straight to std::cout. The default sink
+// writes each line to std::cout without flushing. Installing a NullSink or
+// raising the level skips message formatting altogether, and building
+// with -DPIZZASHOP_NO_LOGGING compiles every call site away.
+enum LogLevel { LOG_DEBUG, LOG_INFO, LOG_WARNING, LOG_ERROR, LOG_OFF };
+
+class EventSink {
+public:
+    virtual ~EventSink();
+    virtual void write(LogLevel level, std::string message) = 0;
+    virtual void flush();
+};
+
+class ConsoleSink : public EventSink {
+private:
+    std::mutex mutex;
+    
+public:
+    void write(LogLevel level, std::string message) override;
+    void flush() override;
+};
+
+class NullSink : public EventSink {
+public:
+    void write(LogLevel level, std::string message) override;
+};
+
+// Producers claim slots in a bounded multi-producer ring with a CAS; a
+// background thread drains the ring into the stream. The writer sleeps on
+// a condition variable while the ring is empty, and producers only take its
+// mutex to wake it from that sleep. A full ring makes producers yield until
+// the writer catches up.
+// Uninstall it with EventLog::setSink before destroying it.
+class AsyncSink : public EventSink {
+private:
+    struct Slot {
+        std::atomic<std::size_t> sequence;
+        LogLevel level;
+        std::string message;
+    };
+    
+    std::ostream& out;
+    std::unique_ptr<Slot[]> slots;
+    std::size_t mask;
+    std::atomic<std::size_t> enqueuePos;
+    std::atomic<std::size_t> dequeuePos;
+    std::atomic<bool> stopping;
+    std::atomic<bool> writerSleeping;
+    std::mutex wakeMutex;
+    std::condition_variable wake;
+    std::thread writer;
+    
+    bool drainOnce();
+    bool hasPending() const;
+    void writerLoop();
+    
+public:
+    explicit AsyncSink(std::ostream& out, std::size_t capacity = 8192);
+    ~AsyncSink();
+    AsyncSink(const AsyncSink&) = delete;
+    AsyncSink& operator=(const AsyncSink&) = delete;
+    
+    void write(LogLevel level, std::string message) override;
+    void flush() override;
+};
+
+class EventLog {
+public:
+    static void setSink(EventSink* sink);
+    static EventSink* getSink();
+    // Sends this thread's output to sink instead of the installed one;
+    // nullptr goes back to the installed sink
+    static void setThreadSink(EventSink* sink);
+    static void setLevel(LogLevel level);
+    static bool enabled(LogLevel level);
+    static void log(LogLevel level, std::string message);
+};
+
+#ifdef PIZZASHOP_NO_LOGGING
+// Still type-checks the message, but the optimizer drops the dead branch
+#define PIZZA_LOG(level, expr)                                   \
+    do {                                                         \
+        if (false) {                                             \
+            std::ostringstream pizzaLogStream;                   \
+            pizzaLogStream << expr;                              \
+        }                                                        \
+    } while (0)
+#else
+#define PIZZA_LOG(level, expr)                                   \
+    do {                                                         \
+        if (EventLog::enabled(level)) {                          \
+            std::ostringstream pizzaLogStream;                   \
+            pizzaLogStream << expr;                              \
+            EventLog::log(level, pizzaLogStream.str());          \
+        }                                                        \
+    } while (0)
+#endif
+
+// ==================== METRICS ====================
+// Counters and latency histograms for orders, phases and menus. Each
+// thread writes only to its own shard, so recording is a relaxed load and
+// store with no lock or read-modify-write; snapshot() sums every shard on
+// demand. A shard outlives its thread and is handed to the next new one.
+// Counters see every event. A clock read costs more than a whole state
+// transition, so latencies are timed on a per-thread sample of events.
+// Building with -DPIZZASHOP_NO_METRICS compiles every PIZZA_COUNT and
+// PIZZA_RECORD site away, including its clock reads.
+enum MetricCounter {
+    METRIC_ORDERS_CREATED,
+    METRIC_PIZZAS_ORDERED,
+    METRIC_ORDER_STEPS,             // processOrder calls
+    METRIC_STATE_CHANGES,
+    METRIC_PREPARING_RETRIES,       // Preparing sent the order back to Pending
+    METRIC_ORDERS_READY,
+    METRIC_MENU_PIZZAS_ADDED,
+    METRIC_MENU_PIZZAS_REMOVED,
+    METRIC_NOTIFICATIONS,
+    METRIC_OBSERVER_UPDATES,
+    METRIC_COUNTER_COUNT
+};
+
+enum MetricHistogram {
+    METRIC_PREPARING_NS,            // time an order spent in Preparing before it moved on
+    METRIC_FAN_OUT_NS,              // one message to every observer, or one async batch
+    METRIC_HISTOGRAM_COUNT
+};
+
+// HDR-style log-linear buckets: values below 8 are exact, larger ones keep
+// 3 significant bits, so any reported value is within 12.5% of the truth.
+const int kMetricSubBucketBits = 3;
+const int kMetricBuckets = (64 - kMetricSubBucketBits + 1) << kMetricSubBucketBits;
+
+struct alignas(64) MetricsShard {
+    struct Histogram {
+        std::atomic<std::uint64_t> buckets[kMetricBuckets];
+        std::atomic<std::uint64_t> count;
+        std::atomic<std::uint64_t> sum;
+        std::atomic<std::uint64_t> max;
+    };
+    
+    std::atomic<std::uint64_t> counters[METRIC_COUNTER_COUNT];
+    Histogram histograms[METRIC_HISTOGRAM_COUNT];
+    
+    MetricsShard();
+};
+
+struct MetricsSnapshot {
+    struct Histogram {
+        std::uint64_t count;
+        std::uint64_t sum;
+        std::uint64_t max;
+        std::vector<std::uint64_t> buckets;
+        
+        // Upper bound of the bucket holding the q-th value, capped at max
+        std::uint64_t percentile(double q) const;
+    };
+    
+    std::uint64_t counters[METRIC_COUNTER_COUNT];
+    Histogram histograms[METRIC_HISTOGRAM_COUNT];
+    
+    MetricsSnapshot();
+    std::uint64_t counter(MetricCounter which) const;
+    const Histogram& histogram(MetricHistogram which) const;
+    // Prometheus text exposition format
+    void writeText(std::ostream& out) const;
+};
+
+class Metrics {
+private:
+    static inline thread_local MetricsShard* localShard = nullptr;
+    static inline thread_local unsigned int sampleCountdown = 1;
+    static std::atomic<unsigned int> sampleEvery;
+    static MetricsShard* attachThread();
+    
+    static MetricsShard& shard() {
+        MetricsShard* current = localShard;
+        return current != nullptr ? *current : *attachThread();
+    }
+    
+    // Only the owning thread writes a shard, so a plain load and store is enough
+    static void bump(std::atomic<std::uint64_t>& slot, std::uint64_t amount) {
+        slot.store(slot.load(std::memory_order_relaxed) + amount, std::memory_order_relaxed);
+    }
+    
+public:
+    static void add(MetricCounter counter, std::uint64_t amount = 1) {
+        bump(shard().counters[counter], amount);
+    }
+    
+    static void record(MetricHistogram histogram, std::uint64_t value) {
+        MetricsShard::Histogram& target = shard().histograms[histogram];
+        bump(target.buckets[bucketOf(value)], 1);
+        bump(target.count, 1);
+        bump(target.sum, value);
+        if (value > target.max.load(std::memory_order_relaxed)) {
+            target.max.store(value, std::memory_order_relaxed);
+        }
+    }
+    
+    // True for one in every getSampleEvery() calls on this thread
+    static bool sampleTick() {
+        if (--sampleCountdown != 0) return false;
+        sampleCountdown = sampleEvery.load(std::memory_order_relaxed);
+        return true;
+    }
+    // 1 times every event. Other threads switch after their current countdown.
+    static void setSampleEvery(unsigned int every);
+    static unsigned int getSampleEvery();
+    
+    static int bucketOf(std::uint64_t value) {
+        if (value < (1u << kMetricSubBucketBits)) return static_cast<int>(value);
+        int magnitude = 63 - __builtin_clzll(value);
+        int shift = magnitude - kMetricSubBucketBits;
+        return ((shift + 1) << kMetricSubBucketBits)
+               + static_cast<int>((value >> shift) & ((1u << kMetricSubBucketBits) - 1));
+    }
+    static std::uint64_t bucketUpperBound(int bucket);
+    
+    // Monotonic nanoseconds for latency measurements
+    static std::uint64_t now() {
+        return static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count());
+    }
+    
+    static MetricsSnapshot snapshot();
+    static const char* nameOf(MetricCounter counter);
+    static const char* nameOf(MetricHistogram histogram);
+};
+
+#ifdef PIZZASHOP_NO_METRICS
+// Arguments still type-check, but nothing is evaluated
+#define PIZZA_COUNT(counter, amount) do { if (false) { (void)(amount); } } while (0)
+#define PIZZA_RECORD(histogram, value) do { if (false) { (void)(value); } } while (0)
+#define PIZZA_METRICS_NOW() std::uint64_t(0)
+#define PIZZA_METRICS_SAMPLE() false
+#else
+#define PIZZA_COUNT(counter, amount) Metrics::add(counter, amount)
+#define PIZZA_RECORD(histogram, value) Metrics::record(histogram, value)
+#define PIZZA_METRICS_NOW() Metrics::now()
+#define PIZZA_METRICS_SAMPLE() Metrics::sampleTick()
+#endif
+
 #endif // PIZZASHOP_H
\ No newline at end of file
@@ -2,15 +2,45 @@
 #include <iostream>
 #include <cstdlib>
 #include <ctime>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <sstream>
+#include <algorithm>
+#include <filesystem>
+#include <cmath>
+#include <cstring>
+#include <random>
+
+// Counts notifications instead of printing them, for tests with many observers
+class CountingObserver : public Observer {
+private:
+    std::mutex messageMutex;
+    std::string lastMessage;
+    
+public:
+    std::atomic<int> count;
+    
+    CountingObserver() : count(0) {}
+    void update(const std::string& message) override {
+        std::lock_guard<std::mutex> lock(messageMutex);
+        lastMessage = message;
+        count++;
+    }
+    std::string getLastMessage() {
+        std::lock_guard<std::mutex> lock(messageMutex);
+        return lastMessage;
+    }
+};
 
 void testCompositePattern() {
     std::cout << "\n=== Testing Composite Pattern ===\n";
     
     // Test individual toppings
-    Topping* dough = new Topping(10.00, "Dough");
-    Topping* sauce = new Topping(5.00, "Tomato Sauce");
-    Topping* cheese = new Topping(15.00, "Cheese");
-    Topping* pepperoni = new Topping(20.00, "Pepperoni");
+    Topping* dough = new Topping(Money(10.00), "Dough");
+    Topping* sauce = new Topping(Money(5.00), "Tomato Sauce");
+    Topping* cheese = new Topping(Money(15.00), "Cheese");
+    Topping* pepperoni = new Topping(Money(20.00), "Pepperoni");
     
     std::cout << "Individual toppings:\n";
     std::cout << dough->getName() << ": R" << dough->getPrice() << std::endl;
@@ -18,17 +48,15 @@ void testCompositePattern() {
     std::cout << cheese->getName() << ": R" << cheese->getPrice() << std::endl;
     std::cout << pepperoni->getName() << ": R" << pepperoni->getPrice() << std::endl;
     
-    // Test topping group
-    ToppingGroup* pizza = new ToppingGroup("Custom Pizza");
-    pizza->add(dough);
-    pizza->add(sauce);
-    pizza->add(cheese);
-    pizza->add(pepperoni);
-    
-    std::cout << "\nCustom pizza: " << pizza->getName() << std::endl;
-    std::cout << "Total price: R" << pizza->getPrice() << std::endl;
+    // Test topping group; it owns the toppings from here on
+    ToppingGroup pizza("Custom Pizza");
+    pizza.add(PizzaPtr(dough));
+    pizza.add(PizzaPtr(sauce));
+    pizza.add(PizzaPtr(cheese));
+    pizza.add(PizzaPtr(pepperoni));
     
-    delete pizza; // This will delete all toppings as well
+    std::cout << "\nCustom pizza: " << pizza.getName() << std::endl;
+    std::cout << "Total price: R" << pizza.getPrice() << std::endl;
 }
 
 void testDecoratorPattern() {
@@ -36,22 +64,21 @@ void testDecoratorPattern() {
     
     // Create a base pizza
     ToppingGroup* base = new ToppingGroup("Base Pizza");
-    base->add(new Topping(10.00, "Dough"));
-    base->add(new Topping(5.00, "Tomato Sauce"));
-    base->add(new Topping(15.00, "Cheese"));
+    PizzaPtr toppings(base);
+    base->add(makePizza<Topping>(Money(10.00), "Dough"));
+    base->add(makePizza<Topping>(Money(5.00), "Tomato Sauce"));
+    base->add(makePizza<Topping>(Money(15.00), "Cheese"));
     
-    BasePizza* pizza = new BasePizza(base);
+    PizzaPtr pizza = makePizza<BasePizza>(std::move(toppings));
     std::cout << "Base pizza: " << pizza->getName() << " - R" << pizza->getPrice() << std::endl;
     
     // Add extra cheese
-    Pizza* withCheese = new ExtraCheese(pizza);
+    PizzaPtr withCheese = makePizza<ExtraCheese>(std::move(pizza));
     std::cout << "With extra cheese: " << withCheese->getName() << " - R" << withCheese->getPrice() << std::endl;
     
-    // Add stuffed crust
-    Pizza* withCrust = new StuffedCrust(withCheese);
+    // Add stuffed crust; it now owns the decorators and the base pizza
+    PizzaPtr withCrust = makePizza<StuffedCrust>(std::move(withCheese));
     std::cout << "With stuffed crust: " << withCrust->getName() << " - R" << withCrust->getPrice() << std::endl;
-    
-    delete withCrust; // This will delete all decorators and the base pizza
 }
 
 void testStrategyPattern() {
@@ -62,18 +89,18 @@ void testStrategyPattern() {
     
     // Add some pizzas
     ToppingGroup* pizza1 = new ToppingGroup("Test Pizza 1");
-    pizza1->add(new Topping(10.00, "Dough"));
-    pizza1->add(new Topping(5.00, "Tomato Sauce"));
-    pizza1->add(new Topping(15.00, "Cheese"));
+    pizza1->add(makePizza<Topping>(Money(10.00), "Dough"));
+    pizza1->add(makePizza<Topping>(Money(5.00), "Tomato Sauce"));
+    pizza1->add(makePizza<Topping>(Money(15.00), "Cheese"));
     
     ToppingGroup* pizza2 = new ToppingGroup("Test Pizza 2");
-    pizza2->add(new Topping(10.00, "Dough"));
-    pizza2->add(new Topping(5.00, "Tomato Sauce"));
-    pizza2->add(new Topping(15.00, "Cheese"));
-    pizza2->add(new Topping(20.00, "Pepperoni"));
+    pizza2->add(makePizza<Topping>(Money(10.00), "Dough"));
+    pizza2->add(makePizza<Topping>(Money(5.00), "Tomato Sauce"));
+    pizza2->add(makePizza<Topping>(Money(15.00), "Cheese"));
+    pizza2->add(makePizza<Topping>(Money(20.00), "Pepperoni"));
     
-    order.addPizza(new BasePizza(pizza1));
-    order.addPizza(new BasePizza(pizza2));
+    order.addPizza(makePizza<BasePizza>(PizzaPtr(pizza1)));
+    order.addPizza(makePizza<BasePizza>(PizzaPtr(pizza2)));
     
     // Test different strategies
     std::cout << "Order total with regular price: R" << order.calculateTotal() << std::endl;
@@ -95,11 +122,11 @@ void testStatePattern() {
     
     // Add a test pizza
     ToppingGroup* pizza = new ToppingGroup("Test Pizza");
-    pizza->add(new Topping(10.00, "Dough"));
-    pizza->add(new Topping(5.00, "Tomato Sauce"));
-    pizza->add(new Topping(15.00, "Cheese"));
+    pizza->add(makePizza<Topping>(Money(10.00), "Dough"));
+    pizza->add(makePizza<Topping>(Money(5.00), "Tomato Sauce"));
+    pizza->add(makePizza<Topping>(Money(15.00), "Cheese"));
     
-    order.addPizza(new BasePizza(pizza));
+    order.addPizza(makePizza<BasePizza>(PizzaPtr(pizza)));
     
     // Process through states
     std::cout << "Initial state: " << order.getStatus() << std::endl;
@@ -128,48 +155,37 @@ void testObserverPattern() {
     
     // Add a pizza to trigger notifications
     ToppingGroup* pizza = new ToppingGroup("Test Observer Pizza");
-    pizza->add(new Topping(10.00, "Dough"));
-    pizza->add(new Topping(5.00, "Tomato Sauce"));
-    pizza->add(new Topping(15.00, "Cheese"));
+    pizza->add(makePizza<Topping>(Money(10.00), "Dough"));
+    pizza->add(makePizza<Topping>(Money(5.00), "Tomato Sauce"));
+    pizza->add(makePizza<Topping>(Money(15.00), "Cheese"));
     
     std::cout << "Adding pizza to menu (should trigger notifications):\n";
-    BasePizza* basePizza = new BasePizza(pizza);
-    menu.addPizza(basePizza);
-    
-    // Clean up the pizza we added
-    delete basePizza;
+    PizzaPtr basePizza = makePizza<BasePizza>(PizzaPtr(pizza));
+    menu.addPizza(basePizza.get());
 }
 
 void testPizzaFactory() {
     std::cout << "\n=== Testing Pizza Factory ===\n";
     
     // Test all factory methods
-    Pizza* pepperoni = PizzaFactory::createPepperoniPizza();
+    PizzaPtr pepperoni = PizzaFactory::createPepperoniPizza();
     std::cout << "Pepperoni: " << pepperoni->getName() << " - R" << pepperoni->getPrice() << std::endl;
     
-    Pizza* vegetarian = PizzaFactory::createVegetarianPizza();
+    PizzaPtr vegetarian = PizzaFactory::createVegetarianPizza();
     std::cout << "Vegetarian: " << vegetarian->getName() << " - R" << vegetarian->getPrice() << std::endl;
     
-    Pizza* meatLovers = PizzaFactory::createMeatLoversPizza();
+    PizzaPtr meatLovers = PizzaFactory::createMeatLoversPizza();
     std::cout << "Meat Lovers: " << meatLovers->getName() << " - R" << meatLovers->getPrice() << std::endl;
     
-    Pizza* vegDeluxe = PizzaFactory::createVegetarianDeluxePizza();
+    PizzaPtr vegDeluxe = PizzaFactory::createVegetarianDeluxePizza();
     std::cout << "Vegetarian Deluxe: " << vegDeluxe->getName() << " - R" << vegDeluxe->getPrice() << std::endl;
     
     // Test decorator combinations
-    Pizza* cheesePepperoni = PizzaFactory::addExtraCheese(PizzaFactory::createPepperoniPizza());
+    PizzaPtr cheesePepperoni = PizzaFactory::addExtraCheese(PizzaFactory::createPepperoniPizza());
     std::cout << "Cheese Pepperoni: " << cheesePepperoni->getName() << " - R" << cheesePepperoni->getPrice() << std::endl;
     
-    Pizza* stuffedMeatLovers = PizzaFactory::addStuffedCrust(PizzaFactory::createMeatLoversPizza());
+    PizzaPtr stuffedMeatLovers = PizzaFactory::addStuffedCrust(PizzaFactory::createMeatLoversPizza());
     std::cout << "Stuffed Meat Lovers: " << stuffedMeatLovers->getName() << " - R" << stuffedMeatLovers->getPrice() << std::endl;
-    
-    // Cleanup
-    delete pepperoni;
-    delete vegetarian;
-    delete meatLovers;
-    delete vegDeluxe;
-    delete cheesePepperoni;
-    delete stuffedMeatLovers;
 }
 
 void testOrderProcessing() {
@@ -189,16 +205,16 @@ void testOrderProcessing() {
     specialsMenu.addObserver(&sarah);
     
     // Create some pizzas for the menu
-    Pizza* pepperoni = PizzaFactory::createPepperoniPizza();
-    Pizza* vegetarian = PizzaFactory::createVegetarianPizza();
-    Pizza* meatLovers = PizzaFactory::createMeatLoversPizza();
-    Pizza* vegDeluxe = PizzaFactory::createVegetarianDeluxePizza();
+    PizzaPtr pepperoni = PizzaFactory::createPepperoniPizza();
+    PizzaPtr vegetarian = PizzaFactory::createVegetarianPizza();
+    PizzaPtr meatLovers = PizzaFactory::createMeatLoversPizza();
+    PizzaPtr vegDeluxe = PizzaFactory::createVegetarianDeluxePizza();
     
     // Add pizzas to menu (this will notify observers)
-    pizzaMenu.addPizza(pepperoni);
-    pizzaMenu.addPizza(vegetarian);
-    pizzaMenu.addPizza(meatLovers);
-    pizzaMenu.addPizza(vegDeluxe);
+    pizzaMenu.addPizza(pepperoni.get());
+    pizzaMenu.addPizza(vegetarian.get());
+    pizzaMenu.addPizza(meatLovers.get());
+    pizzaMenu.addPizza(vegDeluxe.get());
     
     // Create a customer order
     PlaceOrder order;
@@ -236,12 +252,6 @@ void testOrderProcessing() {
     std::cout << "\nTesting order clearance:\n";
     order.clearOrder();
     std::cout << "After clearing - Pizzas: " << order.getPizzaCount() << ", Total: R" << order.getTotal() << std::endl;
-    
-    // Clean up menu pizzas
-    delete pepperoni;
-    delete vegetarian;
-    delete meatLovers;
-    delete vegDeluxe;
 }
 
 void testEdgeCases() {
@@ -272,23 +282,32 @@ void testEdgeCases() {
     std::cout << "Empty order state: " << emptyStateOrder.getStatus() << std::endl;
     emptyStateOrder.processOrder();
     std::cout << "Empty order state after processing: " << emptyStateOrder.getStatus() << std::endl;
+
+    // Amounts that cannot be held in cents are refused, not truncated
+    int refused = 0;
+    const double unrepresentable[] = {std::nan(""), HUGE_VAL, -HUGE_VAL, 1e300, -9.3e16};
+    for (double amount : unrepresentable) {
+        try {
+            Money money(amount);
+            std::cout << "Accepted " << amount << " as R" << money << std::endl;
+        } catch (const std::invalid_argument&) {
+            refused++;
+        }
+    }
+    std::cout << (refused == 5 && Money(-0.005).getCents() == -1 && Money(9.1e16).getCents() == 9100000000000000000
+                  ? "✅ Money rejects non-finite and out-of-range amounts\n" : "❌ Money accepted an unrepresentable amount\n");
 }
 
 void testDecoratorPrintMethods() {
     std::cout << "\n=== Testing Decorator Print Methods ===\n";
     
-    Pizza* base = PizzaFactory::createPepperoniPizza();
-    
-    ExtraCheese* withCheese = new ExtraCheese(base);
+    ExtraCheese withCheese(PizzaFactory::createPepperoniPizza());
     std::cout << "Testing ExtraCheese printPizza():\n";
-    withCheese->printPizza();
+    withCheese.printPizza();
     
-    StuffedCrust* withCrust = new StuffedCrust(PizzaFactory::createVegetarianPizza());
+    StuffedCrust withCrust(PizzaFactory::createVegetarianPizza());
     std::cout << "Testing StuffedCrust printPizza():\n";
-    withCrust->printPizza();
-    
-    delete withCheese;
-    delete withCrust;
+    withCrust.printPizza();
 }
 
 void testObserverRemoval() {
@@ -303,17 +322,65 @@ void testObserverRemoval() {
     menu.addObserver(&bob);
     menu.addObserver(&website);
     
+    // The menu only lists pizzas; these handles keep them alive
+    PizzaPtr pepperoni = PizzaFactory::createPepperoniPizza();
+    PizzaPtr vegetarian = PizzaFactory::createVegetarianPizza();
+    
     std::cout << "Adding pizza with all observers:\n";
-    menu.addPizza(PizzaFactory::createPepperoniPizza());
+    menu.addPizza(pepperoni.get());
     
     std::cout << "\nRemoving Alice as observer:\n";
     menu.removeObserver(&alice);
     
     std::cout << "Adding another pizza (Alice shouldn't be notified):\n";
-    menu.addPizza(PizzaFactory::createVegetarianPizza());
+    menu.addPizza(vegetarian.get());
+}
+
+// Unsubscribes from inside its first update()
+class SelfRemovingObserver : public Observer {
+private:
+    Menu& menu;
     
-    // Clean up - note: the pizzas added to menu aren't automatically deleted
-    // so we need to be careful about memory management here
+public:
+    std::atomic<int> count;
+    
+    explicit SelfRemovingObserver(Menu& menu) : menu(menu), count(0) {}
+    void update(const std::string&) override {
+        if (count++ == 0) menu.removeObserver(this);
+    }
+};
+
+void testObserverSelfRemoval() {
+    std::cout << "\n=== Testing Observer Self-Removal ===\n";
+    
+    PizzaPtr pepperoni = PizzaFactory::createPepperoniPizza();
+    PizzaPtr vegetarian = PizzaFactory::createVegetarianPizza();
+    
+    PizzaMenu menu;
+    SelfRemovingObserver leaver(menu);
+    CountingObserver stayer;
+    menu.addObserver(&leaver);
+    menu.addObserver(&stayer);
+    menu.addPizza(pepperoni.get());
+    menu.addPizza(vegetarian.get());
+    bool syncOk = leaver.count == 1 && stayer.count == 2 && menu.getObserverCount() == 1;
+    std::cout << "Synchronous: leaver notified " << leaver.count << "x, stayer " << stayer.count << "x"
+              << (syncOk ? " ✅" : " ❌") << std::endl;
+    
+    // On a dispatcher worker the event being delivered holds the snapshot
+    PizzaMenu asyncMenu;
+    NotificationDispatcher dispatcher(1, 64);
+    asyncMenu.setDispatcher(&dispatcher);
+    SelfRemovingObserver asyncLeaver(asyncMenu);
+    asyncMenu.addObserver(&asyncLeaver);
+    asyncMenu.addPizza(pepperoni.get());
+    dispatcher.flush();
+    asyncMenu.addPizza(vegetarian.get());
+    dispatcher.flush();
+    asyncMenu.setDispatcher(nullptr);
+    bool asyncOk = asyncLeaver.count == 1 && asyncMenu.getObserverCount() == 0;
+    std::cout << "Dispatched: leaver notified " << asyncLeaver.count << "x"
+              << (asyncOk ? " ✅" : " ❌") << std::endl;
 }
 void testPreparingToPendingTransition() {
     std::cout << "\n=== Testing Specific Preparing->Pending Transition ===\n";
@@ -322,10 +389,10 @@ void testPreparingToPendingTransition() {
     
     // Add a test pizza
     ToppingGroup* pizza = new ToppingGroup("Test Pizza");
-    pizza->add(new Topping(10.00, "Dough"));
-    pizza->add(new Topping(5.00, "Tomato Sauce"));
-    pizza->add(new Topping(15.00, "Cheese"));
-    order.addPizza(new BasePizza(pizza));
+    pizza->add(makePizza<Topping>(Money(10.00), "Dough"));
+    pizza->add(makePizza<Topping>(Money(5.00), "Tomato Sauce"));
+    pizza->add(makePizza<Topping>(Money(15.00), "Cheese"));
+    order.addPizza(makePizza<BasePizza>(PizzaPtr(pizza)));
     
     // Manually set to Preparing state
     order.setState(new Preparing());
@@ -373,19 +440,1364 @@ void testMenuPizzaRemoval() {
     pizzaMenu.addObserver(&customer);
     specialsMenu.addObserver(&customer);
     
-    Pizza* pizza1 = PizzaFactory::createPepperoniPizza();
-    Pizza* pizza2 = PizzaFactory::createVegetarianPizza();
+    PizzaPtr pizza1 = PizzaFactory::createPepperoniPizza();
+    PizzaPtr pizza2 = PizzaFactory::createVegetarianPizza();
     
     std::cout << "Adding pizzas to menus:\n";
-    pizzaMenu.addPizza(pizza1);
-    specialsMenu.addPizza(pizza2);
+    pizzaMenu.addPizza(pizza1.get());
+    specialsMenu.addPizza(pizza2.get());
     
     std::cout << "\nRemoving pizzas from menus:\n";
-    pizzaMenu.removePizza(pizza1);
-    specialsMenu.removePizza(pizza2);
+    pizzaMenu.removePizza(pizza1.get());
+    specialsMenu.removePizza(pizza2.get());
+}
+
+void testFlattenedPizzaRecord() {
+    std::cout << "\n=== Testing Flattened Pizza Record ===\n";
+    
+    PizzaPtr pizza = PizzaFactory::addStuffedCrust(PizzaFactory::addExtraCheese(PizzaFactory::createMeatLoversPizza()));
+    PizzaRecord record = PizzaRecord::compile(pizza.get());
+    
+    std::cout << "Tree price: R" << pizza->getPrice() << ", record price: R" << record.getPrice() << std::endl;
+    std::cout << "Toppings (" << record.toppingIds.size() << "):";
+    for (size_t i = 0; i < record.toppingIds.size(); i++) {
+        std::cout << " " << record.toppingName(i) << "=R" << record.toppingPrices[i];
+    }
+    std::cout << "\nSurcharges: " << record.surcharges.size() << std::endl;
+    
+    // Hand-built toppings stay out of the shared catalog
+    size_t catalogBefore = ToppingCatalog::instance().size();
+    ToppingGroup custom("Custom");
+    custom.add(makePizza<Topping>(Money(9.00), "Truffle Oil"));
+    custom.add(makePizza<Topping>(Money(9.00), "Truffle Oil"));
+    custom.add(makePizza<Topping>(Money(4.00), "Basil"));
+    PizzaRecord customRecord = PizzaRecord::compile(&custom);
+    bool localIds = ToppingCatalog::instance().size() == catalogBefore && customRecord.unlistedNames.size() == 2
+                    && customRecord.toppingIds[0] == customRecord.toppingIds[1] && customRecord.toppingName(2) == "Basil"
+                    && customRecord.getPrice() == custom.getPrice();
+    std::cout << (localIds ? "✅" : "❌") << " Uncatalogued toppings get record-local ids, catalog unchanged" << std::endl;
+    
+    if (record.getPrice() == pizza->getPrice()) {
+        std::cout << "✅ Record price matches tree price\n";
+    } else {
+        std::cout << "❌ Record price differs from tree price\n";
+    }
+    
+    // Orders price from their compiled records
+    PlaceOrder order;
+    order.addPizza(std::move(pizza));
+    order.addPizza(PizzaFactory::createVegetarianDeluxePizza());
+    std::cout << "Order total from records: R" << order.calculateTotal() << std::endl;
+}
+
+void testOrderArena() {
+    std::cout << "\n=== Testing Order Arena ===\n";
+    
+    PlaceOrder order;
+    {
+        PizzaArena::Scope scope(order.getArena());
+        order.addPizza(PizzaFactory::createMeatLoversPizza());
+        order.addPizza(PizzaFactory::addExtraCheese(PizzaFactory::createPepperoniPizza()));
+    }
+    
+    // Built outside the scope, so this one comes from the normal heap
+    order.addPizza(PizzaFactory::createVegetarianPizza());
+    
+    std::cout << "Arena bytes in use: " << order.getArena().bytesUsed() << std::endl;
+    std::cout << "Order total: R" << order.calculateTotal() << std::endl;
+    
+    order.clearOrder();
+    std::cout << "Arena bytes after clearOrder: " << order.getArena().bytesUsed() << std::endl;
+}
+
+void testToppingCatalog() {
+    std::cout << "\n=== Testing Topping Catalog ===\n";
+    
+    ToppingCatalog& catalog = ToppingCatalog::instance();
+    Topping* cheese = catalog.get("Cheese", Money(15.00));
+    Topping* sameCheese = catalog.get("Cheese", Money(15.00));
+    Topping* feta = catalog.get("Feta Cheese", Money(18.00));
+    
+    std::cout << "Cheese id: " << cheese->getId() << ", Feta Cheese id: " << feta->getId() << std::endl;
+    std::cout << "Same instance for repeated lookups: " << (cheese == sameCheese ? "yes" : "no") << std::endl;
+    std::cout << "Cheese == Feta Cheese by id: " << (cheese->getId() == feta->getId() ? "yes" : "no") << std::endl;
+    
+    // Factory pizzas share catalog toppings, so deleting them leaves the catalog intact
+    PizzaPtr first = PizzaFactory::createPepperoniPizza();
+    PizzaPtr second = PizzaFactory::createMeatLoversPizza();
+    size_t catalogSize = catalog.size();
+    first.reset();
+    second.reset();
+    std::cout << "Catalog entries still available after deleting pizzas: " << catalogSize << std::endl;
+    std::cout << "Cheese after deletes: " << catalog.get(cheese->getId())->getName() << " - R" << cheese->getPrice() << std::endl;
+    
+    // Standalone toppings remain owned by their group
+    ToppingGroup custom("Custom");
+    custom.add(PizzaPtr(catalog.get("Dough", Money(10.00))));
+    custom.add(makePizza<Topping>(Money(30.00), "Truffle"));
+    std::cout << "Mixed group: " << custom.getName() << " - R" << custom.getPrice() << std::endl;
+}
+
+void testCachedPizzaNames() {
+    std::cout << "\n=== Testing Cached Pizza Names ===\n";
+    
+    ToppingGroup* group = new ToppingGroup("Build Your Own");
+    group->add(makePizza<Topping>(Money(10.00), "Dough"));
+    PizzaPtr pizza = makePizza<ExtraCheese>(makePizza<BasePizza>(PizzaPtr(group)));
+    
+    std::cout << "Before add: " << pizza->getName() << std::endl;
+    
+    // Mutating the inner group must invalidate the decorator's cached label
+    group->add(makePizza<Topping>(Money(15.00), "Cheese"));
+    std::cout << "After add: " << pizza->getName() << std::endl;
+    
+    std::string label;
+    pizza->appendName(label);
+    std::cout << "appendName: " << label << std::endl;
+    
+    std::cout << "writeName: ";
+    pizza->writeName(std::cout);
+    std::cout << std::endl;
+
+    // A finished pizza may be listed on several menus at once
+    PizzaPtr shared = PizzaFactory::addStuffedCrust(PizzaFactory::createMenuPizza<MenuRecipes::Pepperoni>());
+    PizzaMenu menus[2];
+    std::string seen[2];
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 2; t++) {
+        threads.emplace_back([&shared, &menus, &seen, t] {
+            menus[t].addPizza(shared.get());
+            for (int i = 0; i < 1000; i++) {
+                seen[t] = shared->getName();
+            }
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    std::cout << (seen[0] == seen[1] && seen[0] == shared->getName() && menus[1].findPizza(seen[0]) == shared.get()
+                  ? "✅ Shared pizza named consistently across threads\n" : "❌ Shared pizza names diverged\n");
+}
+
+// Fails every batched reprice it is handed
+class FailingDiscount : public DiscountStrategy {
+public:
+    using DiscountStrategy::applyDiscount;
+    Money applyDiscount(Money) override { throw std::runtime_error("FailingDiscount: price order: always fails"); }
+    void applyDiscount(PlaceOrder* const*, const Money*, Money*, std::size_t) override {
+        throw std::runtime_error("FailingDiscount: price batch: always fails");
+    }
+    std::string getStrategyName() override { return "Failing"; }
+};
+
+void testBatchPricing() {
+    std::cout << "\n=== Testing Batch Pricing ===\n";
+    
+    std::vector<PlaceOrder*> orders;
+    for (int i = 0; i < 100; i++) {
+        PlaceOrder* order = new PlaceOrder();
+        order->addPizza(PizzaFactory::createPepperoniPizza());
+        if (i % 2 == 0) order->addPizza(PizzaFactory::addExtraCheese(PizzaFactory::createMeatLoversPizza()));
+        if (i % 3 == 1) order->setDiscountStrategy(new BulkDiscount());
+        if (i % 3 == 2) order->setDiscountStrategy(new FamilyDiscount());
+        orders.push_back(order);
+    }
+    
+    WorkStealingPool pool(4);
+    BatchPricer pricer(pool, 8);
+    std::vector<Money> totals = pricer.priceOrders(orders);
+    
+    int mismatches = 0;
+    Money sum;
+    for (size_t i = 0; i < orders.size(); i++) {
+        if (totals[i] != orders[i]->getTotal()) mismatches++;
+        sum += totals[i];
+    }
+    std::cout << "Priced " << totals.size() << " orders on " << pool.size() << " threads, combined total: R" << sum << std::endl;
+    std::cout << (mismatches == 0 ? "✅ Batch totals match serial totals\n" : "❌ Batch totals differ from serial totals\n");
+    
+    // Batches sharing a pool wait only for their own tasks and failures
+    FailingDiscount failing;
+    int failures = 0;
+    int cleanRuns = 0;
+    std::thread failer([&pricer, &orders, &failing, &failures] {
+        for (int round = 0; round < 20; round++) {
+            std::vector<Money> scratch(orders.size());
+            try {
+                pricer.repriceWith(orders.data(), orders.size(), failing, scratch.data());
+            } catch (const std::runtime_error&) {
+                failures++;
+            }
+        }
+    });
+    for (int round = 0; round < 20; round++) {
+        try {
+            if (pricer.priceOrders(orders) == totals) cleanRuns++;
+        } catch (const std::runtime_error&) {
+        }
+    }
+    failer.join();
     
-    delete pizza1;
-    delete pizza2;
+    // A task may price a batch of its own on the same pool
+    WorkStealingPool::Batch outer;
+    std::vector<std::vector<Money>> nested(8);
+    for (auto& slot : nested) {
+        pool.submit(outer, [&pricer, &orders, &slot] { slot = pricer.priceOrders(orders); });
+    }
+    pool.wait(outer);
+    long nestedMatches = std::count(nested.begin(), nested.end(), totals);
+    std::cout << "Failing batches: " << failures << "/20, clean batches: " << cleanRuns << "/20, nested batches: "
+              << nestedMatches << "/8" << std::endl;
+    std::cout << (failures == 20 && cleanRuns == 20 && nestedMatches == 8
+                  ? "✅ Concurrent and nested batches stay independent\n" : "❌ Batches interfered with each other\n");
+    
+    for (auto order : orders) {
+        delete order;
+    }
+}
+
+void testBatchedDiscounts() {
+    std::cout << "\n=== Testing Batched Discounts ===\n";
+    
+    // Odd length so the vector kernels also exercise their scalar tail
+    std::vector<Money> prices;
+    for (int i = 0; i < 37; i++) {
+        prices.push_back(Money(50.0 + i * 7.25));
+    }
+    std::vector<Money> discounted(prices.size());
+    
+    RegularPrice regular;
+    BulkDiscount bulk;
+    FamilyDiscount family;
+    DiscountStrategy* strategies[] = {&regular, &bulk, &family};
+    
+    for (auto strategy : strategies) {
+        strategy->applyDiscount(prices.data(), discounted.data(), prices.size());
+        int mismatches = 0;
+        for (size_t i = 0; i < prices.size(); i++) {
+            if (discounted[i] != strategy->applyDiscount(prices[i])) mismatches++;
+        }
+        std::cout << strategy->getStrategyName() << ": first R" << discounted[0] << ", last R" << discounted.back()
+                  << (mismatches == 0 ? " ✅ matches scalar" : " ❌ differs from scalar") << std::endl;
+    }
+
+    // Packed kernel against Money::scaledBy on awkward amounts: negatives,
+    // exact half-cent ties, and amounts too large for the packed lanes
+    std::vector<Money> awkward;
+    std::mt19937_64 rng(18);
+    for (int i = 0; i < 301; i++) {
+        std::int64_t cents;
+        switch (i % 5) {
+            case 0: cents = static_cast<std::int64_t>(rng() % 2000000) - 1000000; break;
+            case 1: cents = (static_cast<std::int64_t>(rng() % 20000) - 10000) * 10 + 5; break;
+            case 2: cents = static_cast<std::int64_t>(rng() >> 20) - (std::int64_t(1) << 43); break;
+            case 3: cents = i < 150 ? 50 : static_cast<std::int64_t>(rng() % 90000000000000000ULL) - 45000000000000000LL; break;
+            default: cents = i * 20 + 10; break;
+        }
+        awkward.push_back(Money::fromCents(cents));
+    }
+    int exactMismatches = 0;
+    for (std::size_t length : {1u, 3u, 63u, 65u, 129u, 301u}) {
+        std::vector<Money> out(length);
+        bulk.applyDiscount(awkward.data(), out.data(), length);
+        for (std::size_t i = 0; i < length; i++) {
+            if (out[i] != awkward[i].scaledBy(90, 100)) exactMismatches++;
+        }
+        family.applyDiscount(awkward.data(), out.data(), length);
+        for (std::size_t i = 0; i < length; i++) {
+            if (out[i] != awkward[i].scaledBy(85, 100)) exactMismatches++;
+        }
+    }
+    std::cout << "Packed kernels vs scaledBy: " << exactMismatches << " mismatches"
+              << (exactMismatches == 0 ? " ✅" : " ❌") << std::endl;
+
+    // Repricing a batch of orders under one promo
+    std::vector<PlaceOrder*> orders;
+    for (int i = 0; i < 10; i++) {
+        PlaceOrder* order = new PlaceOrder();
+        order->addPizza(PizzaFactory::createVegetarianPizza());
+        orders.push_back(order);
+    }
+    WorkStealingPool pool(2);
+    BatchPricer pricer(pool, 3);
+    std::vector<Money> totals(orders.size());
+    pricer.repriceWith(orders.data(), orders.size(), family, totals.data());
+    std::cout << "Repriced " << totals.size() << " orders with family discount: R" << totals[0] << " each" << std::endl;
+    
+    for (auto order : orders) {
+        delete order;
+    }
+}
+
+void testCompileTimeRecipes() {
+    std::cout << "\n=== Testing Compile-Time Recipes ===\n";
+    
+    static_assert(MenuRecipes::Pepperoni.basePrice() == Money(50.00), "Pepperoni base price");
+    static_assert(MenuRecipes::MeatLovers.basePrice() == Money(97.00), "Meat Lovers base price");
+    static_assert(MenuRecipes::VegetarianDeluxe.size() == 8, "Vegetarian Deluxe topping count");
+    
+    PizzaPtr fromRecipe = PizzaFactory::createMenuPizza<MenuRecipes::MeatLovers>();
+    PizzaPtr fromTree = PizzaFactory::createMeatLoversPizza();
+    std::cout << "Recipe pizza: " << fromRecipe->getName() << " - R" << fromRecipe->getPrice() << std::endl;
+    std::cout << "Tree pizza:   " << fromTree->getName() << " - R" << fromTree->getPrice() << std::endl;
+    std::cout << ((fromRecipe->getName() == fromTree->getName() && fromRecipe->getPrice() == fromTree->getPrice())
+                  ? "✅ Recipe pizza matches factory tree\n" : "❌ Recipe pizza differs from factory tree\n");
+    
+    // Recipe pizzas decorate and price in orders like any other Pizza
+    PlaceOrder order;
+    order.addPizza(PizzaFactory::addStuffedCrust(PizzaFactory::createMenuPizza<MenuRecipes::Pepperoni>()));
+    order.addPizza(std::move(fromRecipe));
+    std::cout << "Order with recipe pizzas: R" << order.calculateTotal() << std::endl;
+}
+
+// Refuses every update
+class ThrowingObserver : public Observer {
+public:
+    void update(const std::string&) override { throw std::runtime_error("ThrowingObserver: update: always fails"); }
+};
+
+void testAsyncNotifications() {
+    std::cout << "\n=== Testing Async Notifications ===\n";
+    
+    std::vector<CountingObserver> observers(200);
+    NotificationDispatcher dispatcher(2, 64);
+    
+    PizzaMenu menu;
+    SpecialsMenu specials;
+    for (auto& observer : observers) {
+        menu.addObserver(&observer);
+        specials.addObserver(&observer);
+    }
+    menu.setDispatcher(&dispatcher);
+    specials.setDispatcher(&dispatcher);
+    
+    PizzaPtr pepperoni = PizzaFactory::createPepperoniPizza();
+    PizzaPtr vegetarian = PizzaFactory::createVegetarianPizza();
+    PizzaPtr special = PizzaFactory::createMenuPizza<MenuRecipes::MeatLovers>();
+    menu.addPizza(pepperoni.get());
+    menu.addPizza(vegetarian.get());
+    menu.removePizza(pepperoni.get());
+    specials.addPizza(special.get());
+    
+    dispatcher.flush();
+    
+    int total = 0;
+    for (auto& observer : observers) {
+        total += observer.count;
+    }
+    std::cout << "Events delivered: " << dispatcher.getEventsDelivered()
+              << ", notifications received: " << total << std::endl;
+    std::cout << "Last message seen by first observer: " << observers[0].getLastMessage() << std::endl;
+    std::cout << (total == 4 * 200 ? "✅ Every observer received every event\n" : "❌ Notifications were lost\n");
+    
+    // Back to synchronous delivery
+    menu.setDispatcher(nullptr);
+    menu.removePizza(vegetarian.get());
+    std::cout << "Synchronous delivery after switching back: " << observers[0].count << " notifications\n";
+    
+    // A throwing observer is reported, and observers in other chunks still hear every event
+    ThrowingObserver thrower;
+    CountingObserver bystander;
+    NotificationDispatcher reporting(2, 1);
+    PizzaMenu watched;
+    watched.addObserver(&thrower);
+    watched.addObserver(&bystander);
+    watched.setDispatcher(&reporting);
+    watched.addPizza(pepperoni.get());
+    reporting.flush();
+    watched.removePizza(pepperoni.get());
+    reporting.flush();
+    std::cout << "Failed deliveries: " << reporting.getFailedDeliveries() << ", bystander notifications: " << bystander.count << std::endl;
+    std::cout << (reporting.getFailedDeliveries() == 2 && bystander.count == 2
+                  ? "✅ Observer failures are counted, not swallowed\n" : "❌ Observer failures went unreported\n");
+}
+
+void testConcurrentMenus() {
+    std::cout << "\n=== Testing Concurrent Menus (16 threads) ===\n";
+    
+    const int threadCount = 16;
+    const int rounds = 200;
+    
+    PizzaMenu menu;
+    SpecialsMenu specials;
+    CountingObserver resident;
+    menu.addObserver(&resident);
+    specials.addObserver(&resident);
+    
+    std::vector<std::thread> threads;
+    for (int t = 0; t < threadCount; t++) {
+        threads.emplace_back([&menu, &specials, rounds] {
+            CountingObserver visitor;
+            PizzaPtr pizza = PizzaFactory::createMenuPizza<MenuRecipes::Vegetarian>();
+            PizzaPtr special = PizzaFactory::createMenuPizza<MenuRecipes::MeatLovers>();
+            for (int i = 0; i < rounds; i++) {
+                menu.addObserver(&visitor);
+                specials.addObserver(&visitor);
+                menu.addPizza(pizza.get());
+                specials.addPizza(special.get());
+                menu.removePizza(pizza.get());
+                specials.removePizza(special.get());
+                menu.removeObserver(&visitor);
+                specials.removeObserver(&visitor);
+            }
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    
+    int expected = threadCount * rounds * 4;
+    std::cout << "Resident observer notifications: " << resident.count << " (expected " << expected << ")\n";
+    std::cout << "Pizzas left: " << menu.getPizzaCount() + specials.getPizzaCount()
+              << ", observers left: " << menu.getObserverCount() + specials.getObserverCount() << std::endl;
+    std::cout << ((resident.count == expected && menu.getPizzaCount() == 0 && specials.getObserverCount() == 1)
+                  ? "✅ Menus stayed consistent under concurrent edits\n" : "❌ Menus lost updates under concurrent edits\n");
+}
+
+void testMenuLookup() {
+    std::cout << "\n=== Testing Indexed Menu Lookup ===\n";
+    
+    CountingObserver observer;
+    PizzaMenu menu;
+    menu.addObserver(&observer);
+    
+    PizzaPtr pepperoni = PizzaFactory::createPepperoniPizza();
+    PizzaPtr vegetarian = PizzaFactory::createVegetarianPizza();
+    PizzaPtr meatLovers = PizzaFactory::createMeatLoversPizza();
+    menu.addPizza(pepperoni.get());
+    menu.addPizza(vegetarian.get());
+    menu.addPizza(meatLovers.get());
+    menu.addPizza(vegetarian.get()); // already listed, no second entry or notification
+    
+    std::size_t vegetarianId = menu.getPizzaId(vegetarian.get());
+    std::cout << "Pizzas on menu: " << menu.getPizzaCount() << ", notifications: " << observer.count << std::endl;
+    std::cout << "Vegetarian id: " << vegetarianId << ", found by id: "
+              << (menu.findPizza(vegetarianId) == vegetarian.get() ? "yes" : "no") << std::endl;
+    std::cout << "Found by name: " << (menu.findPizza(meatLovers->getName()) == meatLovers.get() ? "yes" : "no") << std::endl;
+    
+    menu.removePizza(vegetarian.get());
+    std::cout << "After removing Vegetarian - pizzas: " << menu.getPizzaCount()
+              << ", id lookup: " << (menu.findPizza(vegetarianId) == nullptr ? "gone" : "still there")
+              << ", Meat Lovers id unchanged: " << (menu.findPizza(menu.getPizzaId(meatLovers.get())) == meatLovers.get() ? "yes" : "no") << std::endl;
+    std::cout << "Last notification: " << observer.getLastMessage() << std::endl;
+}
+
+void testKitchenScheduler() {
+    std::cout << "\n=== Testing Kitchen Scheduler ===\n";
+    
+    KitchenMetrics metrics;
+    {
+        Kitchen kitchen(2, 4);
+        for (unsigned int i = 1; i <= 12; i++) {
+            PlaceOrder* order = new PlaceOrder();
+            order->addPizza(PizzaFactory::createMenuPizza<MenuRecipes::Pepperoni>());
+            order->setRandomSeed(i * 2654435761u);
+            kitchen.submit(order);
+        }
+        kitchen.drain();
+        metrics = kitchen.getMetrics();
+        
+        int ready = 0;
+        for (auto order : kitchen.getReadyOrders()) {
+            if (order->getStatus() == "READY") ready++;
+        }
+        std::cout << "\nOrders submitted: " << metrics.submitted << ", completed: " << metrics.completed
+                  << ", READY: " << ready << std::endl;
+    }
+    
+    std::cout << "Transitions: " << metrics.transitions << ", Preparing->Pending retries: " << metrics.retries << std::endl;
+    std::cout << "Max queue depth (started/pending/preparing): " << metrics.maxQueueDepth[0] << "/"
+              << metrics.maxQueueDepth[1] << "/" << metrics.maxQueueDepth[2] << std::endl;
+    std::cout << (metrics.completed == 12 && metrics.transitions == 36 + 2 * metrics.retries
+                  ? "✅ Every order reached READY\n" : "❌ Kitchen lost orders\n");
+
+    // Unseeded orders roll on each oven thread's own generator
+    KitchenMetrics unseeded;
+    {
+        Kitchen kitchen(3, 4);
+        for (int i = 0; i < 12; i++) {
+            PlaceOrder* order = new PlaceOrder();
+            order->addPizza(PizzaFactory::createMenuPizza<MenuRecipes::Pepperoni>());
+            kitchen.submit(order);
+        }
+        kitchen.drain();
+        unseeded = kitchen.getMetrics();
+    }
+    std::cout << (unseeded.completed == 12 && unseeded.transitions == 36 + 2 * unseeded.retries
+                  ? "✅ Unseeded orders reached READY\n" : "❌ Unseeded orders were lost\n");
+}
+
+void testSharedOrderStates() {
+    std::cout << "\n=== Testing Shared Order States ===\n";
+    
+    std::cout << "Shared instances: " << (Pending::instance() == Pending::instance() ? "yes" : "no")
+              << ", shared flag: " << (Ready::instance()->isShared() ? "set" : "missing") << std::endl;
+    
+    // Heap-allocated phases are still accepted and owned by the order
+    PlaceOrder order;
+    order.setRandomSeed(7);
+    order.setState(new Preparing());
+    while (order.getStatus() != "READY") {
+        order.processOrder();
+    }
+    order.setState(OrderStarted::instance());
+    std::cout << "Back to: " << order.getStatus() << std::endl;
+}
+
+void testEventSinks() {
+    std::cout << "\n=== Testing Event Sinks ===\n";
+    
+    std::ostringstream captured;
+    {
+        AsyncSink asyncSink(captured);
+        EventLog::setSink(&asyncSink);
+        
+        PlaceOrder order;
+        order.setRandomSeed(3);
+        while (order.getStatus() != "READY") {
+            order.processOrder();
+        }
+        asyncSink.flush();
+        EventLog::setSink(nullptr);
+    }
+    
+    std::string firstLine = captured.str().substr(0, captured.str().find('\n'));
+    std::cout << "AsyncSink captured first line: " << firstLine << std::endl;
+    
+    // Warnings only: routine state changes are filtered before formatting
+    std::ostringstream warnings;
+    {
+        AsyncSink asyncSink(warnings);
+        EventLog::setSink(&asyncSink);
+        EventLog::setLevel(LOG_WARNING);
+        PlaceOrder order;
+        order.setRandomSeed(5);
+        order.processOrder();
+        asyncSink.flush();
+        EventLog::setLevel(LOG_DEBUG);
+        EventLog::setSink(nullptr);
+    }
+    std::cout << "Info lines kept at LOG_WARNING: " << (warnings.str().find("Order state changed") == std::string::npos ? "none" : "some") << std::endl;
+    
+    // A tiny ring keeps the writer falling asleep and being woken
+    std::ostringstream bursts;
+    {
+        AsyncSink asyncSink(bursts, 16);
+        std::vector<std::thread> producers;
+        for (int t = 0; t < 3; t++) {
+            producers.emplace_back([&asyncSink] {
+                for (int i = 0; i < 20000; i++) {
+                    asyncSink.write(LOG_INFO, "tick");
+                    if (i % 500 == 0) std::this_thread::sleep_for(std::chrono::microseconds(100));
+                }
+            });
+        }
+        for (auto& producer : producers) {
+            producer.join();
+        }
+        asyncSink.flush();
+    }
+    std::string burstText = bursts.str();
+    long burstLines = std::count(burstText.begin(), burstText.end(), '\n');
+    std::cout << "AsyncSink delivered " << burstLines << " of 60000 burst lines"
+              << (burstLines == 60000 ? " ✅" : " ❌") << std::endl;
+    
+    NullSink nullSink;
+    EventLog::setSink(&nullSink);
+    std::cout << "Logging enabled with NullSink: " << (EventLog::enabled(LOG_ERROR) ? "yes" : "no") << std::endl;
+    EventLog::setSink(nullptr);
+    std::cout << "Logging enabled with default sink: " << (EventLog::enabled(LOG_INFO) ? "yes" : "no") << std::endl;
+}
+
+void testBinarySerialization() {
+    std::cout << "\n=== Testing Binary Serialization ===\n";
+    
+    std::vector<PizzaPtr> pizzas;
+    pizzas.push_back(PizzaFactory::createPepperoniPizza());
+    pizzas.push_back(PizzaFactory::createVegetarianDeluxePizza());
+    pizzas.push_back(PizzaFactory::addStuffedCrust(PizzaFactory::addExtraCheese(PizzaFactory::createMeatLoversPizza())));
+    pizzas.push_back(PizzaFactory::addExtraCheese(PizzaFactory::createMenuPizza<MenuRecipes::Vegetarian>()));
+    
+    bool allMatch = true;
+    for (const auto& pizza : pizzas) {
+        std::string bytes;
+        OrderSerializer::writePizza(pizza.get(), bytes);
+        PizzaView view;
+        if (!PizzaView::open(bytes.data(), bytes.size(), view)) {
+            allMatch = false;
+            continue;
+        }
+        PizzaPtr rebuilt = OrderSerializer::readPizza(view);
+        std::string again;
+        OrderSerializer::writePizza(rebuilt.get(), again);
+        bool matches = view.getName() == pizza->getName() && view.getPrice() == pizza->getPrice()
+                       && rebuilt->getName() == pizza->getName() && rebuilt->getPrice() == pizza->getPrice()
+                       && again == bytes;
+        std::cout << pizza->getName() << " (" << bytes.size() << " bytes): " << (matches ? "round-trips" : "differs") << std::endl;
+        allMatch = allMatch && matches;
+    }
+    
+    PlaceOrder order;
+    order.addPizza(PizzaFactory::createPepperoniPizza());
+    order.addPizza(PizzaFactory::addExtraCheese(PizzaFactory::createVegetarianPizza()));
+    order.setDiscountStrategy(new FamilyDiscount());
+    order.setState(Pending::instance());
+    
+    std::string bytes;
+    OrderSerializer::writeOrder(order, bytes);
+    OrderView view;
+    bool opened = OrderView::open(bytes.data(), bytes.size(), view);
+    std::cout << "Order view: " << (opened ? "opened" : "rejected") << ", pizzas: " << (opened ? view.getPizzaCount() : 0)
+              << ", total matches: " << (opened && view.getTotal() == order.calculateTotal() ? "yes" : "no") << std::endl;
+    
+    PlaceOrder restored;
+    bool read = OrderSerializer::readOrder(bytes.data(), bytes.size(), restored);
+    std::cout << "Restored order: " << restored.getPizzaCount() << " pizzas, state " << restored.getStatus()
+              << ", total R" << restored.calculateTotal() << " (original R" << order.calculateTotal() << ")" << std::endl;
+    
+    // Truncated and corrupted buffers are rejected without touching the order
+    std::string truncated = bytes.substr(0, bytes.size() - 3);
+    std::string corrupted = bytes;
+    corrupted[13] = 0x7F;
+    bool rejected = !OrderSerializer::readOrder(truncated.data(), truncated.size(), restored)
+                    && !OrderSerializer::readOrder(corrupted.data(), corrupted.size(), restored)
+                    && restored.getPizzaCount() == 2;
+
+    // Structurally sound buffers still carry untrusted amounts and codes
+    const double dough = 10.00;
+    std::size_t priceAt = bytes.find(std::string(reinterpret_cast<const char*>(&dough), sizeof(dough)));
+    const double badPrices[] = {1e300, -1e300, std::nan(""), HUGE_VAL};
+    for (double badPrice : badPrices) {
+        std::string patched = bytes;
+        std::memcpy(&patched[priceAt], &badPrice, sizeof(badPrice));
+        OrderView patchedView;
+        rejected = rejected && priceAt != std::string::npos && !OrderView::open(patched.data(), patched.size(), patchedView)
+                   && !OrderSerializer::readOrder(patched.data(), patched.size(), restored);
+    }
+    std::string unknownDiscount = bytes;
+    unknownDiscount[6] = 7;
+    OrderView discountView;
+    rejected = rejected && !OrderView::open(unknownDiscount.data(), unknownDiscount.size(), discountView)
+               && restored.getPizzaCount() == 2;
+    std::cout << "Bad amounts and discount codes: " << (rejected ? "rejected" : "accepted") << std::endl;
+
+    std::cout << ((allMatch && read && restored.calculateTotal() == order.calculateTotal() && rejected)
+                  ? "✅ Binary format round-trips pizzas and orders\n" : "❌ Binary format lost information\n");
+}
+
+void testOrderJournal() {
+    std::cout << "\n=== Testing Order Journal ===\n";
+    
+    std::string directory = "pizzashop-journal-test";
+    std::filesystem::remove_all(directory);
+    
+    Money expectedTotal;
+    {
+        // Small segments so the orders span several files
+        OrderJournal journal(directory, 1024);
+        PlaceOrder first;
+        PlaceOrder second;
+        PlaceOrder finished;
+        first.attachJournal(&journal, 1);
+        second.attachJournal(&journal, 2);
+        finished.attachJournal(&journal, 3);
+        
+        first.addPizza(PizzaFactory::createPepperoniPizza());
+        second.addPizza(PizzaFactory::createMeatLoversPizza());
+        first.addPizza(PizzaFactory::addExtraCheese(PizzaFactory::createVegetarianPizza()));
+        first.setDiscountStrategy(new FamilyDiscount());
+        first.setState(Pending::instance());
+        second.clearOrder();
+        second.addPizza(PizzaFactory::createMenuPizza<MenuRecipes::Vegetarian>());
+        finished.addPizza(PizzaFactory::createVegetarianDeluxePizza());
+        journal.closeOrder(3);
+        
+        journal.sync();
+        expectedTotal = first.calculateTotal() + second.calculateTotal();
+        std::cout << "Journaled " << journal.getLastSequence() << " events in " << journal.getSyncCount() << " sync(s)" << std::endl;
+    }
+    
+    std::map<std::uint64_t, std::unique_ptr<PlaceOrder>> orders;
+    JournalRecoveryStats stats = OrderJournal::recover(directory, orders, 2);
+    Money recoveredTotal;
+    for (auto& entry : orders) {
+        recoveredTotal += entry.second->calculateTotal();
+    }
+    std::cout << "Recovered " << stats.openOrders << " open orders from " << stats.events << " events in "
+              << stats.segments << " segments" << std::endl;
+    bool restored = orders.size() == 2 && orders.count(3) == 0 && orders[1]->getPizzaCount() == 2
+                    && orders[1]->getStatus() == "PENDING" && orders[2]->getPizzaCount() == 1
+                    && recoveredTotal == expectedTotal && stats.tornSegments == 0;
+    
+    // A reopened journal keeps numbering and only appends new segments
+    {
+        OrderJournal journal(directory, 1024);
+        std::uint64_t sequence = journal.closeOrder(1);
+        std::cout << "Reopened journal continues at sequence " << sequence << std::endl;
+    }
+    std::map<std::uint64_t, std::unique_ptr<PlaceOrder>> afterClose;
+    OrderJournal::recover(directory, afterClose);
+    
+    // A torn tail loses only the damaged record
+    std::vector<std::filesystem::path> files;
+    for (const auto& entry : std::filesystem::directory_iterator(directory)) {
+        files.push_back(entry.path());
+    }
+    std::sort(files.begin(), files.end());
+    std::filesystem::resize_file(files.back(), std::filesystem::file_size(files.back()) - 3);
+    std::map<std::uint64_t, std::unique_ptr<PlaceOrder>> afterTear;
+    JournalRecoveryStats torn = OrderJournal::recover(directory, afterTear);
+    
+    std::cout << "Open after close: " << afterClose.size() << ", after torn tail: " << afterTear.size()
+              << " (torn segments: " << torn.tornSegments << ")" << std::endl;
+    std::filesystem::remove_all(directory);
+    
+    std::cout << ((restored && afterClose.size() == 1 && afterTear.size() == 2 && torn.tornSegments == 1)
+                  ? "✅ Journal recovered every open order\n" : "❌ Journal recovery lost or resurrected orders\n");
+}
+
+void testOrderIngest() {
+    std::cout << "\n=== Testing Order Ingest ===\n";
+    
+    std::string csv =
+        "order_id,pizzas,discount\r\n"
+        "1,pepperoni+cheese;vegetarian,family\r\n"
+        "2,\"meat-lovers+crust+cheese\",bulk\n"
+        "3,hawaiian,regular\n"
+        "\n"
+        "4,vegetarian-deluxe\n"
+        "5,pepperoni";
+    std::string jsonl =
+        "{\"id\": 1, \"pizzas\": [\"pepperoni+cheese\", \"vegetarian\"], \"discount\": \"family\"}\n"
+        "{\"note\": {\"rush\": [1, 2]}, \"id\": 2, \"pizzas\": [\"meat-lovers+crust+cheese\"], \"discount\": \"bulk\"}\n"
+        "{\"id\": 3, \"pizzas\": []}\n"
+        "{\"id\": 4, \"pizzas\": [\"vegetarian-deluxe\"]}\n"
+        "{\"id\": 5, \"pizzas\": [\"pepperoni\"]}\n";
+    
+    // Reference totals built by hand through the factory
+    PlaceOrder reference;
+    reference.addPizza(PizzaFactory::addExtraCheese(PizzaFactory::createPepperoniPizza()));
+    reference.addPizza(PizzaFactory::createVegetarianPizza());
+    reference.setDiscountStrategy(new FamilyDiscount());
+    Money expected = reference.calculateTotal();
+    PlaceOrder second;
+    second.addPizza(PizzaFactory::addStuffedCrust(PizzaFactory::addExtraCheese(PizzaFactory::createMeatLoversPizza())));
+    second.setDiscountStrategy(new BulkDiscount());
+    PlaceOrder rest;
+    rest.addPizza(PizzaFactory::createVegetarianDeluxePizza());
+    rest.addPizza(PizzaFactory::createPepperoniPizza());
+    expected += second.calculateTotal() + rest.calculateTotal();
+    
+    bool allMatch = true;
+    IngestFormat formats[] = {INGEST_CSV, INGEST_JSONL};
+    const char* names[] = {"CSV", "JSONL"};
+    for (int f = 0; f < 2; f++) {
+        // Tiny chunks and queues so rows straddle reads and stages block on each other
+        OrderIngester ingester(2, 1, 7, 2);
+        std::vector<PlaceOrder*> received;
+        std::mutex receivedMutex;
+        ingester.setSink([&](PlaceOrder* order) {
+            std::lock_guard<std::mutex> lock(receivedMutex);
+            received.push_back(order);
+        });
+        std::istringstream input(f == 0 ? csv : jsonl);
+        IngestStats stats = ingester.ingest(input, formats[f]);
+        
+        std::cout << names[f] << ": " << stats.ordersPriced << " orders, " << stats.pizzasBuilt << " pizzas, "
+                  << stats.malformedRows << " malformed, revenue R" << stats.revenue << " (expected R" << expected << ")" << std::endl;
+        std::cout << "  parse->build: " << stats.parsedQueue.batches << " batches, build->price: "
+                  << stats.builtQueue.batches << " batches" << std::endl;
+        allMatch = allMatch && stats.ordersPriced == 4 && stats.malformedRows == 1 && received.size() == 4
+                   && stats.revenue == expected && stats.bytesRead == (f == 0 ? csv : jsonl).size();
+        for (auto order : received) {
+            delete order;
+        }
+    }
+    
+    std::cout << (allMatch ? "✅ Ingested orders match hand-built ones\n" : "❌ Ingested orders differ from hand-built ones\n");
+
+    // Only a row naming the columns is a header; any other first row is data
+    const char* firstRows[] = {"\"order_id\", \"pizzas\", \"discount\"\n2,pepperoni\n", "\"1\",pepperoni\n2,pepperoni\n",
+                               "+1,pepperoni\n2,pepperoni\n"};
+    const std::size_t expectedRows[][2] = {{1, 0}, {2, 0}, {1, 1}};
+    bool headersRight = true;
+    for (int i = 0; i < 3; i++) {
+        std::istringstream input(firstRows[i]);
+        IngestStats stats = OrderIngester().ingest(input, INGEST_CSV);
+        headersRight = headersRight && stats.ordersPriced == expectedRows[i][0] && stats.malformedRows == expectedRows[i][1];
+    }
+
+    // A sink that throws keeps the order it was handed; the rest are freed
+    std::vector<std::unique_ptr<PlaceOrder>> kept;
+    OrderIngester failing(4, 1, 64, 1);
+    failing.setSink([&kept](PlaceOrder* order) {
+        kept.emplace_back(order);
+        if (kept.size() == 3) throw std::runtime_error("sink: store order: full");
+    });
+    std::istringstream rows("1,pepperoni\n2,pepperoni\n3,pepperoni\n4,pepperoni\n5,pepperoni\n6,pepperoni\n");
+    bool sinkFailureSurfaced = false;
+    try {
+        failing.ingest(rows, INGEST_CSV);
+    } catch (const std::runtime_error&) {
+        sinkFailureSurfaced = true;
+    }
+    std::cout << "Header rows: " << (headersRight ? "only real headers skipped" : "data dropped")
+              << ", failing sink kept " << kept.size() << " orders" << std::endl;
+    std::cout << (headersRight && sinkFailureSurfaced && kept.size() == 3
+                  ? "✅ Ingest skips only real headers and surfaces sink failures\n" : "❌ Ingest dropped rows or hid a sink failure\n");
+}
+
+void testRuleDiscounts() {
+    std::cout << "\n=== Testing Rule-Based Discounts ===\n";
+    
+    std::vector<DiscountRule> rules = {
+        {"Bulk 3+", "", 3, Money(), PERCENT_OFF, 10, false},
+        {"Big order", "", 0, Money(250.00), AMOUNT_OFF, 30, true},
+        {"Pepperoni special", "Pepperoni", 1, Money(), AMOUNT_OFF_EACH, 5, true},
+        {"Mushroom lovers", "Mushrooms", 2, Money(), PERCENT_OFF, 20, false}
+    };
+    RuleDiscount promos(rules);
+    std::cout << promos.getStrategyName() << std::endl;
+    
+    // One pepperoni pizza: only the per-topping special applies
+    PlaceOrder single;
+    single.addPizza(PizzaFactory::createPepperoniPizza());
+    single.setDiscountStrategy(new RuleDiscount(promos));
+    Money singleExpected = single.calculateSubtotal() - Money(5.0);
+    
+    // Three pizzas with two pepperonis: 10% off competes with the stacked R10 (+R30 over R250)
+    PlaceOrder bulk;
+    bulk.addPizza(PizzaFactory::createPepperoniPizza());
+    bulk.addPizza(PizzaFactory::createMenuPizza<MenuRecipes::Pepperoni>());
+    bulk.addPizza(PizzaFactory::createMeatLoversPizza());
+    bulk.setDiscountStrategy(new RuleDiscount(promos));
+    Money bulkSubtotal = bulk.calculateSubtotal();
+    Money bulkStacked = Money(5.0) * 3 + (bulkSubtotal >= Money(250.0) ? Money(30.0) : Money());
+    Money bulkExpected = bulkSubtotal - std::max(bulkSubtotal.scaledBy(10, 100), bulkStacked);
+    
+    // Two mushroom pizzas trigger the 20% topping rule
+    PlaceOrder mushrooms;
+    mushrooms.addPizza(PizzaFactory::createVegetarianPizza());
+    mushrooms.addPizza(PizzaFactory::addExtraCheese(PizzaFactory::createVegetarianDeluxePizza()));
+    mushrooms.setDiscountStrategy(new RuleDiscount(promos));
+    Money mushroomExpected = mushrooms.calculateSubtotal().scaledBy(80, 100);
+    
+    // Hand-built toppings outside the catalog still match rules by name
+    PlaceOrder handMade;
+    ToppingGroup* extraMushrooms = new ToppingGroup("Mushroom Medley");
+    extraMushrooms->add(makePizza<Topping>(Money(12.00), "Mushrooms"));
+    extraMushrooms->add(makePizza<Topping>(Money(13.00), "Mushrooms"));
+    handMade.addPizza(PizzaPtr(extraMushrooms));
+    handMade.setDiscountStrategy(new RuleDiscount(promos));
+    bool handMadeMatches = handMade.calculateTotal() == Money(25.0).scaledBy(80, 100);
+    std::cout << "Hand-made mushrooms: R" << handMade.calculateTotal() << std::endl;
+    
+    std::cout << "Single: R" << single.calculateTotal() << " (expected R" << singleExpected << ")" << std::endl;
+    std::cout << "Bulk: R" << bulk.calculateTotal() << " (expected R" << bulkExpected << ")" << std::endl;
+    std::cout << "Mushrooms: R" << mushrooms.calculateTotal() << " (expected R" << mushroomExpected << ")" << std::endl;
+    
+    // A shared engine through BatchPricer sees each order, not just its subtotal
+    PlaceOrder* batch[] = {&single, &bulk, &mushrooms};
+    Money totals[3];
+    WorkStealingPool pool(2);
+    BatchPricer pricer(pool, 1);
+    pricer.repriceWith(batch, 3, promos, totals);
+    bool batchMatches = totals[0] == single.calculateTotal() && totals[1] == bulk.calculateTotal()
+                        && totals[2] == mushrooms.calculateTotal();
+    
+    bool correct = single.calculateTotal() == singleExpected && bulk.calculateTotal() == bulkExpected
+                   && mushrooms.calculateTotal() == mushroomExpected && promos.applyDiscount(Money(300.0)) == Money(270.0)
+                   && handMadeMatches;
+    std::cout << ((correct && batchMatches) ? "✅ Rule engine picks the best stacked or single discount\n"
+                                            : "❌ Rule engine priced an order wrongly\n");
+}
+
+void testDiscountRoundTrip() {
+    std::cout << "\n=== Testing Discount Round Trip ===\n";
+    
+    // Built-in strategies come back as the same strategy and total
+    DiscountStrategy* builtIns[] = {new RegularPrice(), new BulkDiscount(), new FamilyDiscount()};
+    bool builtInsOk = true;
+    for (auto strategy : builtIns) {
+        PlaceOrder order;
+        order.addPizza(PizzaFactory::createPepperoniPizza());
+        order.setDiscountStrategy(strategy);
+        std::string bytes;
+        OrderSerializer::writeOrder(order, bytes);
+        PlaceOrder copy;
+        bool read = OrderSerializer::readOrder(bytes.data(), bytes.size(), copy);
+        bool same = read && copy.getDiscountStrategy()->getStrategyName() == strategy->getStrategyName()
+                    && copy.calculateTotal() == order.calculateTotal();
+        std::cout << strategy->getStrategyName() << (same ? ": ✅ round-trips" : ": ❌ changed on the way back") << std::endl;
+        builtInsOk = builtInsOk && same;
+    }
+    
+    // A rule table has no code, so writers refuse it instead of losing it
+    std::vector<DiscountRule> rules = {{"Pepperoni special", "Pepperoni", 1, Money(), AMOUNT_OFF_EACH, 5, true}};
+    PlaceOrder promo;
+    promo.addPizza(PizzaFactory::createPepperoniPizza());
+    promo.setDiscountStrategy(new RuleDiscount(rules));
+    std::string bytes;
+    bool writeRefused = false;
+    try {
+        OrderSerializer::writeOrder(promo, bytes);
+    } catch (const std::invalid_argument&) {
+        writeRefused = bytes.empty();
+    }
+    
+    std::string directory = "pizzashop-discount-test";
+    std::filesystem::remove_all(directory);
+    bool journalRefused = false;
+    {
+        OrderJournal journal(directory, 1024);
+        PlaceOrder journaled;
+        journaled.attachJournal(&journal, 1);
+        journaled.setDiscountStrategy(new BulkDiscount());
+        RuleDiscount* custom = new RuleDiscount(rules);
+        try {
+            journaled.setDiscountStrategy(custom);
+        } catch (const std::invalid_argument&) {
+            journalRefused = journaled.getDiscountStrategy()->getStrategyName() == BulkDiscount().getStrategyName();
+            delete custom;
+        }
+    }
+    std::filesystem::remove_all(directory);
+    std::cout << (writeRefused ? "✅" : "❌") << " writeOrder refuses a rule discount" << std::endl;
+    std::cout << (journalRefused ? "✅" : "❌") << " journaled order refuses a rule discount and keeps its strategy" << std::endl;
+    if (!builtInsOk) std::cout << "❌ built-in discounts did not round-trip" << std::endl;
+}
+
+void testMetrics() {
+    std::cout << "\n=== Testing Metrics ===\n";
+    
+    // Time every event so the histogram counts are exact
+    unsigned int sampleEvery = Metrics::getSampleEvery();
+    Metrics::setSampleEvery(1);
+    MetricsSnapshot before = Metrics::snapshot();
+    
+    PlaceOrder order;
+    order.addPizza(PizzaFactory::createPepperoniPizza());
+    order.addPizza(PizzaFactory::createMenuPizza<MenuRecipes::Vegetarian>());
+    order.setRandomSeed(7);
+    while (order.getStatus() != "READY") {
+        order.processOrder();
+    }
+    
+    CountingObserver first, second;
+    PizzaMenu menu;
+    menu.addObserver(&first);
+    menu.addObserver(&second);
+    PizzaPtr special = PizzaFactory::createMeatLoversPizza();
+    menu.addPizza(special.get());
+    menu.removePizza(special.get());
+    
+    // Threads that have exited still count
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 4; t++) {
+        threads.emplace_back([] {
+            for (int i = 0; i < 1000; i++) {
+                Metrics::add(METRIC_ORDER_STEPS);
+            }
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    
+    MetricsSnapshot after = Metrics::snapshot();
+    Metrics::setSampleEvery(sampleEvery);
+    auto delta = [&](MetricCounter counter) { return after.counter(counter) - before.counter(counter); };
+    std::uint64_t retries = delta(METRIC_PREPARING_RETRIES);
+    std::uint64_t preparingVisits = after.histogram(METRIC_PREPARING_NS).count - before.histogram(METRIC_PREPARING_NS).count;
+    std::cout << "Orders created: " << delta(METRIC_ORDERS_CREATED) << ", pizzas: " << delta(METRIC_PIZZAS_ORDERED)
+              << ", ready: " << delta(METRIC_ORDERS_READY) << ", Preparing visits: " << preparingVisits << std::endl;
+    std::cout << "Menu adds/removals: " << delta(METRIC_MENU_PIZZAS_ADDED) << "/" << delta(METRIC_MENU_PIZZAS_REMOVED)
+              << ", notifications: " << delta(METRIC_NOTIFICATIONS) << ", observer updates: " << delta(METRIC_OBSERVER_UPDATES)
+              << std::endl;
+    
+#ifdef PIZZASHOP_NO_METRICS
+    std::cout << "Metrics compiled out\n";
+#else
+    bool correct = delta(METRIC_ORDERS_CREATED) == 1 && delta(METRIC_PIZZAS_ORDERED) == 2 && delta(METRIC_ORDERS_READY) == 1
+                   && preparingVisits == retries + 1 && delta(METRIC_STATE_CHANGES) == 3 + 2 * retries
+                   && delta(METRIC_ORDER_STEPS) == 3 + 2 * retries + 4000 && delta(METRIC_NOTIFICATIONS) == 2
+                   && delta(METRIC_OBSERVER_UPDATES) == 4 && delta(METRIC_MENU_PIZZAS_ADDED) == 1;
+    std::cout << (correct ? "✅ Counters match the events recorded\n" : "❌ Counters missed events\n");
+#endif
+    
+    // Bucket bounds stay within one sub-bucket of the recorded value
+    bool bucketsTight = true;
+    std::uint64_t samples[] = {0, 7, 8, 9, 1000, 123456789, ~std::uint64_t(0)};
+    for (std::uint64_t value : samples) {
+        std::uint64_t bound = Metrics::bucketUpperBound(Metrics::bucketOf(value));
+        bucketsTight = bucketsTight && bound >= value && bound - value <= value / 8;
+    }
+    std::cout << (bucketsTight ? "✅ Histogram buckets bound values within 12.5%\n" : "❌ Histogram bucket bounds are off\n");
+    
+    std::ostringstream text;
+    after.writeText(text);
+    std::cout << "Text export has orders_created: "
+              << (text.str().find("pizzashop_orders_created_total ") != std::string::npos ? "yes" : "no")
+              << ", preparing p99: " << (text.str().find("pizzashop_preparing_ns{quantile=\"0.99\"}") != std::string::npos ? "yes" : "no")
+              << std::endl;
+}
+
+void testInlineAddOns() {
+    std::cout << "\n=== Testing Inline Add-On Stacks ===\n";
+    
+    // Depth 10 spills past one node's capacity into a nested stack
+    bool allMatch = true;
+    for (std::size_t depth : {1, 2, 5, 8, 10}) {
+        PizzaPtr chain = PizzaFactory::createVegetarianPizza();
+        PizzaPtr stack = PizzaFactory::createVegetarianPizza();
+        for (std::size_t i = 0; i < depth; i++) {
+            if (i % 3 == 1) {
+                chain = makePizza<StuffedCrust>(std::move(chain));
+                stack = PizzaFactory::addStuffedCrust(std::move(stack));
+            } else {
+                chain = makePizza<ExtraCheese>(std::move(chain));
+                stack = PizzaFactory::addExtraCheese(std::move(stack));
+            }
+        }
+        std::string chainBytes, stackBytes;
+        OrderSerializer::writePizza(chain.get(), chainBytes);
+        OrderSerializer::writePizza(stack.get(), stackBytes);
+        bool matches = stack->getName() == chain->getName() && stack->getPrice() == chain->getPrice()
+                       && PizzaRecord::compile(stack.get()).getPrice() == chain->getPrice()
+                       && stackBytes == chainBytes;
+        std::cout << "Depth " << depth << ": R" << stack->getPrice() << (matches ? " matches" : " DIFFERS")
+                  << " the decorator chain" << std::endl;
+        allMatch = allMatch && matches;
+    }
+    
+    PizzaPtr pizza = PizzaFactory::addExtraCheese(PizzaFactory::createPepperoniPizza());
+    std::string before = pizza->getName();
+    Pizza* node = pizza.get();
+    pizza = PizzaFactory::addStuffedCrust(std::move(pizza));
+    AddOnPizza* stack = dynamic_cast<AddOnPizza*>(pizza.get());
+    bool inPlace = pizza.get() == node && stack != nullptr && stack->size() == 2
+                   && pizza->getName() == before + " with Stuffed Crust";
+    std::cout << (allMatch && inPlace ? "✅ Add-on stacks grow in place and match decorator chains\n"
+                                      : "❌ Add-on stacks diverge from decorator chains\n");
+}
+
+// Counts lines instead of printing them
+class CountingSink : public EventSink {
+public:
+    std::atomic<int> lines;
+    
+    CountingSink() : lines(0) {}
+    void write(LogLevel, std::string) override { lines++; }
+};
+
+void testOrderService() {
+    std::cout << "\n=== Testing Sharded Order Service ===\n";
+    
+    // Shard workers never touch the installed sink
+    CountingSink installed;
+    CountingSink shardLog;
+    EventLog::setSink(&installed);
+    {
+        OrderService logged(2, &shardLog);
+        OrderService quiet(2);
+        for (OrderService* service : {&logged, &quiet}) {
+            std::uint64_t order = service->call(ServiceRequest{SERVICE_CREATE_ORDER, 0, 0, 0, 3, 0}).orderId;
+            service->call(ServiceRequest{SERVICE_ADD_PIZZA, INGEST_PEPPERONI, 0, 0, 3, order});
+            service->call(ServiceRequest{SERVICE_ADVANCE, 0, 0, 0, 3, order});
+        }
+    }
+    EventLog::setSink(nullptr);
+    std::cout << "Shard log lines: " << shardLog.lines << ", installed sink lines: " << installed.lines << std::endl;
+    bool correct = shardLog.lines > 0 && installed.lines == 0;
+    
+    NullSink nullSink;
+    EventLog::setSink(&nullSink);
+    {
+        OrderService service(3);
+        
+        // In process: the service prices an order like a local PlaceOrder
+        ServiceResponse created = service.call(ServiceRequest{SERVICE_CREATE_ORDER, 0, 0, 0, 7, 0});
+        std::uint64_t id = created.orderId;
+        service.call(ServiceRequest{SERVICE_ADD_PIZZA, INGEST_PEPPERONI, SERVICE_EXTRA_CHEESE, 0, 7, id});
+        service.call(ServiceRequest{SERVICE_ADD_PIZZA, INGEST_VEGETARIAN, 0, 0, 7, id});
+        ServiceResponse priced = service.call(ServiceRequest{SERVICE_SET_DISCOUNT, 0, 0, DISCOUNT_FAMILY, 7, id});
+        PlaceOrder local;
+        local.addPizza(PizzaFactory::addExtraCheese(PizzaFactory::createPepperoniPizza()));
+        local.addPizza(PizzaFactory::createVegetarianPizza());
+        local.setDiscountStrategy(new FamilyDiscount());
+        std::cout << "Store 7 order " << id << " on shard " << service.shardOf(7) << ": " << priced.pizzaCount
+                  << " pizzas, R" << priced.total << " (local R" << local.getTotal() << ")" << std::endl;
+        correct = correct && created.status == SERVICE_OK && priced.status == SERVICE_OK
+                  && priced.pizzaCount == 2 && priced.total == local.getTotal();
+        
+        ServiceResponse step = service.call(ServiceRequest{SERVICE_GET_ORDER, 0, 0, 0, 7, id});
+        for (int i = 0; i < 100 && step.phase != PHASE_READY; i++) {
+            step = service.call(ServiceRequest{SERVICE_ADVANCE, 0, 0, 0, 7, id});
+        }
+        correct = correct && step.phase == PHASE_READY;
+        
+        // Menus are per store; orders only answer to their own store
+        service.call(ServiceRequest{SERVICE_UNLIST_RECIPE, INGEST_VEGETARIAN, 0, 0, 7, 0});
+        ServiceResponse unlisted = service.call(ServiceRequest{SERVICE_ADD_PIZZA, INGEST_VEGETARIAN, 0, 0, 7, id});
+        ServiceResponse other = service.call(ServiceRequest{SERVICE_CREATE_ORDER, 0, 0, 0, 8, 0});
+        ServiceResponse elsewhere = service.call(ServiceRequest{SERVICE_ADD_PIZZA, INGEST_VEGETARIAN, 0, 0, 8, other.orderId});
+        ServiceResponse wrongStore = service.call(ServiceRequest{SERVICE_GET_ORDER, 0, 0, 0, 8, id});
+        std::cout << "Unlisted recipe: " << (unlisted.status == SERVICE_NOT_ON_MENU ? "refused" : "accepted")
+                  << ", other store: " << (elsewhere.status == SERVICE_OK ? "accepted" : "refused")
+                  << ", wrong store: " << (wrongStore.status == SERVICE_UNKNOWN_ORDER ? "unknown order" : "found") << std::endl;
+        correct = correct && unlisted.status == SERVICE_NOT_ON_MENU && elsewhere.status == SERVICE_OK
+                  && wrongStore.status == SERVICE_UNKNOWN_ORDER;
+        
+        // Over the socket, from several POS clients at once
+        const std::string path = "pizzashop-service-test.sock";
+        OrderServer server(service, path);
+        server.start();
+        const int clientCount = 4;
+        const int ordersPerClient = 25;
+        std::vector<std::vector<std::uint64_t>> ids(clientCount);
+        std::atomic<int> failures(0);
+        std::vector<std::thread> clients;
+        for (int c = 0; c < clientCount; c++) {
+            clients.emplace_back([&, c] {
+                OrderClient client(path);
+                for (int i = 0; i < ordersPerClient; i++) {
+                    std::uint32_t store = static_cast<std::uint32_t>(c * ordersPerClient + i);
+                    ServiceResponse order = client.createOrder(store);
+                    ServiceResponse added = client.addPizza(store, order.orderId, INGEST_MEAT_LOVERS, SERVICE_STUFFED_CRUST);
+                    ServiceResponse closed = client.closeOrder(store, order.orderId);
+                    ServiceResponse gone = client.getOrder(store, order.orderId);
+                    if (order.status != SERVICE_OK || added.status != SERVICE_OK || closed.pizzaCount != 1
+                        || gone.status != SERVICE_UNKNOWN_ORDER) {
+                        failures++;
+                    }
+                    ids[c].push_back(order.orderId);
+                }
+            });
+        }
+        for (auto& client : clients) {
+            client.join();
+        }
+        std::vector<std::uint64_t> allIds;
+        for (const auto& clientIds : ids) {
+            allIds.insert(allIds.end(), clientIds.begin(), clientIds.end());
+        }
+        std::sort(allIds.begin(), allIds.end());
+        bool unique = std::adjacent_find(allIds.begin(), allIds.end()) == allIds.end();
+        
+        // One client after another: each hang-up is joined at the next accept
+        for (int i = 0; i < 20; i++) {
+            OrderClient shortLived(path);
+            shortLived.getOrder(7, id);
+        }
+        OrderClient late(path);
+        late.getOrder(7, id);
+        std::size_t serverThreads = server.getThreadCount();
+        std::cout << "Connection threads after 21 sequential clients: " << serverThreads << std::endl;
+        correct = correct && serverThreads <= 2;
+        server.stop();
+        ServiceResponse afterStop = late.getOrder(7, id);
+        std::cout << clientCount * ordersPerClient << " socket orders, " << failures << " failures, ids "
+                  << (unique ? "unique" : "repeated") << ", after stop: "
+                  << (afterStop.status == SERVICE_UNAVAILABLE ? "unavailable" : "answered") << std::endl;
+        correct = correct && failures == 0 && unique && afterStop.status == SERVICE_UNAVAILABLE;
+    }
+    EventLog::setSink(nullptr);
+    
+    std::cout << (correct ? "✅ Order service shards stores and answers over the socket\n"
+                          : "❌ Order service answered wrongly\n");
+}
+
+// Re-renders only when the menu version moved since its last render
+class VersionedObserver : public Observer {
+private:
+    Menu& menu;
+    std::uint64_t renderedVersion;
+    
+public:
+    int renders;
+    int skipped;
+    
+    explicit VersionedObserver(Menu& menu) : menu(menu), renderedVersion(menu.getVersion()), renders(0), skipped(0) {}
+    void update(const std::string&) override {
+        std::uint64_t version = menu.getVersion();
+        if (version == renderedVersion) {
+            skipped++;
+            return;
+        }
+        renderedVersion = version;
+        renders++;
+    }
+};
+
+void testMenuSnapshots() {
+    std::cout << "\n=== Testing Menu Snapshots ===\n";
+    
+    PizzaMenu menu;
+    std::vector<PizzaPtr> pizzas;
+    for (int i = 0; i < 200; i++) {
+        pizzas.push_back(i % 2 == 0 ? PizzaFactory::createMenuPizza<MenuRecipes::Pepperoni>()
+                                    : PizzaFactory::createMenuPizza<MenuRecipes::MeatLovers>());
+        menu.addPizza(pizzas.back().get());
+    }
+    std::shared_ptr<const MenuSnapshot> before = menu.snapshot();
+    bool matches = before->getVersion() == 200 && before->size() == 200;
+    for (std::size_t i = 0; i < before->size(); i++) {
+        const MenuItem& item = (*before)[i];
+        matches = matches && item.id == menu.getPizzaId(item.pizza) && item.name == item.pizza->getName()
+                  && item.price == item.pizza->getPrice();
+    }
+    
+    // Removing position 3 swaps the last pizza into it: only the first and last chunks change
+    Pizza* removed = (*before)[3].pizza;
+    menu.removePizza(removed);
+    std::shared_ptr<const MenuSnapshot> after = menu.snapshot();
+    bool unchanged = before->size() == 200 && (*before)[3].pizza == removed;
+    bool shared = after->getChunk(1) == before->getChunk(1) && after->getChunk(2) == before->getChunk(2)
+                  && after->getChunk(0) != before->getChunk(0) && after->getChunk(3) != before->getChunk(3);
+    std::cout << "Version " << before->getVersion() << " -> " << after->getVersion() << ", " << before->size() << " -> "
+              << after->size() << " pizzas, old snapshot " << (unchanged ? "unchanged" : "MODIFIED") << ", "
+              << (shared ? "middle chunks shared" : "chunks copied") << std::endl;
+    
+    VersionedObserver website(menu);
+    menu.addObserver(&website);
+    menu.notifyObservers("Pizza of the day: Pepperoni");
+    menu.addPizza(removed);
+    menu.notifyObservers("Pizza of the day: Pepperoni");
+    menu.removeObserver(&website);
+    std::cout << "Observer renders: " << website.renders << ", skipped: " << website.skipped << std::endl;
+    
+    // Readers never see a half-applied edit while a writer churns the menu
+    std::atomic<bool> stop(false);
+    std::atomic<int> torn(0);
+    std::atomic<long> reads(0);
+    std::vector<std::thread> readers;
+    for (int r = 0; r < 3; r++) {
+        readers.emplace_back([&] {
+            MenuReader reader(menu);
+            while (!stop) {
+                const MenuSnapshot& view = reader.current();
+                std::size_t listed = 0;
+                for (std::size_t i = 0; i < view.size(); i++) {
+                    if (view[i].id != 0 && !view[i].name.empty()) listed++;
+                }
+                if (listed != view.size() || view.size() < 190 || view.size() > 200) torn++;
+                reads++;
+            }
+        });
+    }
+    for (int i = 0; i < 2000; i++) {
+        Pizza* pizza = pizzas[(i * 37) % pizzas.size()].get();
+        menu.removePizza(pizza);
+        menu.addPizza(pizza);
+    }
+    stop = true;
+    for (auto& reader : readers) {
+        reader.join();
+    }
+    std::cout << "Concurrent reads: " << (reads > 0 ? "done" : "none") << ", torn: " << torn << std::endl;
+    
+    bool correct = matches && unchanged && shared && after->getVersion() == 201 && after->size() == 199
+                   && website.renders == 1 && website.skipped == 2 && torn == 0;
+    std::cout << (correct ? "✅ Menu snapshots are immutable, versioned and share chunks\n"
+                          : "❌ Menu snapshots are inconsistent\n");
+}
+
+// Steps an order to READY, letting the lane's other orders run in between
+OrderTask cookOrder(PlaceOrder& order) {
+    while (order.getStatus() != "READY") {
+        order.processOrder();
+        co_await OrderExecutor::yield();
+    }
+}
+
+OrderTask awaitPickup(PlaceOrder& order, std::atomic<int>& sawPreparing, std::atomic<int>& ready) {
+    bool preparing = co_await order.untilState("PREPARING");
+    bool finished = co_await order.untilState("READY");
+    if (preparing) sawPreparing++;
+    if (finished) ready++;
+}
+
+OrderTask awaitReady(PlaceOrder& order, int& outcome) {
+    bool reached = co_await order.untilState("READY");
+    outcome = reached ? 1 : 0;
+}
+
+OrderTask discardOrder(std::unique_ptr<PlaceOrder>& order) {
+    co_await OrderExecutor::yield();
+    order.reset();
+}
+
+OrderTask failingTask() {
+    co_await OrderExecutor::yield();
+    throw std::runtime_error("oven on fire");
+}
+
+void testOrderCoroutines() {
+    std::cout << "\n=== Testing Order Coroutines ===\n";
+    
+    NullSink nullSink;
+    EventLog::setSink(&nullSink);
+    const int orderCount = 2000;
+    std::atomic<int> sawPreparing(0);
+    std::atomic<int> ready(0);
+    int alreadyReady = -1;
+    int abandoned = -1;
+    bool rethrown = false;
+    bool allReady = true;
+    std::size_t lanes = 0;
+    {
+        OrderExecutor executor(2);
+        lanes = executor.getLaneCount();
+        std::vector<std::unique_ptr<PlaceOrder>> orders;
+        for (int i = 0; i < orderCount; i++) {
+            orders.emplace_back(new PlaceOrder());
+            orders.back()->setRandomSeed(static_cast<unsigned int>(i) * 2654435761u);
+            // The waiter and the cook share a lane, so they never race on the order
+            executor.spawn(awaitPickup(*orders.back(), sawPreparing, ready), i);
+            executor.spawn(cookOrder(*orders.back()), i);
+        }
+        executor.drain();
+        for (const auto& order : orders) {
+            allReady = allReady && order->getStatus() == "READY";
+        }
+        
+        // Already READY: the wait completes without suspending
+        executor.spawn(awaitReady(*orders.front(), alreadyReady), 0);
+        executor.drain();
+        
+        std::unique_ptr<PlaceOrder> forgotten(new PlaceOrder());
+        executor.spawn(awaitReady(*forgotten, abandoned), 7);
+        executor.spawn(discardOrder(forgotten), 7);
+        executor.drain();
+        
+        executor.spawn(failingTask());
+        try {
+            executor.drain();
+        } catch (const std::runtime_error&) {
+            rethrown = true;
+        }
+    }
+    EventLog::setSink(nullptr);
+    
+    // A misspelt status must not quietly wait for ORDER STARTED
+    bool typoRejected = false;
+    PlaceOrder typo;
+    try {
+        typo.untilState("Ready");
+    } catch (const std::invalid_argument&) {
+        typoRejected = true;
+    }
+    
+    std::cout << orderCount << " orders on " << lanes << " lanes: " << sawPreparing << " saw PREPARING, "
+              << ready << " resumed at READY" << std::endl;
+    std::cout << "Already READY: " << (alreadyReady == 1 ? "reached" : "not reached")
+              << ", destroyed order wakes its waiter with: " << (abandoned == 0 ? "not reached" : "reached")
+              << ", task failure " << (rethrown ? "rethrown by drain()" : "lost")
+              << ", unknown status " << (typoRejected ? "rejected" : "accepted") << std::endl;
+    bool correct = allReady && ready == orderCount && sawPreparing == orderCount && alreadyReady == 1 && abandoned == 0 && rethrown
+                   && typoRejected;
+    std::cout << (correct ? "✅ Coroutines resume on state changes without polling\n"
+                          : "❌ Coroutines missed state changes\n");
 }
 
 int main() {
@@ -405,10 +1817,35 @@ int main() {
     //edge case
     testDecoratorPrintMethods();
     testObserverRemoval();              // NEW
+    testObserverSelfRemoval();
     testMenuPizzaRemoval();             // NEW
     // state moving back
      testPreparingToPendingTransition();
     
+    testFlattenedPizzaRecord();
+    testOrderArena();
+    testToppingCatalog();
+    testCachedPizzaNames();
+    testBatchPricing();
+    testBatchedDiscounts();
+    testCompileTimeRecipes();
+    testAsyncNotifications();
+    testConcurrentMenus();
+    testMenuLookup();
+    testKitchenScheduler();
+    testSharedOrderStates();
+    testEventSinks();
+    testBinarySerialization();
+    testOrderJournal();
+    testOrderIngest();
+    testRuleDiscounts();
+    testDiscountRoundTrip();
+    testMetrics();
+    testInlineAddOns();
+    testOrderService();
+    testOrderCoroutines();
+    testMenuSnapshots();
+    
     std::cout << "\n=== All tests completed successfully ===\n";
     
     return 0;
@@ -0,0 +1,75 @@
+#!/usr/bin/env python3
+"""Compare two `./bench --micro --json=FILE` result files.
+
+Usage: bench_compare.py BASELINE.json CURRENT.json [--threshold PERCENT]
+                        [--alloc-tolerance ALLOCS]
+
+Each file holds one entry per repetition of every benchmark, taken in
+interleaved passes over the suite; they are grouped by run_name and
+compared by their fastest time and median allocations per iteration, so
+noisy repetitions cannot flag a regression. Exits with status 1 when
+any benchmark got slower than the threshold (default 10%), allocates more
+per iteration than the baseline beyond the tolerance (default 0.05
+allocations or 1%, whichever is larger), or is missing from the current
+run.
+"""
+import argparse
+import json
+import statistics
+import sys
+
+
+def load(path):
+    runs = {}
+    with open(path) as f:
+        for b in json.load(f)["benchmarks"]:
+            if b.get("run_type", "iteration") != "iteration":
+                continue
+            runs.setdefault(b.get("run_name", b["name"]), []).append(b)
+    return {name: {"real_time": min(r["real_time"] for r in reps),
+                   "allocations": statistics.median(r["allocations"] for r in reps),
+                   "repetitions": len(reps)}
+            for name, reps in runs.items()}
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Compare two ./bench --micro --json result files.")
+    parser.add_argument("baseline")
+    parser.add_argument("current")
+    parser.add_argument("--threshold", type=float, default=10.0, help="allowed slowdown in percent")
+    parser.add_argument("--alloc-tolerance", type=float, default=0.05,
+                        help="allowed increase in allocations per iteration (at least 1%% of the baseline)")
+    args = parser.parse_args()
+    threshold = args.threshold
+
+    baseline, current = load(args.baseline), load(args.current)
+    regressions = 0
+    print("%-40s %12s %12s %9s %14s" % ("benchmark", "base ns", "new ns", "change", "allocs"))
+    for name, result in current.items():
+        if name not in baseline:
+            print("%-40s %12s %12.1f %9s %14g" % (name, "-", result["real_time"], "new", result["allocations"]))
+            continue
+        before = baseline[name]
+        change = (result["real_time"] - before["real_time"]) / before["real_time"] * 100
+        allocs = "%g -> %g" % (before["allocations"], result["allocations"])
+        allowed = max(args.alloc_tolerance, before["allocations"] * 0.01)
+        flag = ""
+        if change > threshold or result["allocations"] > before["allocations"] + allowed:
+            flag = "  REGRESSION"
+            regressions += 1
+        print("%-40s %12.1f %12.1f %+8.1f%% %14s%s"
+              % (name, before["real_time"], result["real_time"], change, allocs, flag))
+    for name in baseline:
+        if name not in current:
+            print("%-40s %12.1f %12s %9s  REGRESSION" % (name, baseline[name]["real_time"], "-", "missing"))
+            regressions += 1
+
+    if regressions:
+        print("\n%d regression(s) beyond %g%% or missing" % (regressions, threshold))
+        return 1
+    print("\nNo regressions beyond %g%%" % threshold)
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())